@@ -1,8 +1,7 @@
 #ifndef FT_PING_H
 #define FT_PING_H
 
-#define _POSIX_C_SOURCE 200809L
-// #define _GNU_SOURCE
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -14,16 +13,38 @@
 #include <poll.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+
+#include <time.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <getopt.h>
 
 #include <sys/time.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/random.h>
 #include <sys/socket.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp6.h>
+#include <netinet/ip6.h>
 #include <netinet/ip.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+#include "ft_ping_shm.h"
+#include "ft_ping_checksum.h"
+#include <linux/io_uring.h>
+
 // #include <linux/ipv6.h>
 
 // #ifndef NI_MAXHOST
@@ -33,62 +54,361 @@
 #define PING_PKT_S 56 // Default size of ICMP packet payload
 #define TOTAL_HDR_S 28 // 8 bytes for ICMP header + 20 bytes for IPv4 header			
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+#define DEFAULT_INTERVAL_US 1000000L // 1 second between probes
+#define FLOOD_INTERVAL_US 10000L // flood mode sends at least 100 probes per second
+#define OPT_STATS_INTERVAL 256 // long option codes start past every short option character
+#define OPT_SHM 257
+#define OPT_METRICS_LISTEN 258
+#define OPT_PCAP 259
+#define OPT_PCAP_SIZE 260
+#define OPT_SIM 261
+#define OPT_RATE 262
+#define OPT_BURST 263
+#define RATE_MAX 10000000.0 // largest --rate, one probe every 100 ns
+#define PACKET_TABLE_MIN 16 // smallest in-flight table
+#define PACKET_TABLE_MAX 65536 // one slot per 16-bit sequence number
+#define PRELOAD_MAX 65536 // largest -l burst, one full sequence space
+#define SEND_BATCH 64 // probes per sendmmsg() call
+#define RECV_BATCH 64 // datagrams per recvmmsg() call
+#define RECV_BATCH_BYTES (1 << 20) // receive buffers are capped at 1 MiB in total
+#define PACKET_HEAD_S (sizeof(struct icmphdr) + sizeof(struct timeval)) // per-probe bytes of a batched send
+#define RX_CONTROL_S 256 // control buffer per received datagram (timestamps)
+#define EPOLL_EVENTS 16 // ready descriptors handled per epoll_wait() call
+
+#define IO_EPOLL 0 // readiness loop: epoll_wait() plus sendmmsg() / recvmmsg()
+#define IO_URING 1 // completion loop: io_uring multishot receives and batched sends
+#define IO_SIM 2 // simulated network under a virtual clock, no sockets
+#define URING_ENTRIES 256 // submission queue entries
+#define URING_CQ_ENTRIES 4096 // completion queue entries, room for reply bursts
+#define URING_BUFFERS 256 // provided receive buffers per socket, a power of two
+#define URING_ERRQUEUE_BATCH 16 // error queue reads in flight per socket
+#define SIM_DELAY_NS NSEC_PER_MSEC // default simulated RTT
+#define SIM_LIMIT 65536 // default replies the simulated network holds at once
+#define SIM_LIMIT_MAX (1 << 22)
+#define SIM_QUEUE_BYTES (256 << 20) // the queue limit is lowered to keep its buffers under this
+#define SIM_POLL_TURNS 1024 // loop turns between checks for signals and the stop descriptor
+#define SIM_UNIFORM 0 // delay +- jitter, uniformly
+#define SIM_NORMAL 1 // delay + normally distributed jitter
+#define SIM_PARETO 2 // delay + a heavy tailed excess (shape 3) averaging jitter
+
+#define OUTPUT_TEXT 0 // iputils style text
+#define OUTPUT_JSON 1 // one JSON object per line
+#define OUTPUT_CSV 2 // one CSV row per line, after a header row
+#define OUTPUT_BUFFER_S (1 << 20) // structured output is written in chunks of up to 1 MiB
+#define OUTPUT_RECORD_MAX 2048 // longest formatted record, the buffer is flushed when less is left
+#define OUTPUT_FLUSH_NS (100 * NSEC_PER_MSEC) // longest a record waits in the output buffer
+#define OUTPUT_RING_S (1 << 14) // records queued for the -A writer thread, a power of two
+
+#define RECORD_REPLY 0 // echo reply received
+#define RECORD_ERROR 1 // ICMP error received for a probe
+#define RECORD_TIMEOUT 2 // probe expired without an answer
+#define RECORD_FLOOD_MARK 3 // -f dot printed or erased, sequence 1 for a reply
+
+#define METRICS_CLIENTS 8 // scrapes served at once, a new one evicts the oldest
+#define METRICS_REQUEST_S 2048 // longest HTTP request head accepted
+#define METRICS_RESPONSE_S 16384 // initial response buffer, grown with the number of targets
+#define METRICS_HEADER_S 256 // room reserved for the HTTP header in front of the body
+
+#define PCAP_BUFFER_S (1 << 20) // captured packets are written in chunks of up to 1 MiB
+#define PCAP_COMMENT_S 64 // longest per-packet comment
+#define PCAP_RECORD_MAX (32 + 40 + 65535 + 8 + PCAP_COMMENT_S) // block, IPv6 header, datagram, options
+#define PCAP_SIZE_MAX 65536 // largest --pcap-size, in MiB
+#define LINKTYPE_IPV4 228 // pcapng link types of the IPv4 and IPv6 interfaces
+#define LINKTYPE_IPV6 229
+
+#define ERROR_TIME_EXCEEDED 0 // index in t_ping_stats.error_types
+#define ERROR_UNREACHABLE 1
+
+#define TS_MONOTONIC 0 // RTT from CLOCK_MONOTONIC read around the syscalls
+#define TS_KERNEL 1 // RTT from SO_TIMESTAMPING software TX/RX timestamps
+#define TS_VIRTUAL 2 // RTT from the virtual clock of -E sim
+
+#define DEADLINE_QUEUE_MAX (1 << 22) // largest deadline queue, probes in flight across all targets
+#define SHARDS_MAX 256 // largest -j, each shard takes its own ICMP identifier
+#define FAMILY_IDX(family) ((family) == AF_INET ? 0 : 1) // index of per-family sockets and templates
 
 typedef struct s_ping_pkg {
 	struct icmphdr	header;
 	char			msg[];
 } t_ping_pkg;
 
+#define HIST_SUB_BITS 6 // 64 sub-buckets per power of two, ~1.6% precision
+#define HIST_COARSE_BITS 4 // per-target histograms: 16 sub-buckets, ~6% precision
+#define HIST_MAX_BITS 42 // RTTs up to 2^42 ns (~73 minutes)
+#define HIST_BUCKETS(bits) ((HIST_MAX_BITS - (bits) + 2) << (bits))
+
+typedef struct s_rtt_histogram {
+	uint32_t	*counts;	// log-linear buckets of RTT in ns, allocated on the first value
+	uint64_t	total;
+	int			coarse;		// HIST_COARSE_BITS sub-buckets instead of HIST_SUB_BITS
+} t_rtt_histogram;
+
 typedef struct s_packet_entry {
-	uint16_t				sequence;
-	t_ping_pkg				*packet;
-	struct timeval			send_time;
-	struct s_packet_entry	*next;
+	uint16_t	sequence;
+	int			in_use;
+	int64_t		send_time;	// monotonic ns, drives timeouts
+	int64_t		tx_stamp;	// ns on the timestamp source clock, drives RTT
+	uint32_t	tx_key;		// SO_TIMESTAMPING key of the datagram
 } t_packet_entry;
 
-typedef struct s_rtt_entry {
-	double				rtt;
-	struct s_rtt_entry	*next;
-} t_rtt_entry;
+typedef struct s_packet_table {
+	t_packet_entry	*slots;		// indexed by sequence & mask
+	size_t			mask;		// capacity - 1, capacity is a power of two
+	size_t			in_flight;
+} t_packet_table;
+
+typedef struct s_deadline {
+	int64_t		deadline;	// monotonic ns
+	uint32_t	target;		// index in state->targets
+	uint16_t	sequence;
+} t_deadline;
+
+typedef struct s_deadline_queue {
+	t_deadline	*entries;	// ring in send order, which is deadline order
+	size_t		mask;		// capacity - 1, capacity is a power of two
+	size_t		head;
+	size_t		tail;
+} t_deadline_queue;
+
+typedef struct s_echo_template {
+	t_ping_pkg	*packet;	// prebuilt echo request, patched per probe
+	uint16_t	sum;		// folded one's complement sum of the unpatched template
+} t_echo_template;
+
+typedef struct s_tx_key {
+	uint32_t	target;		// index in state->targets
+	uint16_t	sequence;
+} t_tx_key;
+
+typedef struct s_ping_stats {
+	long			packets_sent;
+	long			packets_received;
+	double			min_rtt; 
+	double			max_rtt; 
+	double			avg_rtt;
+	double			sum_rtt;
+	long			rtt_count;	// replies that carried an RTT
+	double			rtt_mean;	// Welford running mean
+	double			rtt_m2;		// Welford sum of squared deviations
+	double			rtt_ewma;	// moving average weighting each new RTT 1/8, like iputils
+	t_rtt_histogram	rtt_hist;
+	struct timeval	first_packet_time;
+	struct timeval	last_packet_time;
+	int				errors;
+	long			error_types[2];	// errors by ERROR_TIME_EXCEEDED / ERROR_UNREACHABLE
+	long			timeouts;	// probes expired unanswered
+} t_ping_stats;
+
+typedef struct s_target {
+	char					*name;		// as given on the command line or in the targets file
+	int						family;
+	socklen_t				addr_len;
+	struct sockaddr_storage	addr;
+	char					addr_str[INET6_ADDRSTRLEN];
+	uint16_t				sequence;	// next sequence number to send
+	t_packet_table			packets;
+	t_ping_stats			stats;
+	t_shm_target			*shm;		// block in the --shm segment, NULL if none
+	int						send_errno;	// last send error reported for the target, 0 if none
+} t_target;
+
+typedef struct s_probe_record {
+	t_target		*target;
+	int64_t			time_ns;	// CLOCK_REALTIME ns the result was known
+	int64_t			rtt_ns;		// round-trip time, -1 if none
+	int64_t			timeout_ns;	// -W of the probe
+	union {
+		struct sockaddr		sa;
+		struct sockaddr_in	v4;
+		struct sockaddr_in6	v6;
+	}				from;		// sender of an error
+	uint32_t		size;		// ICMP bytes received
+	uint16_t		sequence;
+	int16_t			ttl;		// -1 if none
+	uint8_t			type;		// RECORD_REPLY, RECORD_ERROR, RECORD_TIMEOUT or RECORD_FLOOD_MARK
+	uint8_t			icmp_type;	// error type and code, 0 otherwise
+	uint8_t			icmp_code;
+} t_probe_record;
+
+typedef struct s_pcap_file {
+	int				fd;
+	char			*map;		// preallocated --pcap-size mapping, NULL for buffered writes
+	size_t			size;		// size of the mapping
+	uint64_t		used;		// bytes reserved in the mapping, shared by the shards
+	uint64_t		limit;		// where the first record that did not fit would have started
+	uint64_t		dropped;	// records that did not fit in the mapping
+	int64_t			clock_offset;	// CLOCK_REALTIME - CLOCK_MONOTONIC when the file was opened
+} t_pcap_file;
+
+typedef struct s_metrics_client {
+	int			fd;			// -1 when the slot is free
+	uint64_t	accepted;	// accept order, the lowest is evicted first
+	size_t		len;		// request bytes read
+	char		request[METRICS_REQUEST_S];
+	char		*response;	// NULL until the request is complete
+	size_t		response_len;	// end of the response in the buffer
+	size_t		sent;		// offset of the next byte to send
+} t_metrics_client;
+
+typedef struct s_target_map {
+	uint32_t	*slots;		// target index + 1 by address hash, 0 when empty
+	size_t		mask;
+} t_target_map;
+
+typedef struct s_uring t_uring; // io_uring backend state, private to srcs/uring.c
+typedef struct s_sim t_sim; // simulated network state, private to srcs/sim.c
+
+typedef struct s_sim_config {
+	int64_t		delay;		// ns, mean RTT
+	int64_t		jitter;		// ns, spread of the RTT around delay
+	int			distribution;	// SIM_UNIFORM, SIM_NORMAL or SIM_PARETO
+	double		loss;		// probability a reply is dropped
+	double		duplicate;	// probability a reply is delivered twice
+	double		reorder;	// probability a reply skips the delay and overtakes earlier ones
+	double		corrupt;	// probability a bit of the reply's ICMP message is flipped
+	uint64_t	seed;		// random stream, offset per shard
+	size_t		limit;		// replies held at once, more are dropped
+} t_sim_config;
 
 typedef struct s_ping_state {
-	t_packet_entry	*sent_packets;  
+	t_target			*targets;
+	size_t				ntargets;
+	size_t				target_cap;
+	t_target_map		target_map;
+	t_deadline_queue	deadlines;
+	t_echo_template		templates[2];	// by FAMILY_IDX
 	struct {
-		char	*target;
-		int		target_family;
+		int		socktype;	// SOCK_RAW, or SOCK_DGRAM for unprivileged ICMP sockets
 		struct {
-			int					sockfd;
-			int 				family;                    
-			int 				protocol;
-			uint16_t 			pid;                 
-			socklen_t 			addr_len;         
-			struct sockaddr_in	addr;
-			char				addr_str[INET_ADDRSTRLEN];
+			int			sockfd;
+			uint16_t	pid;
 		} ipv4;
 		struct {
-			int					sockfd;
-			int					family;                    
-			int 				protocol;
-			uint16_t 			pid;                 
-			socklen_t 			addr_len;          
-			struct sockaddr_in6	addr;     
-			char				addr_str[INET6_ADDRSTRLEN];
+			int			sockfd;
+			uint16_t	pid;
 		} ipv6;
 	} conn;
 	struct {
-		long			packets_sent;
-		long			packets_received;
-		double			min_rtt; 
-		double			max_rtt; 
-		double			avg_rtt;
-		double			sum_rtt;
-		t_rtt_entry		*rtt_list;
-		struct timeval	first_packet_time;
-		struct timeval	last_packet_time;
-		int				preload_sent;
-		int				transmission_complete;
-		int				errors;
-	} stats;
+		int64_t	next_send;		// monotonic ns at which the next probe is due
+		int64_t	period;			// ns between probes across all targets
+		size_t	next_target;	// round robin position
+		long	preload_sent;
+		long	preload_total;	// preload probes across all targets
+		long	remaining;		// probes left to send across all targets, -1 without -c
+		size_t	in_flight;		// probes in flight across all targets
+		int		transmission_complete;
+	} sched;
+	struct {
+		long			count;	// probes sent on schedule
+		double			mean;	// Welford running mean of how late they left, ns
+		double			m2;		// Welford sum of squared deviations
+		int64_t			max;
+		t_rtt_histogram	hist;	// how late they left, ns
+	} send_jitter;
+	struct {
+		struct mmsghdr	msgs[SEND_BATCH];
+		struct iovec	iovs[SEND_BATCH][2];	// per-probe head, shared template tail
+		char			heads[SEND_BATCH][PACKET_HEAD_S];
+		t_target		*targets[SEND_BATCH];
+		uint16_t		sequences[SEND_BATCH];
+		int				errors[SEND_BATCH];	// errno the kernel rejected each probe with, 0 if sent
+		int				count;
+	} tx[2];	// by FAMILY_IDX
+	struct {
+		struct mmsghdr			*msgs;
+		struct iovec			*iovs;
+		struct sockaddr_storage	*addrs;
+		char					*buffers;
+		char					*controls;	// RX_CONTROL_S bytes per datagram
+		size_t					count;		// datagrams per recvmmsg() call
+		size_t					buf_size;	// bytes per datagram buffer
+	} rx;
+	struct {
+		int			source;		// TS_KERNEL, TS_MONOTONIC or TS_VIRTUAL
+		uint32_t	tx_key[2];	// SO_TIMESTAMPING key of the next datagram sent, by FAMILY_IDX
+		t_tx_key	*tx_map[2];	// probe sent with each key, indexed by key & deadlines.mask
+	} ts;
+	t_ping_stats		stats;	// totals across all targets
+	struct {
+		int			attached;		// socket filters are in place
+		uint64_t	icmp_in[2];		// kernel ICMP InMsgs when attached, by FAMILY_IDX
+		uint32_t	drops[2];		// socket drop counters when attached, by FAMILY_IDX
+		uint64_t	delivered[2];	// datagrams read from each socket, by FAMILY_IDX
+		uint64_t	overflowed[2];	// datagrams each socket lost to a full receive buffer, by FAMILY_IDX
+		uint64_t	rejected;		// ICMP messages the filters kept out of userspace
+		uint64_t	dropped;		// datagrams lost to a full receive buffer
+	} filter;
+	struct {
+		int		index;		// shard number, offsets the ICMP identifier
+		int		count;		// number of shards, 1 when single threaded
+		int		stop_fd;	// eventfd that stops the event loop, -1 if none
+		int		done_fd;	// eventfd each worker adds 1 to when its loop returns
+		int		status_fd;	// eventfd that asks the worker for interim statistics, -1 if none
+		struct s_ping_state	*workers;	// shard states, set in the main thread of a -j run
+	} shard;
+	struct {
+		char	*buffer;		// OUTPUT_BUFFER_S bytes of formatted records
+		size_t	len;
+		int64_t	flushed_at;		// monotonic ns of the last flush
+	} output;
+	struct {
+		t_probe_record	*ring;		// OUTPUT_RING_S records, NULL without -A
+		uint64_t		tail __attribute__((aligned(64)));	// next slot the probe loop fills
+		uint64_t		dropped;	// records lost on a full ring
+		uint64_t		head __attribute__((aligned(64)));	// next record the writer formats
+		int				sleeping;	// set while the writer waits on wake_fd
+		int				stop;		// set by the probe loop when it is done
+		int				wake_fd;	// eventfd the probe loop wakes the writer with
+		int				started;
+		pthread_t		thread;
+	} writer;
+	struct {
+		t_shm_header	*header;	// mapped --shm segment, NULL if none
+		size_t			size;
+		char			path[PATH_MAX];
+	} shm;
+	struct {
+		int					listen_fd;	// --metrics-listen socket, -1 if none
+		int					armed;		// a readiness wait is pending on listen_fd
+		uint64_t			accepted;	// connections accepted so far
+		t_metrics_client	clients[METRICS_CLIENTS];
+	} metrics;
+	struct {
+		t_pcap_file	*file;		// --pcap capture shared by every shard, NULL if none
+		int			owner;		// this state opened the file and closes it
+		char		*buffer;	// records waiting to be written, without --pcap-size
+		size_t		len;
+		int64_t		rtt_ns;		// RTT of the datagram being parsed, -1 if none
+	} pcap;
+	struct {
+		int				backend;	// IO_EPOLL, IO_URING or IO_SIM (-E flag)
+		uint64_t		syscalls;	// I/O and event loop syscalls made
+		uint64_t		bad_checksums;	// ICMP messages dropped on a checksum mismatch
+		t_uring			*uring;		// io_uring state, NULL with epoll
+	} io;
+	struct {
+		t_sim		*net;		// simulated network, NULL unless -E sim
+		int64_t		now;		// virtual clock, starts at CLOCK_MONOTONIC and jumps between events
+		int64_t		wall_offset;	// CLOCK_REALTIME - virtual clock
+		uint64_t	lost;		// replies dropped by the simulated network
+		uint64_t	duplicated;
+		uint64_t	reordered;
+		uint64_t	corrupted;
+		uint64_t	overflowed;	// replies dropped on a full queue
+	} sim;
+	struct {
+		int		epoll_fd;	// epoll instance of the event loop
+		int		timer_fd;	// CLOCK_MONOTONIC timerfd armed for the next send or expiry
+		int		signal_fd;	// signalfd of the termination signals, -1 in shard workers
+		int64_t	armed;		// absolute deadline the timer is armed for, 0 if disarmed
+		int		signal;		// signal that stopped the run, 0 if none
+		int64_t	status_at;	// monotonic ns of the next --stats-interval summary, 0 if none
+	} loop;
 	struct {
 		int		verbose;	// -v flag
 		int		count;		// -c flag
@@ -96,6 +416,20 @@ typedef struct s_ping_state {
 		int		preload;	// -l flag
 		int		timeout;	// -W flag (in seconds)
 		int		ttl;		// -t flag (time to live)
+		long	interval;	// -i flag (in microseconds)
+		int		flood;		// -f flag
+		int		threads;	// -j flag
+		int		backend;	// -E flag, requested I/O backend
+		int		format;		// -o flag, OUTPUT_TEXT, OUTPUT_JSON or OUTPUT_CSV
+		int		async;		// -A flag
+		long	stats_interval;	// --stats-interval (in microseconds), 0 if none
+		char	*shm_name;	// --shm, segment name under /dev/shm, NULL if none
+		char	*metrics_listen;	// --metrics-listen, [address:]port, NULL if none
+		char	*pcap_path;	// --pcap, capture file, NULL if none
+		long	pcap_size;	// --pcap-size in bytes, 0 for buffered writes
+		t_sim_config	sim;	// --sim, simulated network of -E sim
+		double	rate;		// --rate, probes per second across all targets, 0 if unpaced
+		long	burst;		// --burst, probes the --rate token bucket holds
 	} opts;
 } t_ping_state;
 
@@ -103,49 +437,143 @@ typedef struct s_icmp_context {
 	char					*buffer;
 	ssize_t 				bytes_received;
 	struct sockaddr_storage	*from;
+	int						family;		// family of the socket the datagram arrived on
+	int64_t					rx_time;	// ns on the timestamp source clock
+	int						ttl;		// TTL or hop limit from control data, -1 if none
 	struct iphdr			*ip_header;
 	struct icmphdr			*icmp_header;
+	t_target				*target;
 	uint16_t				packet_id;
 	uint16_t				sequence;
 	uint16_t				expected_pid;
 } t_icmp_context;
 
 // signals
-void			handleSignals(int signum, siginfo_t *info, void *ptr);
-void			setupSignals(t_ping_state *state);
+int				handleSignals(t_ping_state *state);
+int				setupSignals(t_ping_state *state);
+int				interrupted(t_ping_state *state);
+void			handle_status_request(t_ping_state *state);
 // args
 int				parseArgs(t_ping_state *state, int argc, char **argv);
+// targets
+int				add_target(t_ping_state *state, const char *name);
+int				load_target_file(t_ping_state *state, const char *path);
+int				init_target_map(t_ping_state *state);
+t_target*		find_target(t_ping_state *state, struct sockaddr *addr);
+int				all_targets_answered(t_ping_state *state);
+void			cleanup_targets(t_ping_state *state);
+// shards
+int				run_shards(t_ping_state *state, char **argv);
+// filter
+int				init_filters(t_ping_state *state);
+void			read_socket_drops(t_ping_state *state);
+void			merge_filter_stats(t_ping_state *state, t_ping_state *shard);
+void			read_filter_stats(t_ping_state *state);
 // network
 int				resolveHost(t_ping_state *state, char **argv);
 int				createSocket(t_ping_state *state, char **argv);
-int				receive_packet(t_ping_state *state, int sockfd);
-int				send_ping(t_ping_state *state, uint16_t *sequence, int target_sockfd);
+int				init_batches(t_ping_state *state);
+void			cleanup_batches(t_ping_state *state);
+int				receive_packets(t_ping_state *state, int sockfd);
+void			receive_errors(t_ping_state *state, int sockfd);
+int				handle_datagram(t_ping_state *state, int f, struct msghdr *msg, char *buffer, size_t len, int64_t returned_at);
+void			handle_queued_message(t_ping_state *state, int family, struct msghdr *msg, size_t len);
+void			init_schedule(t_ping_state *state);
+int				send_ping(t_ping_state *state);
 // poll
-int				setupPoll(t_ping_state *state, struct pollfd *fds);
+int				setupPoll(t_ping_state *state);
+void			cleanup_poll(t_ping_state *state);
+int				run_event_loop(t_ping_state *state);
 void			handle_timeouts(t_ping_state *state);
-int				get_next_poll_timeout(t_ping_state *state);
+int64_t			next_wakeup(t_ping_state *state);
+void			watch_once(t_ping_state *state, int fd, uint32_t events);
+// pcap
+int				init_pcap(t_ping_state *state);
+void			pcap_probe(t_ping_state *state, int f, int index, int64_t sent_at);
+void			pcap_datagram(t_ping_state *state, int f, struct sockaddr *from, char *buffer, size_t len, int64_t rx_time, int ttl);
+void			cleanup_pcap(t_ping_state *state);
+// metrics
+int				init_metrics(t_ping_state *state);
+int				handle_metrics(t_ping_state *state, int fd);
+void			cleanup_metrics(t_ping_state *state);
+// output
+int				init_output(t_ping_state *state);
+void			output_header(t_ping_state *state);
+void			output_record(t_ping_state *state, t_probe_record *record);
+void			output_summary(t_ping_state *state, const char *name, t_ping_stats *stats);
+void			output_tick(t_ping_state *state, int64_t now);
+void			output_flush(t_ping_state *state);
+void			cleanup_output(t_ping_state *state);
+int64_t			wall_ns(void);
+// shm
+int				init_shm(t_ping_state *state);
+void			publish_stats(t_target *target);
+void			cleanup_shm(t_ping_state *state);
+// writer
+int				init_writer(t_ping_state *state);
+void			emit_record(t_ping_state *state, t_probe_record *record);
+void			stop_writer(t_ping_state *state);
+// uring
+int				init_uring(t_ping_state *state);
+void			cleanup_uring(t_ping_state *state);
+int				uring_sendmmsg(t_ping_state *state, int sockfd, struct mmsghdr *msgs, int count);
+int				run_uring_loop(t_ping_state *state);
+void			uring_watch_once(t_ping_state *state, int fd, uint32_t events);
+const char		*io_backend_str(t_ping_state *state);
 long			timeval_diff_ms(struct timeval *start, struct timeval *end);
+int64_t			now_ns(void);
+int64_t			clock_now(t_ping_state *state);
+int64_t			clock_wall(t_ping_state *state);
+// sim
+int				parse_sim_config(const char *spec, t_sim_config *config);
+int				init_sim(t_ping_state *state);
+void			cleanup_sim(t_ping_state *state);
+int				sim_sendmmsg(t_ping_state *state, int f, struct mmsghdr *msgs, int count);
+int				run_sim_loop(t_ping_state *state);
 // packets
-t_packet_entry*	create_packet(t_ping_state *state, uint16_t sequence);
-t_packet_entry*	find_packet(t_ping_state *state, uint16_t sequence);
-uint16_t		calculate_checksum(t_ping_state *state, uint16_t sequence);
 int				init_packet_system(t_ping_state *state);
-void			remove_packet(t_ping_state *state, uint16_t sequence);
+t_packet_entry*	create_packet(t_ping_state *state, t_target *target, uint16_t sequence);
+t_packet_entry*	find_packet(t_target *target, uint16_t sequence);
+void			remove_packet(t_ping_state *state, t_target *target, uint16_t sequence);
+int				push_deadline(t_ping_state *state, t_target *target, t_packet_entry *packet);
+void			expire_packets(t_ping_state *state, int64_t now);
+int64_t			next_packet_deadline(t_ping_state *state);
 void			cleanup_packets(t_ping_state *state);
-void			fill_packet_data(t_ping_state *state, uint16_t sequence);
+void			fill_packet_data(t_ping_state *state, t_ping_pkg *packet);
+void			stamp_packet(t_ping_state *state, t_echo_template *tmpl, uint16_t sequence);
+uint16_t		calculate_checksum(t_ping_state *state, t_ping_pkg *packet);
 // icmp
-int				parse_icmp_reply(char *buffer, ssize_t bytes_received, t_ping_state *state, struct sockaddr_storage *from);
+int				parse_icmp_reply(char *buffer, ssize_t bytes_received, t_ping_state *state, struct sockaddr_storage *from, int64_t rx_time, int ttl);
+int				parse_queued_error(t_ping_state *state, struct msghdr *msg, size_t bytes);
+const char		*icmp_error_str(int family, uint8_t type);
+// timestamps
+int				init_timestamps(t_ping_state *state);
+void			cleanup_timestamps(t_ping_state *state);
+int64_t			timestamp_now(t_ping_state *state);
+const char		*timestamp_source_str(t_ping_state *state);
+int64_t			message_timestamp(struct msghdr *msg);
+void			record_tx_timestamp(t_ping_state *state, t_target *target, t_packet_entry *packet, int64_t sent_at);
+void			handle_tx_timestamp(t_ping_state *state, int family, struct msghdr *msg);
 // rtt 
-double			calculate_rtt(char *buffer, struct iphdr *ip_header, size_t icmp_data_size, int family);
-double			calculate_mean_deviation(t_ping_state *state);
-void			update_rtt_stats(t_ping_state *state, double rtt);
-void			cleanup_rtt_list(t_ping_state *state);
+double			calculate_rtt(t_packet_entry *packet, int64_t rx_time, size_t icmp_data_size);
+double			calculate_mean_deviation(t_ping_stats *stats);
+void			update_rtt_stats(t_ping_stats *stats, double rtt);
+void			merge_stats(t_ping_stats *into, t_ping_stats *from);
+void			histogram_record(t_rtt_histogram *hist, int64_t value);
+int64_t			histogram_percentile(t_rtt_histogram *hist, double percentile);
+void			histogram_cumulative(t_rtt_histogram *hist, const int64_t *bounds, size_t count, uint64_t *below);
+void			histogram_merge(t_rtt_histogram *into, t_rtt_histogram *from);
+void			histogram_free(t_rtt_histogram *hist);
 //verbose
 void			print_usage(char *arg, char opt);
 void			print_stats(t_ping_state *state);
+void			print_status(t_ping_state *state);
 void			print_verbose_info(t_ping_state *state);
 void			print_default_info(t_ping_state *state);
-void			print_ping_reply(t_ping_state *state, size_t icmp_size, struct icmphdr *icmp_header, int ttl, double rtt);
-void			print_icmp_error(t_icmp_context *ctx, const char *error_message);
+void			print_ping_reply(t_ping_state *state, t_target *target, size_t icmp_size, struct icmphdr *icmp_header, int ttl, double rtt);
+void			print_icmp_error(t_ping_state *state, t_icmp_context *ctx, uint8_t type, uint8_t code);
+void			print_timeout(t_ping_state *state, t_target *target, uint16_t sequence);
+void			print_flood_mark(t_ping_state *state, int reply);
+void			print_record(t_ping_state *state, t_probe_record *record);
 
 #endif
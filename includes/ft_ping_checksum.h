@@ -0,0 +1,22 @@
+#ifndef FT_PING_CHECKSUM_H
+#define FT_PING_CHECKSUM_H
+
+/*
+ * Internet checksum (RFC 1071) and its incremental update (RFC 1624), shared
+ * by ft_ping and ft_ping_echo, which links srcs/checksum.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint16_t		inet_checksum(const void *data, size_t len);
+uint16_t		inet_checksum_scalar(const void *data, size_t len);
+uint16_t		inet_checksum_fold(uint64_t sum);
+uint16_t		inet_checksum_adjust(uint16_t checksum, uint16_t before, uint16_t after);
+const char		*inet_checksum_kernel(void);
+#if defined(__x86_64__) || defined(__i386__)
+uint16_t		inet_checksum_sse2(const void *data, size_t len);
+uint16_t		inet_checksum_avx2(const void *data, size_t len);
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef FT_PING_SHM_H
+#define FT_PING_SHM_H
+
+/*
+ * Layout of the statistics segment ft_ping --shm <name> publishes in
+ * /dev/shm/<name>, for monitors that sample it without parsing stdout. The
+ * header is followed by ntargets blocks of target_size bytes. Each block has
+ * a single writer, the probe loop owning the target, and is guarded by its own
+ * seqlock: read it with shm_read_target()
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define SHM_MAGIC 0x676e6970 // "ping" in little endian
+#define SHM_VERSION 1 // bumped when fields change meaning, new fields only grow target_size
+#define SHM_NAME_S 64 // target name, truncated
+#define SHM_ADDR_S 48 // numeric target address
+
+typedef struct s_shm_header {
+	uint32_t	magic;			// SHM_MAGIC once the segment is initialized
+	uint32_t	version;		// SHM_VERSION
+	uint32_t	header_size;	// offset of the first target block
+	uint32_t	target_size;	// stride of the target blocks
+	uint32_t	ntargets;
+	int32_t		pid;			// process publishing the segment
+	int32_t		running;		// 0 once the run has ended
+	int32_t		reserved;
+	int64_t		started_ns;		// CLOCK_REALTIME ns the segment was created
+} __attribute__((aligned(64))) t_shm_header;
+
+typedef struct s_shm_target {
+	uint64_t	seq;			// seqlock, odd while the block is being updated
+	uint64_t	sent;
+	uint64_t	received;		// replies and ICMP errors, like the final statistics
+	uint64_t	errors;
+	uint64_t	rtt_count;		// replies that carried an RTT
+	int64_t		min_rtt_ns;
+	int64_t		max_rtt_ns;
+	int64_t		sum_rtt_ns;
+	char		name[SHM_NAME_S];
+	char		addr[SHM_ADDR_S];
+} __attribute__((aligned(64))) t_shm_target;
+
+/**
+ * @param header - mapped segment
+ * @param index - target index, below header->ntargets
+ * @return the target's block
+ */
+static inline t_shm_target *shm_target(t_shm_header *header, uint32_t index) {
+	return (t_shm_target*)((char*)header + header->header_size + (size_t)index * header->target_size);
+}
+
+/**
+ * @param block - target block in the mapped segment
+ * @param copy - consistent snapshot of the block
+ *
+ * Copies a block, retrying while the writer is updating it. The writer never
+ * waits for readers, so a reader may retry but never slows the probe loop
+ */
+static inline void shm_read_target(t_shm_target *block, t_shm_target *copy) {
+	uint64_t seq;
+
+	do {
+		while ((seq = __atomic_load_n(&block->seq, __ATOMIC_ACQUIRE)) & 1) {
+		}
+		copy->sent = __atomic_load_n(&block->sent, __ATOMIC_RELAXED);
+		copy->received = __atomic_load_n(&block->received, __ATOMIC_RELAXED);
+		copy->errors = __atomic_load_n(&block->errors, __ATOMIC_RELAXED);
+		copy->rtt_count = __atomic_load_n(&block->rtt_count, __ATOMIC_RELAXED);
+		copy->min_rtt_ns = __atomic_load_n(&block->min_rtt_ns, __ATOMIC_RELAXED);
+		copy->max_rtt_ns = __atomic_load_n(&block->max_rtt_ns, __ATOMIC_RELAXED);
+		copy->sum_rtt_ns = __atomic_load_n(&block->sum_rtt_ns, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&block->seq, __ATOMIC_RELAXED) != seq);
+	copy->seq = seq;
+	memcpy(copy->name, block->name, sizeof(copy->name));
+	memcpy(copy->addr, block->addr, sizeof(copy->addr));
+}
+
+#endif
@@ -25,15 +25,70 @@ static int parse_int_range(const char *str, const char *name, long min, long max
 	return 0;
 }
 
+/**
+ * @param str - string to parse, in seconds with optional fraction (e.g. "0.2")
+ * @param result - pointer to store parsed interval in microseconds
+ * @return 0 on success, -1 on failure
+ * 
+ * Parses send interval and validates it, keeping microsecond resolution
+ */
+static int parse_interval(const char *str, long *result) {
+	char *endptr;
+	errno = 0;
+	double val = strtod(str, &endptr);
+	
+	if (errno != 0 || endptr == str || *endptr != '\0' || val < 0.0 || val > 2099999.0) {
+		fprintf(stderr, "ft_ping: invalid interval: %s (must be 0-2099999 seconds)\n", str);
+		return -1;
+	}
+	
+	*result = (long)(val * 1000000.0 + 0.5);
+	return 0;
+}
+
+/**
+ * @param str - string to parse, in probes per second with optional fraction
+ * @param result - pointer to store parsed rate
+ * @return 0 on success, -1 on failure
+ */
+static int parse_rate(const char *str, double *result) {
+	char *endptr;
+	errno = 0;
+	double val = strtod(str, &endptr);
+	
+	if (errno != 0 || endptr == str || *endptr != '\0' || !(val >= 0.001 && val <= RATE_MAX)) {
+		fprintf(stderr, "ft_ping: invalid rate: %s (must be 0.001-%.0f probes per second)\n", str, RATE_MAX);
+		return -1;
+	}
+	
+	*result = val;
+	return 0;
+}
+
 /**
  * @param state - ping state to populate with parsed options
  * @param argc - argument count
  * @param argv - argument vector
  * @return 0 on success, 1 on failure
  * 
- * Parses command line arguments and populates ping options and target
+ * Parses command line arguments and populates ping options and targets, every
+ * positional argument and every line of a -F file is a target. Options without
+ * a short form are long only (--stats-interval, --shm, --metrics-listen, --pcap, --pcap-size, --sim,
+ * --rate, --burst). --rate replaces -i: the send period comes from the rate,
+ * and -i is set to the matching per-target interval to size the packet tables
  */
 int parseArgs(t_ping_state *state, int argc, char **argv) {
+	static const struct option long_options[] = {
+		{"stats-interval", required_argument, NULL, OPT_STATS_INTERVAL},
+		{"shm", required_argument, NULL, OPT_SHM},
+		{"metrics-listen", required_argument, NULL, OPT_METRICS_LISTEN},
+		{"pcap", required_argument, NULL, OPT_PCAP},
+		{"pcap-size", required_argument, NULL, OPT_PCAP_SIZE},
+		{"sim", required_argument, NULL, OPT_SIM},
+		{"rate", required_argument, NULL, OPT_RATE},
+		{"burst", required_argument, NULL, OPT_BURST},
+		{NULL, 0, NULL, 0},
+	};
 	int opt;
 	
 	state->opts.verbose = 0;
@@ -42,8 +97,22 @@ int parseArgs(t_ping_state *state, int argc, char **argv) {
 	state->opts.preload = 0;
 	state->opts.timeout = 4;
 	state->opts.ttl = 64;
+	state->opts.interval = -1;
+	state->opts.flood = 0;
+	state->opts.threads = 1;
+	state->opts.backend = IO_EPOLL;
+	state->opts.format = OUTPUT_TEXT;
+	state->opts.async = 0;
+	state->opts.stats_interval = 0;
+	state->opts.shm_name = NULL;
+	state->opts.metrics_listen = NULL;
+	state->opts.pcap_path = NULL;
+	state->opts.pcap_size = 0;
+	parse_sim_config(NULL, &state->opts.sim);
+	state->opts.rate = 0.0;
+	state->opts.burst = 0;
 
-	while ((opt = getopt(argc, argv, "vhc:s:l:W:t:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "vhfAc:s:l:W:t:i:F:j:E:o:", long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'v':
 				state->opts.verbose = 1;
@@ -67,7 +136,7 @@ int parseArgs(t_ping_state *state, int argc, char **argv) {
 
 			case 'l': {
 				long preload;
-				if (parse_int_range(optarg, "preload", 1, 3, &preload) != 0) {
+				if (parse_int_range(optarg, "preload", 1, PRELOAD_MAX, &preload) != 0) {
 					return 1;
 				}
 				state->opts.preload = preload;
@@ -90,6 +159,101 @@ int parseArgs(t_ping_state *state, int argc, char **argv) {
 				state->opts.ttl = ttl;
 				break;
 			}
+			case 'i': {
+				long interval;
+				if (parse_interval(optarg, &interval) != 0) {
+					return 1;
+				}
+				state->opts.interval = interval;
+				break;
+			}
+			case 'f':
+				state->opts.flood = 1;
+				break;
+			case 'A':
+				state->opts.async = 1;
+				break;
+			case OPT_STATS_INTERVAL: {
+				long stats_interval;
+				if (parse_interval(optarg, &stats_interval) != 0) {
+					return 1;
+				}
+				state->opts.stats_interval = stats_interval;
+				break;
+			}
+			case OPT_SHM:
+				state->opts.shm_name = optarg;
+				break;
+			case OPT_METRICS_LISTEN:
+				state->opts.metrics_listen = optarg;
+				break;
+			case OPT_PCAP:
+				state->opts.pcap_path = optarg;
+				break;
+			case OPT_PCAP_SIZE: {
+				long size;
+				if (parse_int_range(optarg, "pcap size", 1, PCAP_SIZE_MAX, &size) != 0) {
+					return 1;
+				}
+				state->opts.pcap_size = size << 20;
+				break;
+			}
+			case OPT_SIM:
+				if (parse_sim_config(optarg, &state->opts.sim) != 0) {
+					return 1;
+				}
+				state->opts.backend = IO_SIM;
+				break;
+			case OPT_RATE:
+				if (parse_rate(optarg, &state->opts.rate) != 0) {
+					return 1;
+				}
+				break;
+			case OPT_BURST: {
+				long burst;
+				if (parse_int_range(optarg, "burst", 1, PRELOAD_MAX, &burst) != 0) {
+					return 1;
+				}
+				state->opts.burst = burst;
+				break;
+			}
+			case 'j': {
+				long threads;
+				if (parse_int_range(optarg, "threads", 1, SHARDS_MAX, &threads) != 0) {
+					return 1;
+				}
+				state->opts.threads = threads;
+				break;
+			}
+			case 'E':
+				if (strcmp(optarg, "epoll") == 0) {
+					state->opts.backend = IO_EPOLL;
+				} else if (strcmp(optarg, "io_uring") == 0) {
+					state->opts.backend = IO_URING;
+				} else if (strcmp(optarg, "sim") == 0) {
+					state->opts.backend = IO_SIM;
+				} else {
+					fprintf(stderr, "ft_ping: invalid I/O backend: %s (must be epoll, io_uring or sim)\n", optarg);
+					return 1;
+				}
+				break;
+			case 'o':
+				if (strcmp(optarg, "text") == 0) {
+					state->opts.format = OUTPUT_TEXT;
+				} else if (strcmp(optarg, "json") == 0) {
+					state->opts.format = OUTPUT_JSON;
+				} else if (strcmp(optarg, "csv") == 0) {
+					state->opts.format = OUTPUT_CSV;
+				} else {
+					fprintf(stderr, "ft_ping: invalid output format: %s (must be text, json or csv)\n", optarg);
+					return 1;
+				}
+				break;
+			case 'F':
+				if (load_target_file(state, optarg) != 0) {
+					return 1;
+				}
+				break;
 			case 'h': {
 				print_usage(argv[0], optopt);
 				exit(0);
@@ -102,10 +266,43 @@ int parseArgs(t_ping_state *state, int argc, char **argv) {
 				return 1;
 		}
 	}
-	if (optind >= argc) {
+	for (int i = optind; i < argc; i++) {
+		if (add_target(state, argv[i]) != 0) {
+			return 1;
+		}
+	}
+	if (state->ntargets == 0) {
 		fprintf(stderr, "%s: usage error: Destination address required\n", argv[0]);
 		return 1;
 	}
-	state->conn.target = argv[optind];
+	// -j is capped at the number of targets, so -j with one target runs unsharded
+	// and keeps its statistics in the main thread, where the endpoint reads them
+	if (state->opts.metrics_listen && MIN((size_t)state->opts.threads, state->ntargets) > 1) {
+		fprintf(stderr, "ft_ping: --metrics-listen cannot be combined with -j over more than one target\n");
+		return 1;
+	}
+	if (state->opts.metrics_listen && state->opts.backend == IO_SIM) {
+		fprintf(stderr, "ft_ping: --metrics-listen cannot be combined with -E sim\n");
+		return 1;
+	}
+	if (state->opts.pcap_size > 0 && !state->opts.pcap_path) {
+		fprintf(stderr, "ft_ping: --pcap-size requires --pcap\n");
+		return 1;
+	}
+	if (state->opts.burst > 0 && state->opts.rate == 0.0) {
+		fprintf(stderr, "ft_ping: --burst requires --rate\n");
+		return 1;
+	}
+	if (state->opts.rate > 0.0 && (state->opts.flood || state->opts.interval >= 0)) {
+		fprintf(stderr, "ft_ping: --rate cannot be combined with %s\n", state->opts.flood ? "-f" : "-i");
+		return 1;
+	}
+	if (state->opts.rate > 0.0) {
+		state->opts.interval = (long)(state->ntargets * 1000000.0 / state->opts.rate);
+		state->opts.burst = (state->opts.burst > 0) ? state->opts.burst : 1;
+	}
+	if (state->opts.interval < 0) {
+		state->opts.interval = state->opts.flood ? 0 : DEFAULT_INTERVAL_US;
+	}
 	return 0;
 }
@@ -0,0 +1,182 @@
+#include "../includes/ft_ping.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define CHECKSUM_X86 1
+#endif
+
+/**
+ * @param sum - 64-bit accumulated sum of 16-bit words
+ * @return one's complement of the folded sum
+ * 
+ * Folds carries back into the low 16 bits and complements the result
+ */
+uint16_t inet_checksum_fold(uint64_t sum) {
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	return ~sum;
+}
+
+/**
+ * @param checksum - checksum to update
+ * @param before - 16-bit word as it was
+ * @param after - 16-bit word as it is now
+ * @return checksum updated incrementally (RFC 1624, eqn. 3)
+ */
+uint16_t inet_checksum_adjust(uint16_t checksum, uint16_t before, uint16_t after) {
+	return inet_checksum_fold((uint16_t)~checksum + (uint16_t)~before + after);
+}
+
+/**
+ * @param ptr - pointer to remaining bytes
+ * @param bytes - number of remaining bytes
+ * @return sum of the remaining 16-bit words and trailing odd byte
+ * 
+ * Sums words one at a time, a trailing odd byte is added as is
+ */
+static uint64_t sum_words(const uint8_t *ptr, size_t bytes) {
+	uint64_t sum = 0;
+	uint16_t word;
+
+	while (bytes > 1) {
+		memcpy(&word, ptr, sizeof(word));
+		sum += word;
+		ptr += 2;
+		bytes -= 2;
+	}
+
+	if (bytes == 1) {
+		sum += *ptr;
+	}
+	return sum;
+}
+
+/**
+ * @param data - buffer to checksum, any alignment
+ * @param len - buffer length in bytes
+ * @return RFC 792 Internet checksum
+ * 
+ * Portable reference implementation, one 16-bit word at a time
+ */
+uint16_t inet_checksum_scalar(const void *data, size_t len) {
+	return inet_checksum_fold(sum_words(data, len));
+}
+
+#ifdef CHECKSUM_X86
+
+// Lanes gain at most 2 * 0xFFFF per block, flush before a 32-bit lane can wrap
+#define CHECKSUM_FLUSH_BLOCKS 32768
+
+/**
+ * @param data - buffer to checksum, any alignment
+ * @param len - buffer length in bytes
+ * @return RFC 792 Internet checksum, identical to inet_checksum_scalar()
+ * 
+ * Widens 16 bytes at a time into eight 32-bit lanes with SSE2
+ */
+__attribute__((target("sse2")))
+uint16_t inet_checksum_sse2(const void *data, size_t len) {
+	const uint8_t *ptr = data;
+	const __m128i zero = _mm_setzero_si128();
+	uint64_t sum = 0;
+
+	while (len >= 16) {
+		__m128i acc = zero;
+		size_t blocks = MIN(len / 16, CHECKSUM_FLUSH_BLOCKS);
+
+		for (size_t i = 0; i < blocks; i++) {
+			__m128i v = _mm_loadu_si128((const __m128i*)ptr);
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+			ptr += 16;
+		}
+		len -= blocks * 16;
+
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	return inet_checksum_fold(sum + sum_words(ptr, len));
+}
+
+/**
+ * @param data - buffer to checksum, any alignment
+ * @param len - buffer length in bytes
+ * @return RFC 792 Internet checksum, identical to inet_checksum_scalar()
+ * 
+ * Widens 32 bytes at a time into sixteen 32-bit lanes with AVX2
+ */
+__attribute__((target("avx2")))
+uint16_t inet_checksum_avx2(const void *data, size_t len) {
+	const uint8_t *ptr = data;
+	const __m256i zero = _mm256_setzero_si256();
+	uint64_t sum = 0;
+
+	while (len >= 32) {
+		__m256i acc = zero;
+		size_t blocks = MIN(len / 32, CHECKSUM_FLUSH_BLOCKS);
+
+		for (size_t i = 0; i < blocks; i++) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)ptr);
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+			ptr += 32;
+		}
+		len -= blocks * 32;
+
+		uint32_t lanes[8];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		for (int i = 0; i < 8; i++) {
+			sum += lanes[i];
+		}
+	}
+	return inet_checksum_fold(sum + sum_words(ptr, len));
+}
+
+#endif
+
+static uint16_t (*checksum_kernel)(const void *data, size_t len) = NULL;
+static const char *checksum_kernel_str = "scalar";
+
+/**
+ * Picks the widest checksum kernel the running CPU supports
+ */
+static void select_checksum_kernel(void) {
+	checksum_kernel = inet_checksum_scalar;
+	checksum_kernel_str = "scalar";
+#ifdef CHECKSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		checksum_kernel = inet_checksum_avx2;
+		checksum_kernel_str = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		checksum_kernel = inet_checksum_sse2;
+		checksum_kernel_str = "sse2";
+	}
+#endif
+}
+
+/**
+ * @param data - buffer to checksum, any alignment
+ * @param len - buffer length in bytes
+ * @return RFC 792 Internet checksum
+ * 
+ * Calculates the Internet checksum with the kernel selected for this CPU
+ */
+uint16_t inet_checksum(const void *data, size_t len) {
+	if (!checksum_kernel) {
+		select_checksum_kernel();
+	}
+	return checksum_kernel(data, len);
+}
+
+/**
+ * @return name of the checksum kernel in use
+ */
+const char *inet_checksum_kernel(void) {
+	if (!checksum_kernel) {
+		select_checksum_kernel();
+	}
+	return checksum_kernel_str;
+}
@@ -0,0 +1,233 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * @param family - AF_INET or AF_INET6
+ * @return ICMP messages received by the host so far (InMsgs), 0 if unavailable
+ *
+ * Reads the kernel's SNMP input counter for the family from /proc/net/snmp
+ * or /proc/net/snmp6
+ */
+static uint64_t icmp_in_msgs(int family) {
+	FILE *file = fopen((family == AF_INET) ? "/proc/net/snmp" : "/proc/net/snmp6", "r");
+	char line[1024];
+	char header[1024] = "";
+	uint64_t value = 0;
+
+	if (!file) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		if (family == AF_INET6) {
+			unsigned long long count;
+			if (sscanf(line, "Icmp6InMsgs %llu", &count) == 1) {
+				value = count;
+				break;
+			}
+		} else if (strncmp(line, "Icmp: ", 6) == 0) {
+			if (header[0] == '\0') {
+				memcpy(header, line, sizeof(line));
+				continue;
+			}
+			// the values line follows the header line, InMsgs is the first column
+			unsigned long long count;
+			if (sscanf(line, "Icmp: %llu", &count) == 1) {
+				value = count;
+			}
+			break;
+		}
+	}
+	fclose(file);
+	return value;
+}
+
+/**
+ * @param sockfd - socket file descriptor
+ * @return datagrams the kernel dropped because the receive buffer was full
+ */
+static uint32_t socket_drops(int sockfd) {
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+
+	if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+		len < sizeof(meminfo)) {
+		return 0;
+	}
+	return meminfo[SK_MEMINFO_DROPS];
+}
+
+/**
+ * @param sockfd - socket file descriptor
+ *
+ * Discards datagrams queued before the filter was attached
+ */
+static void drain_socket(int sockfd) {
+	char buffer[1];
+	while (recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT | MSG_TRUNC) >= 0) {
+	}
+}
+
+/**
+ * @param sockfd - raw IPv4 ICMP socket
+ * @param id - echo identifier of our probes
+ * @return 0 on success, -1 on failure
+ *
+ * Attaches a classic BPF program that passes echo replies carrying our
+ * identifier and time exceeded / unreachable errors quoting one of our probes.
+ * Datagrams start at the IP header; the quoted probe is our own packet, so its
+ * IP header has no options and the quoted identifier sits 32 bytes into ICMP
+ */
+static int attach_ipv4_filter(int sockfd, uint16_t id) {
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),							// X = IP header length
+		BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),							// A = ICMP type
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 3, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_TIME_EXCEEDED, 4, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_DEST_UNREACH, 3, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),							// echo reply identifier
+		BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 8 + sizeof(struct iphdr) + 4),	// quoted identifier
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+	return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+/**
+ * @param sockfd - raw ICMPv6 socket
+ * @param id - echo identifier of our probes
+ * @return 0 on success, -1 on failure
+ *
+ * Restricts the socket to echo replies, time exceeded and unreachable messages
+ * with ICMP6_FILTER, then attaches a classic BPF program that checks their
+ * identifier. Datagrams start at the ICMPv6 header, the quoted identifier sits
+ * past the fixed IPv6 header of the quoted probe
+ */
+static int attach_ipv6_filter(int sockfd, uint16_t id) {
+	struct icmp6_filter types;
+	ICMP6_FILTER_SETBLOCKALL(&types);
+	ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &types);
+	ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &types);
+	ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &types);
+	if (setsockopt(sockfd, IPPROTO_ICMPV6, ICMP6_FILTER, &types, sizeof(types)) < 0) {
+		return -1;
+	}
+
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),							// A = ICMPv6 type
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 2),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),							// echo reply identifier
+		BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 8 + sizeof(struct ip6_hdr) + 4),	// quoted identifier
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+	return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+/**
+ * @param state - ping state containing sockets and echo identifiers
+ * @return 0 on success, 1 on failure
+ *
+ * Filters foreign ICMP traffic in the kernel so it never wakes the event loop,
+ * and snapshots the kernel ICMP input counters to report how much was rejected.
+ * Without filters (old kernels) foreign replies are still dropped in userspace.
+ * Datagram sockets need none, the kernel only delivers our identifier to them
+ */
+int init_filters(t_ping_state *state) {
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+
+	memset(&state->filter, 0, sizeof(state->filter));
+	if (state->conn.socktype == SOCK_DGRAM || state->opts.backend == IO_SIM) {
+		return 0;
+	}
+	if (attach_ipv4_filter(sockets[0], state->conn.ipv4.pid) < 0 ||
+		attach_ipv6_filter(sockets[1], state->conn.ipv6.pid) < 0) {
+		if (state->opts.verbose) {
+			perror("ft_ping: socket filter");
+		}
+		return 0;
+	}
+
+	for (int f = 0; f < 2; f++) {
+		drain_socket(sockets[f]);
+		state->filter.icmp_in[f] = icmp_in_msgs((f == 0) ? AF_INET : AF_INET6);
+		state->filter.drops[f] = socket_drops(sockets[f]);
+	}
+	state->filter.attached = 1;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing sockets and filter counters
+ *
+ * Reads how many datagrams each socket lost to a full receive buffer since the
+ * filters were attached. Kernel drop counters do not include filter
+ * rejections, only receive buffer overflows
+ */
+void read_socket_drops(t_ping_state *state) {
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+
+	if (!state->filter.attached) {
+		return;
+	}
+	for (int f = 0; f < 2; f++) {
+		state->filter.overflowed[f] = socket_drops(sockets[f]) - state->filter.drops[f];
+	}
+}
+
+/**
+ * @param state - ping state receiving the counts
+ * @param shard - shard state whose worker has been joined
+ *
+ * Adds what the shard's sockets delivered and lost to the run counts, and keeps
+ * the earliest ICMP input snapshot, taken when the first shard attached its
+ * filters. The rejected count is left to read_filter_stats() in the main thread
+ */
+void merge_filter_stats(t_ping_state *state, t_ping_state *shard) {
+	read_socket_drops(shard);
+	if (!shard->filter.attached) {
+		return;
+	}
+	for (int f = 0; f < 2; f++) {
+		if (!state->filter.attached || shard->filter.icmp_in[f] < state->filter.icmp_in[f]) {
+			state->filter.icmp_in[f] = shard->filter.icmp_in[f];
+		}
+		state->filter.delivered[f] += shard->filter.delivered[f];
+		state->filter.overflowed[f] += shard->filter.overflowed[f];
+	}
+	state->filter.attached = 1;
+}
+
+/**
+ * @param state - ping state containing filter counters
+ *
+ * Updates the rejected and dropped counts: ICMP messages the host received
+ * since the filters were attached, minus the ones delivered to or dropped by our
+ * sockets, were rejected by the filters. The ICMP input counters are host-wide,
+ * so a -j run calls this once, over the counts of every shard
+ */
+void read_filter_stats(t_ping_state *state) {
+	if (!state->filter.attached) {
+		return;
+	}
+	state->filter.rejected = 0;
+	state->filter.dropped = 0;
+	for (int f = 0; f < 2; f++) {
+		uint64_t received = icmp_in_msgs((f == 0) ? AF_INET : AF_INET6) - state->filter.icmp_in[f];
+		uint64_t kept = state->filter.delivered[f] + state->filter.overflowed[f];
+
+		state->filter.rejected += (received > kept) ? received - kept : 0;
+		state->filter.dropped += state->filter.overflowed[f];
+	}
+}
@@ -5,21 +5,31 @@
  * @param buffer - received packet buffer
  * @param bytes_received - total bytes received
  * @param state - ping state containing connection and statistics info
- * @param from - source address from recvfrom() call
+ * @param from - source address from recvmmsg() call
+ * @param rx_time - receive time on the timestamp source clock
+ * @param ttl - TTL or hop limit from control data, -1 if none
  * @return initialized ICMP context structure
  * 
- * Creates and initializes ICMP context with parsed headers and common data
+ * Creates and initializes ICMP context with parsed headers and common data,
+ * IPv4 raw sockets deliver the IP header, IPv6 and datagram sockets start at
+ * the ICMP header
  */
-static t_icmp_context create_icmp_context(char *buffer, ssize_t bytes_received, t_ping_state *state, struct sockaddr_storage *from) {
+static t_icmp_context create_icmp_context(char *buffer, ssize_t bytes_received, t_ping_state *state, struct sockaddr_storage *from, int64_t rx_time, int ttl) {
+	int family = from->ss_family;
+	int has_ip_header = (family == AF_INET && state->conn.socktype == SOCK_RAW);
 	t_icmp_context ctx = {
 		.buffer = buffer,
 		.bytes_received = bytes_received,
 		.from = from,
-		.ip_header = (state->conn.target_family == AF_INET) ? (struct iphdr*)buffer : NULL,
-		.icmp_header = (state->conn.target_family == AF_INET) ? 
+		.family = family,
+		.rx_time = rx_time,
+		.ttl = ttl,
+		.ip_header = has_ip_header ? (struct iphdr*)buffer : NULL,
+		.icmp_header = has_ip_header ? 
 					   (struct icmphdr*)(buffer + ((struct iphdr*)buffer)->ihl * 4) : 
 					   (struct icmphdr*)buffer,
-		.expected_pid = (state->conn.target_family == AF_INET) ? 
+		.target = NULL,
+		.expected_pid = (family == AF_INET) ? 
 						state->conn.ipv4.pid : state->conn.ipv6.pid,
 		.packet_id = 0,
 		.sequence = 0
@@ -39,34 +49,102 @@ static int get_icmp_packet_type(uint8_t icmp_type, int family) {
 	return 0; 
 }
 
-static int handle_icmp_errors(t_icmp_context *ctx, t_ping_state *state) {
-	size_t error_min_size = sizeof(struct iphdr) + sizeof(struct icmphdr) * 2; // sizeof(struct ipv6hdr) * 2 + sizeof(struct icmp6_hdr) * 2;
-	if ((unsigned long)ctx->bytes_received < error_min_size) {
+/**
+ * @param ctx - ICMP context of an error message
+ * @param inner_dst - address to fill with the destination of the quoted probe
+ * @return quoted ICMP header of the probe, NULL if the error is too short
+ * 
+ * Locates the original datagram quoted by an ICMP or ICMPv6 error and the
+ * destination it was sent to, which identifies the target
+ */
+static struct icmphdr *quoted_probe(t_icmp_context *ctx, struct sockaddr_storage *inner_dst) {
+	char *quoted = (char*)ctx->icmp_header + sizeof(struct icmphdr);
+	size_t available = ctx->bytes_received - (quoted - ctx->buffer);
+	
+	memset(inner_dst, 0, sizeof(*inner_dst));
+	if (ctx->family == AF_INET) {
+		struct iphdr *orig_ip = (struct iphdr*)quoted;
+		if (available < sizeof(struct iphdr) || available < orig_ip->ihl * 4 + sizeof(struct icmphdr)) {
+			return NULL;
+		}
+		struct sockaddr_in *dst = (struct sockaddr_in*)inner_dst;
+		dst->sin_family = AF_INET;
+		dst->sin_addr.s_addr = orig_ip->daddr;
+		return (struct icmphdr*)(quoted + orig_ip->ihl * 4);
+	}
+	
+	if (available < sizeof(struct ip6_hdr) + sizeof(struct icmphdr)) {
+		return NULL;
+	}
+	struct ip6_hdr *orig_ip6 = (struct ip6_hdr*)quoted;
+	struct sockaddr_in6 *dst6 = (struct sockaddr_in6*)inner_dst;
+	dst6->sin6_family = AF_INET6;
+	memcpy(&dst6->sin6_addr, &orig_ip6->ip6_dst, sizeof(struct in6_addr));
+	return (struct icmphdr*)(quoted + sizeof(struct ip6_hdr));
+}
+
+/**
+ * @param family - AF_INET or AF_INET6
+ * @param type - ICMP or ICMPv6 error type
+ * @return description of the error
+ */
+const char *icmp_error_str(int family, uint8_t type) {
+	if ((family == AF_INET && type == ICMP_TIME_EXCEEDED) ||
+		(family == AF_INET6 && type == ICMP6_TIME_EXCEEDED)) {
+		return "Time to live exceeded";
+	}
+	return "Destination Unreachable";
+}
+
+/**
+ * @param ctx - ICMP context with the sequence of the quoted probe
+ * @param state - ping state containing statistics
+ * @param dst - destination the probe was sent to
+ * @param type - ICMP or ICMPv6 error type
+ * @param code - ICMP or ICMPv6 error code
+ * @return 0 if the error concerned one of our probes in flight, 1 otherwise
+ * 
+ * Reports an error returned for a probe and retires it, shared by errors read
+ * from raw sockets and from the error queue of datagram sockets
+ */
+static int report_icmp_error(t_icmp_context *ctx, t_ping_state *state, struct sockaddr_storage *dst, uint8_t type, uint8_t code) {
+	ctx->target = find_target(state, (struct sockaddr*)dst);
+	if (!ctx->target || !find_packet(ctx->target, ctx->sequence)) {
 		return 1;
 	}
 	
-	struct iphdr *orig_ip = (struct iphdr*)((char*)ctx->icmp_header + sizeof(struct icmphdr));
-	struct icmphdr *orig_icmp = (struct icmphdr*)((char*)orig_ip + (orig_ip->ihl * 4));
+	print_icmp_error(state, ctx, type, code);
+	int kind = (type == ((ctx->target->family == AF_INET) ? ICMP_TIME_EXCEEDED : ICMP6_TIME_EXCEEDED)) ?
+			   ERROR_TIME_EXCEEDED : ERROR_UNREACHABLE;
+	ctx->target->stats.errors++;
+	ctx->target->stats.error_types[kind]++;
+	ctx->target->stats.packets_received++;
+	state->stats.errors++;
+	state->stats.error_types[kind]++;
+	state->stats.packets_received++;
+	publish_stats(ctx->target);
+	remove_packet(state, ctx->target, ctx->sequence);
+	return 0;
+}
+
+static int handle_icmp_errors(t_icmp_context *ctx, t_ping_state *state) {
+	struct sockaddr_storage inner_dst;
+	struct icmphdr *orig_icmp = quoted_probe(ctx, &inner_dst);
+	if (!orig_icmp) {
+		return 1;
+	}
 	
 	ctx->packet_id = ntohs(orig_icmp->un.echo.id);
 	ctx->sequence = ntohs(orig_icmp->un.echo.sequence);
 	
-	uint8_t expected_type = (state->conn.target_family == AF_INET) ? 
+	uint8_t expected_type = (ctx->family == AF_INET) ? 
 							ICMP_ECHO : ICMP6_ECHO_REQUEST;
 	
 	if (orig_icmp->type != expected_type || ctx->packet_id != ctx->expected_pid) {
 		return 1;
 	}
 	
-	t_packet_entry *packet_entry = find_packet(state, ctx->sequence);
-	if (!packet_entry) {
-		return 1;
-	}
-	
-	print_icmp_error(ctx, "Time to live exceeded");
-	state->stats.errors++;
-	remove_packet(state, ctx->sequence);
-	return 0;
+	return report_icmp_error(ctx, state, &inner_dst, ctx->icmp_header->type, ctx->icmp_header->code);
 }
 
 static int handle_icmp_replies(t_icmp_context *ctx, t_ping_state *state) {
@@ -77,47 +155,90 @@ static int handle_icmp_replies(t_icmp_context *ctx, t_ping_state *state) {
 		return 1;
 	}
 	
-	t_packet_entry *packet_entry = find_packet(state, ctx->sequence);
+	ctx->target = find_target(state, (struct sockaddr*)ctx->from);
+	if (!ctx->target) {
+		return 1;
+	}
+	t_packet_entry *packet_entry = find_packet(ctx->target, ctx->sequence);
 	if (!packet_entry) {
 		return 1;
 	}
 	
-	size_t icmp_size = (state->conn.target_family == AF_INET) ? 
+	size_t icmp_size = ctx->ip_header ? 
 					ctx->bytes_received - (ctx->ip_header->ihl * 4) : 
 					ctx->bytes_received;
 	size_t icmp_data_size = icmp_size - sizeof(struct icmphdr);
 	
-	int ttl = (state->conn.target_family == AF_INET) ? ctx->ip_header->ttl : 64; // ((struct ipv6hdr*)ctx->buffer)->hop_limit
+	int ttl = ctx->ttl;
+	if (ttl < 0) {
+		ttl = ctx->ip_header ? ctx->ip_header->ttl : 64;
+	}
 	
-	double rtt = calculate_rtt(ctx->buffer, ctx->ip_header, icmp_data_size, state->conn.target_family);
-	update_rtt_stats(state, rtt);
-	print_ping_reply(state, icmp_size, ctx->icmp_header, ttl, rtt);
+	double rtt = calculate_rtt(packet_entry, ctx->rx_time, icmp_data_size);
+	state->pcap.rtt_ns = (rtt >= 0.0) ? llround(rtt * NSEC_PER_MSEC) : -1;
+	update_rtt_stats(&ctx->target->stats, rtt);
+	update_rtt_stats(&state->stats, rtt);
+	ctx->target->stats.packets_received++;
+	state->stats.packets_received++;
+	publish_stats(ctx->target);
+	print_ping_reply(state, ctx->target, icmp_size, ctx->icmp_header, ttl, rtt);
 	
-	remove_packet(state, ctx->sequence);
+	remove_packet(state, ctx->target, ctx->sequence);
 	return 0;
 }
 
+/**
+ * @param ctx - ICMP context of a reply or error
+ * @param state - ping state containing the socket type and backend
+ * @return 1 if the ICMP checksum holds or the kernel already checked it, 0 otherwise
+ * 
+ * Raw IPv4 sockets deliver ICMP messages without checking them. Datagram sockets
+ * and raw ICMPv6 sockets only deliver messages the kernel verified, ICMPv6 with
+ * the pseudo header. The simulated network stands in for the kernel, its IPv6
+ * replies carry the plain ICMP sum of the probe, so everything is checked there
+ */
+static int checksum_ok(t_icmp_context *ctx, t_ping_state *state) {
+	if (state->opts.backend != IO_SIM && !ctx->ip_header) {
+		return 1;
+	}
+	size_t icmp_size = ctx->bytes_received - ((char*)ctx->icmp_header - ctx->buffer);
+	return inet_checksum(ctx->icmp_header, icmp_size) == 0;
+}
+
 /**
  * @param buffer - received packet buffer
  * @param bytes_received - total bytes received
  * @param state - ping state containing connection and statistics info
- * @param from - source address from recvfrom() call
+ * @param from - source address from recvmmsg() call
+ * @param rx_time - receive time on the timestamp source clock
+ * @param ttl - TTL or hop limit from control data, -1 if none
  * @return 0 if valid reply packet processed, 1 otherwise
  * 
- * Parses ICMP reply packet and dispatches to appropriate handler
+ * Parses ICMP reply packet and dispatches to appropriate handler, the target
+ * is found from the reply's source address or the error's quoted destination.
+ * A message failing its checksum is counted and dropped before it is matched
+ * to a probe, even if the flipped bit changed its type
  */
-int parse_icmp_reply(char *buffer, ssize_t bytes_received, t_ping_state *state, struct sockaddr_storage *from) {
+int parse_icmp_reply(char *buffer, ssize_t bytes_received, t_ping_state *state, struct sockaddr_storage *from, int64_t rx_time, int ttl) {
 
-	size_t min_size = (state->conn.target_family == AF_INET) ? 
+	int family = from->ss_family;
+	int has_ip_header = (family == AF_INET && state->conn.socktype == SOCK_RAW);
+	size_t min_size = has_ip_header ? 
 					sizeof(struct iphdr) + sizeof(struct icmphdr) :
 					sizeof(struct icmphdr);
 	if ((unsigned long)bytes_received < min_size) {
 		return 1;
 	}
+	if (has_ip_header && bytes_received < ((struct iphdr*)buffer)->ihl * 4 + (ssize_t)sizeof(struct icmphdr)) {
+		return 1;
+	}
 	
-	t_icmp_context ctx = create_icmp_context(buffer, bytes_received, state, from);
-	
-	switch (get_icmp_packet_type(ctx.icmp_header->type, state->conn.target_family)) {
+	t_icmp_context ctx = create_icmp_context(buffer, bytes_received, state, from, rx_time, ttl);
+	if (!checksum_ok(&ctx, state)) {
+		state->io.bad_checksums++;
+		return 1;
+	}
+	switch (get_icmp_packet_type(ctx.icmp_header->type, family)) {
 		case 1: // reply
 			return handle_icmp_replies(&ctx, state);
 		case 2: // error
@@ -125,4 +246,45 @@ int parse_icmp_reply(char *buffer, ssize_t bytes_received, t_ping_state *state,
 		default: // unknown
 			return 1;
 	}
-}
\ No newline at end of file
+}
+/**
+ * @param state - ping state containing connection and statistics info
+ * @param msg - message read from the error queue of a datagram socket
+ * @param bytes - payload length, the ICMP header of the probe the error concerns
+ * @return 0 if the error concerned one of our probes in flight, 1 otherwise
+ * 
+ * Datagram ICMP sockets never see ICMP errors as datagrams; with IP_RECVERR the
+ * kernel queues them on the error queue instead, addressed to the original
+ * destination, with the sender of the error as offender
+ */
+int parse_queued_error(t_ping_state *state, struct msghdr *msg, size_t bytes) {
+	struct sock_extended_err *serr = NULL;
+	
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+			serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+		}
+	}
+	if (!serr || (serr->ee_origin != SO_EE_ORIGIN_ICMP && serr->ee_origin != SO_EE_ORIGIN_ICMP6) ||
+		bytes < sizeof(struct icmphdr)) {
+		return 1;
+	}
+	
+	struct sockaddr_storage offender;
+	struct sockaddr *sender = SO_EE_OFFENDER(serr);
+	struct sockaddr_storage *dst = msg->msg_name;
+	struct icmphdr *probe = msg->msg_iov[0].iov_base;
+	
+	memset(&offender, 0, sizeof(offender));
+	memcpy(&offender, sender, (sender->sa_family == AF_INET6) ? 
+		   sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+	if (offender.ss_family == AF_UNSPEC) {
+		offender = *dst;
+	}
+	
+	t_icmp_context ctx = create_icmp_context(msg->msg_iov[0].iov_base, bytes, state, &offender, 0, -1);
+	ctx.family = dst->ss_family;
+	ctx.sequence = ntohs(probe->un.echo.sequence);
+	return report_icmp_error(&ctx, state, dst, serr->ee_type, serr->ee_code);
+}
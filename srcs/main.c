@@ -1,61 +1,79 @@
 #include "../includes/ft_ping.h"
 
-static void ready(t_ping_state *state) {
-	setupSignals(state);
+static int ready(t_ping_state *state) {
+	if (setupSignals(state) || setupPoll(state) || init_output(state) || init_writer(state) ||
+		init_metrics(state)) {
+		return 1;
+	}
 	memset(&state->stats, 0, sizeof(state->stats));
+	init_schedule(state);
 	print_verbose_info(state);
 	print_default_info(state);
+	return 0;
 }
 
 
-static void end(t_ping_state *state) {
+static int end(t_ping_state *state) {
+	int answered = all_targets_answered(state);
+	read_socket_drops(state);
+	read_filter_stats(state);
+	stop_writer(state);
 	print_stats(state);
+	cleanup_output(state);
+	cleanup_shm(state);
+	cleanup_metrics(state);
+	cleanup_pcap(state);
 	cleanup_packets(state);
+	cleanup_batches(state);
+	cleanup_timestamps(state);
+	cleanup_targets(state);
+	histogram_free(&state->stats.rtt_hist);
+	histogram_free(&state->send_jitter.hist);
+	cleanup_poll(state);
+	close(state->loop.signal_fd);
 	close(state->conn.ipv4.sockfd);
 	close(state->conn.ipv6.sockfd);
+	return answered;
 }
 
 int main(int argc, char **argv) {
 	t_ping_state state;
-	struct pollfd fds[2];
-	uint16_t sequence = 1;
 	int ret = 0;
 
+	memset(&state, 0, sizeof(state));
+	state.shard.count = 1;
+	state.shard.stop_fd = -1;
+	state.shard.done_fd = -1;
+	state.shard.status_fd = -1;
+	state.loop.epoll_fd = -1;
+	state.loop.timer_fd = -1;
+	state.loop.signal_fd = -1;
+	state.writer.wake_fd = -1;
+	state.metrics.listen_fd = -1;
 	if (parseArgs(&state, argc, argv) ||
-		resolveHost(&state, argv) || 
-		createSocket(&state, argv) ||
-		init_packet_system(&state)) {
+		resolveHost(&state, argv) ||
+		init_shm(&state) ||
+		init_pcap(&state)) {
+		return ret = 1;
+	}
+	if (state.opts.threads > 1 && state.ntargets > 1) {
+		return run_shards(&state, argv);
+	}
+	if (createSocket(&state, argv) ||
+		init_packet_system(&state) ||
+		init_filters(&state) ||
+		init_batches(&state) ||
+		init_timestamps(&state)) {
 		return ret = 1;
 	}
 
-	ready(&state);
-
-	int target_sockfd = setupPoll(&state, fds);
-	
-	while (!state.stats.transmission_complete || state.sent_packets != NULL) {
-		ret = send_ping(&state, &sequence, target_sockfd);
-		int poll_timeout = get_next_poll_timeout(&state);
-		if (poll_timeout < 0) {
-			break;
-		}
-		
-		int poll_result = poll(fds, 2, poll_timeout);
-		if (poll_result > 0) {
-			for (int i = 0; i < 2; i++) {
-				if (fds[i].revents & POLLIN) {
-					if ((ret = receive_packet(&state, fds[i].fd)) == 0) {
-						state.stats.packets_received++;
-					}
-					break;
-				}
-			}
-		} else if (poll_result == 0) {
-			handle_timeouts(&state);
-		} else if (poll_result < 0 && errno != EINTR) {
-			fprintf(stderr, "poll: %s\n", strerror(errno));
-			break;
-		}
+	if (ready(&state)) {
+		return ret = 1;
 	}
-	end(&state);
-	return (state.stats.packets_received == 0) ? 1 : ret;
-}
\ No newline at end of file
+	ret = run_event_loop(&state);
+	int answered = end(&state);
+	if (interrupted(&state)) {
+		return 0;
+	}
+	return answered ? ret : 1;
+}
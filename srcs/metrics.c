@@ -0,0 +1,467 @@
+#include "../includes/ft_ping.h"
+
+typedef struct s_metrics_body {
+	char	*buf;
+	size_t	len;
+	size_t	cap;
+	int		failed;		// an allocation failed, the body is incomplete
+} t_metrics_body;
+
+// Upper bounds of the RTT histogram buckets, the labels are the same in seconds
+static const int64_t rtt_bounds[] = {
+	50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000,
+	50000000, 100000000, 250000000, 500000000, 1000000000, 2500000000, 5000000000, 10000000000,
+};
+static const char *rtt_labels[] = {
+	"0.00005", "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025",
+	"0.05", "0.1", "0.25", "0.5", "1.0", "2.5", "5.0", "10.0",
+};
+#define RTT_BOUNDS (sizeof(rtt_bounds) / sizeof(rtt_bounds[0]))
+
+/**
+ * @param spec - --metrics-listen argument, [address:]port or [ipv6]:port
+ * @param host - filled with the address, NULL for every address
+ * @param port - filled with the port
+ * @param buf - storage for the address
+ * @param size - size of buf
+ * @return 0 on success, 1 if the address does not fit
+ *
+ * A bare port listens on 127.0.0.1 only, an empty address on every address
+ */
+static int split_listen(const char *spec, const char **host, const char **port, char *buf, size_t size) {
+	const char *colon = strrchr(spec, ':');
+	const char *start = spec;
+	size_t len;
+
+	if (!colon) {
+		*host = "127.0.0.1";
+		*port = spec;
+		return 0;
+	}
+	*port = colon + 1;
+	len = colon - spec;
+	if (spec[0] == '[' && len >= 2 && spec[len - 1] == ']') {
+		start++;
+		len -= 2;
+	}
+	if (len >= size) {
+		return 1;
+	}
+	memcpy(buf, start, len);
+	buf[len] = '\0';
+	*host = (len > 0) ? buf : NULL;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the --metrics-listen option
+ * @return 0 on success, 1 on failure
+ *
+ * Opens the non-blocking listening socket scrapes connect to and waits for
+ * the first connection in the event loop. Must run after setupPoll()
+ */
+int init_metrics(t_ping_state *state) {
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV,
+	};
+	struct addrinfo *res;
+	const char *host;
+	const char *port;
+	char addr[INET6_ADDRSTRLEN];
+	int one = 1;
+
+	for (int i = 0; i < METRICS_CLIENTS; i++) {
+		state->metrics.clients[i].fd = -1;
+	}
+	if (!state->opts.metrics_listen) {
+		return 0;
+	}
+	if (split_listen(state->opts.metrics_listen, &host, &port, addr, sizeof(addr)) != 0 ||
+		getaddrinfo(host, port, &hints, &res) != 0) {
+		fprintf(stderr, "ft_ping: invalid metrics address: %s (must be [address:]port)\n",
+				state->opts.metrics_listen);
+		return 1;
+	}
+	int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 ||
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+		bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
+		listen(fd, SOMAXCONN) < 0) {
+		fprintf(stderr, "ft_ping: --metrics-listen %s: %s\n", state->opts.metrics_listen, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		freeaddrinfo(res);
+		return 1;
+	}
+	freeaddrinfo(res);
+	state->metrics.listen_fd = fd;
+	watch_once(state, fd, EPOLLIN);
+	state->metrics.armed = 1;
+	return 0;
+}
+
+/**
+ * @param body - body being built
+ * @param format - printf format of the text to add
+ *
+ * Appends to the body, growing it as needed. A failed allocation is recorded
+ * and the rest of the body dropped
+ */
+__attribute__((format(printf, 2, 3)))
+static void append_body(t_metrics_body *body, const char *format, ...) {
+	va_list args;
+
+	while (!body->failed) {
+		va_start(args, format);
+		int len = vsnprintf(body->buf + body->len, body->cap - body->len, format, args);
+		va_end(args);
+		if (len >= 0 && (size_t)len < body->cap - body->len) {
+			body->len += len;
+			return;
+		}
+		char *grown = (len < 0) ? NULL : realloc(body->buf, body->cap * 2 + len);
+		if (!grown) {
+			body->failed = 1;
+			return;
+		}
+		body->buf = grown;
+		body->cap = body->cap * 2 + len;
+	}
+}
+
+/**
+ * @param body - body being built
+ * @param target - target whose labels to add
+ * @param extra - further labels, NULL if none
+ *
+ * Appends the label set of a sample: the target as given and its address,
+ * escaped as OpenMetrics label values
+ */
+static void append_labels(t_metrics_body *body, t_target *target, const char *extra) {
+	append_body(body, "{target=\"");
+	for (const char *c = target->name; *c; c++) {
+		if (*c == '\\' || *c == '"') {
+			append_body(body, "\\%c", *c);
+		} else if (*c == '\n') {
+			append_body(body, "\\n");
+		} else {
+			append_body(body, "%c", *c);
+		}
+	}
+	append_body(body, "\",address=\"%s\"%s%s}", target->addr_str, extra ? "," : "", extra ? extra : "");
+}
+
+/**
+ * @param state - ping state containing the targets and their statistics
+ * @param body - filled with the exposition
+ *
+ * Formats every metric family in the OpenMetrics text format, one sample per
+ * target. The loss ratio counts the probes whose fate is known, so probes
+ * still in flight do not show as lost. RTT histogram buckets are exact within
+ * the precision of the statistics histogram
+ */
+static void format_metrics(t_ping_state *state, t_metrics_body *body) {
+	uint64_t below[RTT_BOUNDS];
+
+	append_body(body, "# TYPE ft_ping_probes_sent counter\n"
+					  "# HELP ft_ping_probes_sent Echo requests sent.\n");
+	for (size_t i = 0; i < state->ntargets; i++) {
+		append_body(body, "ft_ping_probes_sent_total");
+		append_labels(body, &state->targets[i], NULL);
+		append_body(body, " %ld\n", state->targets[i].stats.packets_sent);
+	}
+	append_body(body, "# TYPE ft_ping_replies counter\n"
+					  "# HELP ft_ping_replies Echo replies received.\n");
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_ping_stats *stats = &state->targets[i].stats;
+		append_body(body, "ft_ping_replies_total");
+		append_labels(body, &state->targets[i], NULL);
+		append_body(body, " %ld\n", stats->packets_received - stats->errors);
+	}
+	append_body(body, "# TYPE ft_ping_timeouts counter\n"
+					  "# HELP ft_ping_timeouts Probes expired without an answer.\n");
+	for (size_t i = 0; i < state->ntargets; i++) {
+		append_body(body, "ft_ping_timeouts_total");
+		append_labels(body, &state->targets[i], NULL);
+		append_body(body, " %ld\n", state->targets[i].stats.timeouts);
+	}
+	append_body(body, "# TYPE ft_ping_icmp_errors counter\n"
+					  "# HELP ft_ping_icmp_errors ICMP errors received for probes, by type.\n");
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_ping_stats *stats = &state->targets[i].stats;
+		append_body(body, "ft_ping_icmp_errors_total");
+		append_labels(body, &state->targets[i], "type=\"time_exceeded\"");
+		append_body(body, " %ld\n", stats->error_types[ERROR_TIME_EXCEEDED]);
+		append_body(body, "ft_ping_icmp_errors_total");
+		append_labels(body, &state->targets[i], "type=\"destination_unreachable\"");
+		append_body(body, " %ld\n", stats->error_types[ERROR_UNREACHABLE]);
+	}
+	append_body(body, "# TYPE ft_ping_loss_ratio gauge\n"
+					  "# HELP ft_ping_loss_ratio Fraction of answered or expired probes that expired.\n");
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_ping_stats *stats = &state->targets[i].stats;
+		long known = stats->packets_received + stats->timeouts;
+		append_body(body, "ft_ping_loss_ratio");
+		append_labels(body, &state->targets[i], NULL);
+		append_body(body, " %.6f\n", (known > 0) ? (double)stats->timeouts / known : 0.0);
+	}
+	append_body(body, "# TYPE ft_ping_rtt_seconds histogram\n"
+					  "# UNIT ft_ping_rtt_seconds seconds\n"
+					  "# HELP ft_ping_rtt_seconds Round-trip time of echo replies.\n");
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_ping_stats *stats = &state->targets[i].stats;
+		char le[32];
+		histogram_cumulative(&stats->rtt_hist, rtt_bounds, RTT_BOUNDS, below);
+		for (size_t b = 0; b < RTT_BOUNDS; b++) {
+			snprintf(le, sizeof(le), "le=\"%s\"", rtt_labels[b]);
+			append_body(body, "ft_ping_rtt_seconds_bucket");
+			append_labels(body, &state->targets[i], le);
+			append_body(body, " %llu\n", (unsigned long long)below[b]);
+		}
+		append_body(body, "ft_ping_rtt_seconds_bucket");
+		append_labels(body, &state->targets[i], "le=\"+Inf\"");
+		append_body(body, " %ld\n", stats->rtt_count);
+		append_body(body, "ft_ping_rtt_seconds_count");
+		append_labels(body, &state->targets[i], NULL);
+		append_body(body, " %ld\n", stats->rtt_count);
+		append_body(body, "ft_ping_rtt_seconds_sum");
+		append_labels(body, &state->targets[i], NULL);
+		append_body(body, " %.9f\n", stats->sum_rtt / 1000.0);
+	}
+	append_body(body, "# EOF\n");
+}
+
+/**
+ * @param state - ping state containing the statistics
+ * @param client - connection whose request head is complete
+ *
+ * Builds the whole response once, so a slow client sees a consistent scrape.
+ * The body is formatted after METRICS_HEADER_S reserved bytes and the header
+ * written right in front of it
+ */
+static void build_response(t_ping_state *state, t_metrics_client *client) {
+	t_metrics_body body = {.buf = malloc(METRICS_RESPONSE_S), .len = METRICS_HEADER_S, .cap = METRICS_RESPONSE_S};
+	const char *status = "200 OK";
+	const char *type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+	char header[METRICS_HEADER_S];
+
+	if (!body.buf) {
+		return;
+	}
+	if (strncmp(client->request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+	} else if (strncmp(client->request + 4, "/metrics", 8) != 0 ||
+			   (client->request[12] != ' ' && client->request[12] != '?')) {
+		status = "404 Not Found";
+	}
+	if (status[0] == '2') {
+		format_metrics(state, &body);
+	} else {
+		type = "text/plain; charset=utf-8";
+		append_body(&body, "%s\n", status);
+	}
+	if (body.failed) {
+		free(body.buf);
+		return;
+	}
+	int len = snprintf(header, sizeof(header),
+					   "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+					   status, type, body.len - METRICS_HEADER_S);
+	memcpy(body.buf + METRICS_HEADER_S - len, header, len);
+	client->response = body.buf;
+	client->response_len = body.len;
+	client->sent = METRICS_HEADER_S - len;
+}
+
+/**
+ * @param state - ping state containing the metrics listener
+ * @param client - connection to close
+ *
+ * Frees the slot, and listens again if a full table had stopped accepting
+ */
+static void close_client(t_ping_state *state, t_metrics_client *client) {
+	close(client->fd);
+	free(client->response);
+	client->fd = -1;
+	client->response = NULL;
+	if (!state->metrics.armed) {
+		watch_once(state, state->metrics.listen_fd, EPOLLIN);
+		state->metrics.armed = 1;
+	}
+}
+
+/**
+ * @param state - ping state counting syscalls
+ * @param client - connection with a response to send
+ *
+ * Sends what the socket accepts and waits for room for the rest; the
+ * connection is closed once the response is sent
+ */
+static void send_response(t_ping_state *state, t_metrics_client *client) {
+	while (client->sent < client->response_len) {
+		state->io.syscalls++;
+		ssize_t sent = send(client->fd, client->response + client->sent,
+							client->response_len - client->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0 && (errno == EAGAIN || errno == EINTR)) {
+			watch_once(state, client->fd, EPOLLOUT);
+			return;
+		}
+		if (sent <= 0) {
+			break;
+		}
+		client->sent += sent;
+	}
+	close_client(state, client);
+}
+
+/**
+ * @param state - ping state containing the statistics
+ * @param client - connection reading its request
+ *
+ * Reads until the end of the request head, then answers it. A request head
+ * longer than METRICS_REQUEST_S or a connection closed early is dropped
+ */
+static void read_request(t_ping_state *state, t_metrics_client *client) {
+	while (client->len < METRICS_REQUEST_S - 1) {
+		state->io.syscalls++;
+		ssize_t got = recv(client->fd, client->request + client->len,
+						   METRICS_REQUEST_S - 1 - client->len, MSG_DONTWAIT);
+		if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+			watch_once(state, client->fd, EPOLLIN);
+			return;
+		}
+		if (got <= 0) {
+			break;
+		}
+		client->len += got;
+		client->request[client->len] = '\0';
+		if (strstr(client->request, "\r\n\r\n") || strstr(client->request, "\n\n")) {
+			build_response(state, client);
+			if (client->response) {
+				send_response(state, client);
+				return;
+			}
+			break;
+		}
+	}
+	close_client(state, client);
+}
+
+/**
+ * @param state - ping state containing the client table
+ * @return free client slot, NULL if the table is full
+ */
+static t_metrics_client *free_client(t_ping_state *state) {
+	for (int i = 0; i < METRICS_CLIENTS; i++) {
+		if (state->metrics.clients[i].fd < 0) {
+			return &state->metrics.clients[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @param state - ping state containing the client table
+ *
+ * Shuts down the oldest connection to make room for a new one. Its pending
+ * wait then reports it, and it is closed like any finished connection
+ */
+static void evict_oldest(t_ping_state *state) {
+	t_metrics_client *oldest = &state->metrics.clients[0];
+
+	for (int i = 1; i < METRICS_CLIENTS; i++) {
+		if (state->metrics.clients[i].accepted < oldest->accepted) {
+			oldest = &state->metrics.clients[i];
+		}
+	}
+	shutdown(oldest->fd, SHUT_RDWR);
+}
+
+/**
+ * @param state - ping state containing the metrics listener
+ *
+ * Accepts the pending connections while there is room and starts reading
+ * their requests. With every slot taken the oldest connection is evicted and
+ * accepting resumes once its slot is free
+ */
+static void accept_clients(t_ping_state *state) {
+	t_metrics_client *client = free_client(state);
+
+	state->metrics.armed = 0;
+	if (!client) {
+		evict_oldest(state);
+		return;
+	}
+	while (client) {
+		state->io.syscalls++;
+		int fd = accept4(state->metrics.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			break;
+		}
+		client->fd = fd;
+		client->accepted = state->metrics.accepted++;
+		client->len = 0;
+		read_request(state, client);
+		client = free_client(state);
+	}
+	if (!state->metrics.armed) {
+		watch_once(state, state->metrics.listen_fd, EPOLLIN);
+		state->metrics.armed = 1;
+	}
+}
+
+/**
+ * @param state - ping state containing the metrics listener and clients
+ * @param fd - descriptor the event loop found ready
+ * @return 1 if the descriptor belongs to the metrics endpoint, 0 otherwise
+ *
+ * Serves a scrape from the event loop, so the statistics are read by the
+ * thread that updates them and the probe path takes no lock
+ */
+int handle_metrics(t_ping_state *state, int fd) {
+	if (state->metrics.listen_fd < 0) {
+		return 0;
+	}
+	if (fd == state->metrics.listen_fd) {
+		accept_clients(state);
+		return 1;
+	}
+	for (int i = 0; i < METRICS_CLIENTS; i++) {
+		t_metrics_client *client = &state->metrics.clients[i];
+		if (client->fd == fd) {
+			if (client->response) {
+				send_response(state, client);
+			} else {
+				read_request(state, client);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the metrics listener and clients
+ *
+ * Closes the listener and every connection still open. The listener is shut
+ * down first: a wait io_uring still holds on it would otherwise keep the port
+ * bound until the ring is torn down
+ */
+void cleanup_metrics(t_ping_state *state) {
+	if (state->metrics.listen_fd < 0) {
+		return;
+	}
+	for (int i = 0; i < METRICS_CLIENTS; i++) {
+		if (state->metrics.clients[i].fd >= 0) {
+			close(state->metrics.clients[i].fd);
+			free(state->metrics.clients[i].response);
+			state->metrics.clients[i].fd = -1;
+		}
+	}
+	shutdown(state->metrics.listen_fd, SHUT_RDWR);
+	close(state->metrics.listen_fd);
+	state->metrics.listen_fd = -1;
+}
@@ -1,62 +1,179 @@
 #include "../includes/ft_ping.h"
 
 /**
- * @param state - ping state to populate with resolved address info
- * @param argv - command line arguments for error reporting
+ * @param target - target whose name to resolve
  * @return 0 on success, 1 on failure
  * 
- * Resolves target hostname to IP address and populates connection info
+ * Resolves a target hostname to an IP address and stores it with its display string
  */
-int resolveHost(t_ping_state *state, char **argv) {
+static int resolve_target(t_target *target) {
 	struct addrinfo hints, *result;
 	
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_RAW;
 	
-	if (getaddrinfo(state->conn.target, NULL, &hints, &result) != 0) {
-		fprintf(stderr, "%s: %s: Name or service not known\n", 
-				argv[0], state->conn.target);
+	if (getaddrinfo(target->name, NULL, &hints, &result) != 0) {
 		return 1;
 	}
 	
-	state->conn.ipv4.family = AF_INET;
-	state->conn.ipv4.protocol = IPPROTO_ICMP;
-	state->conn.ipv4.addr_len = sizeof(struct sockaddr_in);
-	
-	state->conn.ipv6.family = AF_INET6;
-	state->conn.ipv6.protocol = IPPROTO_ICMPV6;
-	state->conn.ipv6.addr_len = sizeof(struct sockaddr_in6);
-	
+	target->family = result->ai_family;
 	if (result->ai_family == AF_INET) {
-		memcpy(&state->conn.ipv4.addr, result->ai_addr, sizeof(struct sockaddr_in));
-		inet_ntop(AF_INET, &((struct sockaddr_in*)&state->conn.ipv4.addr)->sin_addr, 
-				state->conn.ipv4.addr_str, INET_ADDRSTRLEN);
+		target->addr_len = sizeof(struct sockaddr_in);
+		memcpy(&target->addr, result->ai_addr, sizeof(struct sockaddr_in));
+		inet_ntop(AF_INET, &((struct sockaddr_in*)&target->addr)->sin_addr, 
+				target->addr_str, INET_ADDRSTRLEN);
 	} else if (result->ai_family == AF_INET6) {
-		memcpy(&state->conn.ipv6.addr, result->ai_addr, sizeof(struct sockaddr_in6));
-		inet_ntop(AF_INET6, &((struct sockaddr_in6*)&state->conn.ipv6.addr)->sin6_addr, 
-				state->conn.ipv6.addr_str, INET6_ADDRSTRLEN);
+		target->addr_len = sizeof(struct sockaddr_in6);
+		memcpy(&target->addr, result->ai_addr, sizeof(struct sockaddr_in6));
+		inet_ntop(AF_INET6, &((struct sockaddr_in6*)&target->addr)->sin6_addr, 
+				target->addr_str, INET6_ADDRSTRLEN);
 	}
-	state->conn.target_family = result->ai_family;
 	freeaddrinfo(result);
 	return 0;
 }
 
+/**
+ * @param state - ping state containing the targets to resolve
+ * @param argv - command line arguments for error reporting
+ * @return 0 on success, 1 if no target could be resolved
+ * 
+ * Resolves every target hostname to an IP address, reports and drops the ones
+ * that do not resolve, and builds the address to target map
+ */
+int resolveHost(t_ping_state *state, char **argv) {
+	size_t kept = 0;
+	
+	for (size_t i = 0; i < state->ntargets; i++) {
+		if (resolve_target(&state->targets[i]) != 0) {
+			fprintf(stderr, "%s: %s: Name or service not known\n", 
+					argv[0], state->targets[i].name);
+			free(state->targets[i].name);
+			continue;
+		}
+		state->targets[kept++] = state->targets[i];
+	}
+	state->ntargets = kept;
+	if (kept == 0) {
+		return 1;
+	}
+	return init_target_map(state);
+}
+
+/**
+ * @param state - ping state to store socket file descriptors
+ * @param socktype - SOCK_RAW or SOCK_DGRAM
+ * @return 0 on success, -1 with errno set on failure
+ * 
+ * Opens the IPv4 and IPv6 ICMP sockets of one backend, closing both on failure
+ */
+static int open_sockets(t_ping_state *state, int socktype) {
+	state->conn.ipv4.sockfd = socket(AF_INET, socktype, IPPROTO_ICMP);
+	state->conn.ipv6.sockfd = socket(AF_INET6, socktype, IPPROTO_ICMPV6);
+	
+	if (state->conn.ipv4.sockfd < 0 || state->conn.ipv6.sockfd < 0) {
+		int err = errno;
+		if (state->conn.ipv4.sockfd >= 0) {
+			close(state->conn.ipv4.sockfd);
+		}
+		if (state->conn.ipv6.sockfd >= 0) {
+			close(state->conn.ipv6.sockfd);
+		}
+		state->conn.ipv4.sockfd = -1;
+		state->conn.ipv6.sockfd = -1;
+		errno = err;
+		return -1;
+	}
+	state->conn.socktype = socktype;
+	return 0;
+}
+
+/**
+ * @param sockfd - ICMP datagram socket
+ * @param family - AF_INET or AF_INET6
+ * @param id - pointer to store the echo identifier
+ * @return 0 on success, -1 on failure
+ * 
+ * Binds a datagram ICMP socket to a free identifier. The kernel writes it into
+ * every echo request and only delivers replies carrying it
+ */
+static int bind_identifier(int sockfd, int family, uint16_t *id) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len = (family == AF_INET) ? 
+						 sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.ss_family = family;
+	if (bind(sockfd, (struct sockaddr*)&addr, addr_len) < 0 ||
+		getsockname(sockfd, (struct sockaddr*)&addr, &addr_len) < 0) {
+		return -1;
+	}
+	*id = ntohs((family == AF_INET) ? ((struct sockaddr_in*)&addr)->sin_port : 
+									  ((struct sockaddr_in6*)&addr)->sin6_port);
+	return 0;
+}
+
+/**
+ * @return identifier of shard 0 for raw and simulated sockets
+ *
+ * Draws a random base once per process, so the identifiers of the shards,
+ * which follow it, do not collide with those of another ft_ping the way
+ * consecutive process IDs do. Falls back to the process ID when no random
+ * bytes are available. Only called from the main thread
+ */
+static uint16_t identifier_base(void) {
+	static uint16_t base;
+	static int drawn;
+	
+	if (!drawn) {
+		if (getrandom(&base, sizeof(base), GRND_NONBLOCK) != sizeof(base)) {
+			base = getpid();
+		}
+		drawn = 1;
+	}
+	return base;
+}
+
 /**
  * @param state - ping state to store socket file descriptors
  * @param argv - command line arguments for error reporting
  * @return 0 on success, 1 on failure
  * 
- * Creates IPv4 and IPv6 raw sockets and sets them to non-blocking mode
- * sets TTL option for ipv4 and hop limit for ipv6
+ * Creates IPv4 and IPv6 raw sockets, or unprivileged ICMP datagram sockets when
+ * raw ones are not permitted, and sets them to non-blocking mode. Raw sockets
+ * send with a random per-process identifier (offset per shard), datagram
+ * sockets with the one the kernel bound them to. Sets TTL option for ipv4 and hop limit
+ * for ipv6, and asks for the received TTL / hop limit and for ICMP errors.
+ * -E sim opens no socket and behaves like a raw one
  */
 int createSocket(t_ping_state *state, char **argv) {
 	int flags;
-	state->conn.ipv4.sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
-	state->conn.ipv6.sockfd = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+	int on = 1;
 	
-	if (state->conn.ipv4.sockfd < 0 || state->conn.ipv6.sockfd < 0) {
-		fprintf(stderr, "%s: Cannot create socket\n", argv[0]);
+	if (state->opts.backend == IO_SIM) {
+		state->conn.socktype = SOCK_RAW;
+		state->conn.ipv4.sockfd = -1;
+		state->conn.ipv6.sockfd = -1;
+		state->conn.ipv4.pid = identifier_base() + state->shard.index;
+		state->conn.ipv6.pid = state->conn.ipv4.pid;
+		return 0;
+	}
+	if (open_sockets(state, SOCK_RAW) < 0) {
+		if ((errno != EPERM && errno != EACCES) || open_sockets(state, SOCK_DGRAM) < 0) {
+			fprintf(stderr, "%s: Cannot create socket: %s\n", argv[0], strerror(errno));
+			if (errno == EACCES || errno == EPERM) {
+				fprintf(stderr, "%s: raw sockets need CAP_NET_RAW, ICMP datagram sockets need a group in net.ipv4.ping_group_range\n", argv[0]);
+			}
+			return 1;
+		}
+	}
+	
+	if (state->conn.socktype == SOCK_RAW) {
+		state->conn.ipv4.pid = identifier_base() + state->shard.index;
+		state->conn.ipv6.pid = state->conn.ipv4.pid;
+	} else if (bind_identifier(state->conn.ipv4.sockfd, AF_INET, &state->conn.ipv4.pid) < 0 ||
+			   bind_identifier(state->conn.ipv6.sockfd, AF_INET6, &state->conn.ipv6.pid) < 0) {
+		perror("bind");
 		return 1;
 	}
 	
@@ -77,152 +194,588 @@ int createSocket(t_ping_state *state, char **argv) {
 		return 1;
 	}
 	
+	setsockopt(state->conn.ipv6.sockfd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on));
+	if (state->conn.socktype == SOCK_DGRAM) {
+		setsockopt(state->conn.ipv4.sockfd, IPPROTO_IP, IP_RECVTTL, &on, sizeof(on));
+		setsockopt(state->conn.ipv4.sockfd, IPPROTO_IP, IP_RECVERR, &on, sizeof(on));
+		setsockopt(state->conn.ipv6.sockfd, IPPROTO_IPV6, IPV6_RECVERR, &on, sizeof(on));
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing packet size and preload options
+ * @return 0 on success, 1 on failure
+ * 
+ * Allocates recvmmsg() buffers and wires up the per-family sendmmsg() headers
+ * once, grows the receive buffers so a full preload burst of replies fits
+ */
+int init_batches(t_ping_state *state) {
+	size_t buf_size = state->opts.psize + TOTAL_HDR_S;
+	size_t count = RECV_BATCH_BYTES / buf_size;
+	count = (count < 1) ? 1 : MIN(count, RECV_BATCH);
+	
+	state->rx.count = count;
+	state->rx.buf_size = buf_size;
+	state->rx.msgs = calloc(count, sizeof(struct mmsghdr));
+	state->rx.iovs = calloc(count, sizeof(struct iovec));
+	state->rx.addrs = calloc(count, sizeof(struct sockaddr_storage));
+	state->rx.buffers = malloc(count * buf_size);
+	state->rx.controls = malloc(count * RX_CONTROL_S);
+	if (!state->rx.msgs || !state->rx.iovs || !state->rx.addrs || !state->rx.buffers || 
+		!state->rx.controls) {
+		fprintf(stderr, "malloc failed for receive batch\n");
+		cleanup_batches(state);
+		return 1;
+	}
+	
+	size_t head_len = MIN(state->opts.psize, PACKET_HEAD_S);
+	
+	memset(&state->tx, 0, sizeof(state->tx));
+	for (int f = 0; f < 2; f++) {
+		for (size_t i = 0; i < SEND_BATCH; i++) {
+			state->tx[f].iovs[i][0].iov_base = state->tx[f].heads[i];
+			state->tx[f].iovs[i][0].iov_len = head_len;
+			state->tx[f].iovs[i][1].iov_base = (char*)state->templates[f].packet + head_len;
+			state->tx[f].iovs[i][1].iov_len = state->opts.psize - head_len;
+			state->tx[f].msgs[i].msg_hdr.msg_iov = state->tx[f].iovs[i];
+			state->tx[f].msgs[i].msg_hdr.msg_iovlen = 2;
+		}
+	}
+	
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+	long wanted = (long)(buf_size + 512) * state->opts.preload * state->ntargets;
+	for (int f = 0; f < 2; f++) {
+		int rcvbuf = 0;
+		socklen_t optlen = sizeof(rcvbuf);
+		getsockopt(sockets[f], SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
+		if (wanted > rcvbuf && wanted <= INT_MAX) {
+			rcvbuf = wanted;
+			setsockopt(sockets[f], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		}
+	}
 	return 0;
 }
 
+/**
+ * @param state - ping state containing receive batch
+ * 
+ * Frees recvmmsg() buffers
+ */
+void cleanup_batches(t_ping_state *state) {
+	free(state->rx.msgs);
+	free(state->rx.iovs);
+	free(state->rx.addrs);
+	free(state->rx.buffers);
+	free(state->rx.controls);
+	memset(&state->rx, 0, sizeof(state->rx));
+}
+
+/**
+ * @param state - ping state containing receive batch
+ * 
+ * Resets the recvmmsg() headers, buffers and control space for a new call
+ */
+static void prepare_rx_batch(t_ping_state *state) {
+	for (size_t i = 0; i < state->rx.count; i++) {
+		state->rx.iovs[i].iov_base = state->rx.buffers + i * state->rx.buf_size;
+		state->rx.iovs[i].iov_len = state->rx.buf_size;
+		memset(&state->rx.msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+		state->rx.msgs[i].msg_hdr.msg_name = &state->rx.addrs[i];
+		state->rx.msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		state->rx.msgs[i].msg_hdr.msg_iov = &state->rx.iovs[i];
+		state->rx.msgs[i].msg_hdr.msg_iovlen = 1;
+		state->rx.msgs[i].msg_hdr.msg_control = state->rx.controls + i * RX_CONTROL_S;
+		state->rx.msgs[i].msg_hdr.msg_controllen = RX_CONTROL_S;
+	}
+}
+
+/**
+ * @param msg - received message with control data
+ * @return TTL or hop limit the datagram arrived with, -1 if the message has none
+ */
+static int message_ttl(struct msghdr *msg) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_TTL) ||
+			(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT)) {
+			int ttl;
+			memcpy(&ttl, CMSG_DATA(cmsg), sizeof(ttl));
+			return ttl;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @param err - errno of a failed receive
+ * @return 1 if it reports an ICMP error queued on a datagram socket, 0 otherwise
+ * 
+ * Datagram ICMP sockets also raise ICMP errors as a pending socket error, which
+ * the next receive returns once; the error itself waits on the error queue
+ */
+static int pending_icmp_error(int err) {
+	return err == ECONNREFUSED || err == EHOSTUNREACH || err == ENETUNREACH ||
+		   err == EHOSTDOWN || err == ENETDOWN || err == EPROTO || 
+		   err == EACCES || err == EMSGSIZE || err == ENOPROTOOPT;
+}
+
 /**
  * @param state - ping state containing packet tracking and statistics
- * @param sockfd - socket file descriptor to receive from
- * @return 0 on successful packet reception, 1 on failure or no packet
+ * @param f - family index of the socket the datagram arrived on
+ * @param msg - received message, its name is the sender and its control data
+ * @param buffer - datagram payload
+ * @param len - payload length
+ * @param returned_at - time the receive returned, used without a kernel RX timestamp
+ * @return 0 if the datagram matched a sent packet, 1 otherwise
  * 
- * Receives ICMP reply packet and processes it if it matches a sent packet
+ * Processes one received datagram, whichever I/O backend read it, and
+ * captures it with the RTT it gave when --pcap is on
  */
-int receive_packet(t_ping_state *state, int sockfd) {
-	char buffer[state->opts.psize + TOTAL_HDR_S];
-	struct sockaddr_storage from;
-	socklen_t fromlen = sizeof(from);
+int handle_datagram(t_ping_state *state, int f, struct msghdr *msg, char *buffer, size_t len, int64_t returned_at) {
+	int64_t rx_time = message_timestamp(msg);
+	if (state->ts.source != TS_KERNEL || rx_time == 0) {
+		rx_time = returned_at;
+	}
+	int ttl = message_ttl(msg);
+	state->filter.delivered[f]++;
+	state->pcap.rtt_ns = -1;
+	int ret = parse_icmp_reply(buffer, len, state, msg->msg_name, rx_time, ttl);
+	pcap_datagram(state, f, msg->msg_name, buffer, len, rx_time, ttl);
+	return ret;
+}
 
-	ssize_t bytes_received = recvfrom(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT, 
-									 (struct sockaddr*)&from, &fromlen);
+/**
+ * @param state - ping state containing packet tracking
+ * @param family - family of the socket the message was read from
+ * @param msg - message read from the socket error queue
+ * @param len - payload length
+ * 
+ * Processes one error queue message: a TX timestamp, or on datagram sockets an
+ * ICMP error for one of our probes
+ */
+void handle_queued_message(t_ping_state *state, int family, struct msghdr *msg, size_t len) {
+	handle_tx_timestamp(state, family, msg);
+	if (state->conn.socktype == SOCK_DGRAM) {
+		parse_queued_error(state, msg, len);
+	}
+}
+
+/**
+ * @param state - ping state containing packet tracking and statistics
+ * @param sockfd - socket file descriptor to receive from
+ * @return number of replies that matched a sent packet, -1 on receive error
+ * 
+ * Drains the socket with recvmmsg() and processes every datagram that
+ * matches a sent packet, stops once the socket would block. Each datagram is
+ * stamped with its kernel RX timestamp, or the time recvmmsg() returned
+ */
+int receive_packets(t_ping_state *state, int sockfd) {
+	int processed = 0;
 	
-	if (bytes_received < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			return 1;
-		} else {
-			perror("recvfrom");
-			return 1;
+	while (1) {
+		prepare_rx_batch(state);
+		int received = recvmmsg(sockfd, state->rx.msgs, state->rx.count, MSG_DONTWAIT, NULL);
+		state->io.syscalls++;
+		if (received < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				return processed;
+			}
+			if (state->conn.socktype == SOCK_DGRAM && pending_icmp_error(errno)) {
+				receive_errors(state, sockfd);
+				return processed;
+			}
+			perror("recvmmsg");
+			return (processed > 0) ? processed : -1;
+		}
+		
+		int64_t returned_at = timestamp_now(state);
+		int f = (sockfd == state->conn.ipv4.sockfd) ? 0 : 1;
+		for (int i = 0; i < received; i++) {
+			if (handle_datagram(state, f, &state->rx.msgs[i].msg_hdr, state->rx.iovs[i].iov_base,
+								state->rx.msgs[i].msg_len, returned_at) == 0) {
+				processed++;
+			}
+		}
+		if ((size_t)received < state->rx.count) {
+			return processed;
 		}
 	}
+}
+
+/**
+ * @param state - ping state containing packet tracking
+ * @param sockfd - socket file descriptor whose error queue to drain
+ * 
+ * Drains the socket error queue, where the kernel returns TX timestamps and,
+ * on datagram sockets, ICMP errors for our probes
+ */
+void receive_errors(t_ping_state *state, int sockfd) {
+	int family = (sockfd == state->conn.ipv4.sockfd) ? AF_INET : AF_INET6;
 	
-	return parse_icmp_reply(buffer, bytes_received, state, &from);
+	while (1) {
+		prepare_rx_batch(state);
+		int received = recvmmsg(sockfd, state->rx.msgs, state->rx.count, 
+								MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+		state->io.syscalls++;
+		if (received <= 0) {
+			return;
+		}
+		for (int i = 0; i < received; i++) {
+			handle_queued_message(state, family, &state->rx.msgs[i].msg_hdr, state->rx.msgs[i].msg_len);
+		}
+		if ((size_t)received < state->rx.count) {
+			return;
+		}
+	}
 }
 
 /**
- * @param state - ping state containing options and timing info
- * @param sequence - sequence number of packet to check
- * @return 1 if packet should be sent, 0 if not
+ * @param state - ping state containing options and targets
  * 
- * Determines if a packet should be sent based on count limits and timing
+ * Sets up the round robin scheduler: targets take turns, so each one is probed
+ * once per interval and consecutive probes are spread evenly across it. The
+ * first --stats-interval summary is due one stats interval from now
  */
-static int can_send(t_ping_state *state, uint16_t sequence) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
+void init_schedule(t_ping_state *state) {
+	long interval = state->opts.interval;
+	long preload = state->opts.preload;
 	
-	if (state->opts.count != -1 && sequence > state->opts.count) {
-		return 0;
+	if (state->opts.flood && interval == 0) {
+		interval = FLOOD_INTERVAL_US;
+	}
+	if (state->opts.count != -1 && preload > state->opts.count) {
+		preload = state->opts.count;
 	}
 	
-	if (state->stats.preload_sent < state->opts.preload) {
-		return 1;
-	} else if (state->stats.last_packet_time.tv_sec == 0) {
-		return 1;
-	} else {
-		long elapsed = timeval_diff_ms(&state->stats.last_packet_time, &now);
-		return (elapsed >= 1000);
+	memset(&state->sched, 0, sizeof(state->sched));
+	memset(&state->send_jitter, 0, sizeof(state->send_jitter));
+	state->sched.period = interval * NSEC_PER_USEC / (int64_t)state->ntargets;
+	if (state->opts.rate > 0.0) {
+		state->sched.period = MAX((int64_t)(NSEC_PER_SEC / state->opts.rate + 0.5), 1);
 	}
+	state->sched.preload_total = preload * (long)state->ntargets;
+	state->sched.remaining = (state->opts.count == -1) ? -1 : 
+							 (long)state->opts.count * (long)state->ntargets;
+	state->sched.next_send = clock_now(state);
+	state->loop.status_at = (state->opts.stats_interval > 0) ?
+							state->sched.next_send + state->opts.stats_interval * NSEC_PER_USEC : 0;
 }
 
 /**
- * @param state - ping state containing connection info
- * @param packet - packet entry to send
- * @param sockfd - socket file descriptor to send through
- * @return 0 on success, 1 on failure
+ * @param state - ping state containing scheduler info and targets
+ * @return next target in round robin order that still has probes to send, NULL if none
+ */
+static t_target *next_target(t_ping_state *state) {
+	for (size_t tries = 0; tries < state->ntargets; tries++) {
+		t_target *target = &state->targets[state->sched.next_target];
+		state->sched.next_target = (state->sched.next_target + 1) % state->ntargets;
+		if (state->opts.count == -1 || target->sequence <= state->opts.count) {
+			return target;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @param state - ping state containing options and scheduler info
+ * @param now - current monotonic time
+ * @return number of packets to send now, 0 if none
  * 
- * Sends ICMP packet through the specified socket
+ * Determines how many packets are due based on count limits and the send schedule.
+ * The preload and back to back sends (-i 0) go out in bursts of up to SEND_BATCH,
+ * flood mode sends as soon as every outstanding probe has been answered. With
+ * many targets several send periods can elapse per wakeup, they are sent together,
+ * with --rate only as many as the token bucket holds (--burst).
+ * A batch never holds more probes per target than its table has slots
  */
-static int send_packet(t_ping_state *state, t_packet_entry *packet, int sockfd) {
-	struct sockaddr *addr;
-	socklen_t addr_len;
+static int probes_due(t_ping_state *state, int64_t now) {
+	long due = 0;
 	
-	if (sockfd == state->conn.ipv4.sockfd) {
-		addr = (struct sockaddr*)&state->conn.ipv4.addr;
-		addr_len = state->conn.ipv4.addr_len;
-	} else {
-		addr = (struct sockaddr*)&state->conn.ipv6.addr;
-		addr_len = state->conn.ipv6.addr_len;
+	if (state->sched.remaining == 0) {
+		return 0;
 	}
 	
-	ssize_t bytes_sent = sendto(sockfd, packet->packet, state->opts.psize, 0, addr, addr_len);
-	if (bytes_sent < 0) {
-		perror("sendto");
-		return 1;
+	if (state->sched.preload_sent < state->sched.preload_total) {
+		due = state->sched.preload_total - state->sched.preload_sent;
+	} else if (state->opts.flood && state->sched.in_flight == 0) {
+		due = 1;
+	} else if (now >= state->sched.next_send) {
+		due = (state->sched.period == 0) ? SEND_BATCH : 
+			  (now - state->sched.next_send) / state->sched.period + 1;
+		if (state->opts.rate > 0.0) {
+			due = MIN(due, state->opts.burst);
+		}
 	}
-	
-	if ((size_t)bytes_sent != state->opts.psize) {
-		fprintf(stderr, "sendto: partial packet sent (%zd of %zu bytes)\n", 
-				bytes_sent, state->opts.psize);
-		return 1;
+	if (state->sched.remaining != -1) {
+		due = MIN(due, state->sched.remaining);
 	}
-	return 0;
+	due = MIN(due, (long)((state->targets[0].packets.mask + 1) * state->ntargets));
+	return MIN(due, SEND_BATCH);
 }
 
 /**
- * @param state - ping state to update with send statistics
- * @param packet - packet entry that was sent
- * @param sequence - pointer to sequence number to increment
+ * @param state - ping state containing scheduler info
+ * @param decided_at - monotonic time the batch was found due at
+ * @param now - monotonic time the batch was sent at
+ * @param sent - number of probes in the batch
+ * @param preloading - whether the batch was part of the preload
+ * 
+ * Advances the send schedule by one period per probe from the previous due time
+ * so the rate does not drift, restarting from now when the loop has fallen
+ * behind by more than a batch.
+ * With --rate the schedule is a token bucket of --burst probes filling at the
+ * rate: next_send is when the bucket next holds a probe, and it may lag
+ * decided_at by at most burst - 1 periods, so a late wakeup is made up by at
+ * most that many probes back to back and the rest of the delay is dropped
+ */
+static void schedule_next_send(t_ping_state *state, int64_t decided_at, int64_t now, int sent, int preloading) {
+	if (preloading) {
+		state->sched.next_send = now + state->sched.period;
+		return;
+	}
+	if (state->opts.rate > 0.0) {
+		int64_t full = decided_at - (state->opts.burst - 1) * state->sched.period;
+		state->sched.next_send = MAX(state->sched.next_send, full) + state->sched.period * sent;
+		return;
+	}
+	state->sched.next_send += state->sched.period * sent;
+	if (state->sched.next_send < now) {
+		state->sched.next_send = now;
+	}
+}
+
+/**
+ * @param state - ping state containing the echo templates and send batches
+ * @param target - target the probe is sent to
+ * @param packet - table entry of the stamped probe
  * 
- * Updates packet timing, send statistics, and transmission completion status
+ * Copies the per-probe head of the freshly stamped template into the send batch
+ * of the target's family and addresses the message to the target
  */
-static void update_stats(t_ping_state *state, t_packet_entry *packet, uint16_t *sequence) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
+static void queue_probe(t_ping_state *state, t_target *target, t_packet_entry *packet) {
+	int f = FAMILY_IDX(target->family);
+	int i = state->tx[f].count++;
+	struct msghdr *hdr = &state->tx[f].msgs[i].msg_hdr;
 	
-	packet->send_time = now;
+	memcpy(state->tx[f].heads[i], state->templates[f].packet, state->tx[f].iovs[i][0].iov_len);
+	hdr->msg_name = &target->addr;
+	hdr->msg_namelen = target->addr_len;
+	state->tx[f].targets[i] = target;
+	state->tx[f].sequences[i] = packet->sequence;
+}
+
+/**
+ * @param state - ping state containing connection info and send batch
+ * @param f - family index of the batch to send
+ * @return number of probes handed to the kernel or failed for good
+ * 
+ * Sends the batched ICMP packets through the family's socket with sendmmsg(),
+ * as linked io_uring submissions with the same semantics, or into the
+ * simulated network.
+ * A probe the kernel rejects outright (e.g. network unreachable) gets its errno
+ * in the batch's errors and the rest of the batch still goes out. Transient
+ * errors stop the batch so the remaining probes are retried on the next wakeup
+ */
+static int send_packets(t_ping_state *state, int f) {
+	int sockfd = (f == 0) ? state->conn.ipv4.sockfd : state->conn.ipv6.sockfd;
+	int count = state->tx[f].count;
+	int done = 0;
 	
-	if (state->stats.packets_sent == 0) {
-		gettimeofday(&state->stats.first_packet_time, NULL);
+	memset(state->tx[f].errors, 0, count * sizeof(state->tx[f].errors[0]));
+	while (done < count) {
+		int sent;
+		if (state->io.backend == IO_URING) {
+			sent = uring_sendmmsg(state, sockfd, state->tx[f].msgs + done, count - done);
+		} else if (state->io.backend == IO_SIM) {
+			sent = sim_sendmmsg(state, f, state->tx[f].msgs + done, count - done);
+		} else {
+			sent = sendmmsg(sockfd, state->tx[f].msgs + done, count - done, 0);
+			state->io.syscalls++;
+		}
+		if (sent > 0) {
+			done += sent;
+			continue;
+		}
+		if (errno == ENOBUFS || errno == ENOMEM || errno == EAGAIN || errno == EINTR) {
+			break;
+		}
+		state->tx[f].errors[done++] = errno;
 	}
-	state->stats.packets_sent++;
-	if (state->stats.preload_sent < state->opts.preload) {
-		state->stats.preload_sent++;
+	return done;
+}
+
+/**
+ * @param stats - statistics to update
+ * @param now - wall clock time the probe was sent at
+ */
+static void count_sent(t_ping_stats *stats, struct timeval *now) {
+	if (stats->packets_sent == 0) {
+		stats->first_packet_time = *now;
 	}
-	state->stats.last_packet_time = now;
-	(*sequence)++;
+	stats->packets_sent++;
+	stats->last_packet_time = *now;
+}
+
+/**
+ * @param state - ping state holding the send schedule statistics
+ * @param late - how long after its slot in the schedule a probe was sent, ns
+ */
+static void record_send_jitter(t_ping_state *state, int64_t late) {
+	late = MAX(late, 0);
+	long count = ++state->send_jitter.count;
+	double delta = late - state->send_jitter.mean;
+	state->send_jitter.mean += delta / count;
+	state->send_jitter.m2 += delta * (late - state->send_jitter.mean);
+	state->send_jitter.max = MAX(state->send_jitter.max, late);
+	histogram_record(&state->send_jitter.hist, late);
+}
+
+/**
+ * @param state - ping state to update with send statistics
+ * @param target - target the probe was meant for
+ * @param error - errno the kernel rejected the probe with
+ * 
+ * Counts a probe the kernel rejected as a send error instead of a transmitted
+ * probe. It still uses up its share of -c and of the preload, so a target
+ * that cannot be reached does not keep the run going. The error is reported
+ * when it first hits the target, not once per probe
+ */
+static void count_send_error(t_ping_state *state, t_target *target, int error) {
+	if (target->send_errno != error) {
+		fprintf(stderr, "ft_ping: sending to %s: %s\n", target->addr_str, strerror(error));
+		target->send_errno = error;
+	}
+	target->stats.errors++;
+	state->stats.errors++;
+	publish_stats(target);
+	if (state->sched.preload_sent < state->sched.preload_total) {
+		state->sched.preload_sent++;
+	}
+	if (state->sched.remaining > 0 && --state->sched.remaining == 0) {
+		state->sched.transmission_complete = 1;
+	}
+}
+
+/**
+ * @param state - ping state to update with send statistics
+ * @param target - target the probe was sent to
+ * @param packet - packet entry that was sent
+ * @param sent_at - monotonic time the probe was sent at
+ * @param now - wall clock time the probe was sent at
+ * 
+ * Updates packet timing, queues its deadline, updates target and total send
+ * statistics, publishing the target's to the --shm segment, and transmission
+ * completion status
+ */
+static void update_stats(t_ping_state *state, t_target *target, t_packet_entry *packet, 
+						 int64_t sent_at, struct timeval *now) {
+	packet->send_time = sent_at;
+	push_deadline(state, target, packet);
 	
-	if (state->opts.count != -1 && *sequence > state->opts.count) {
-		state->stats.transmission_complete = 1;
+	count_sent(&target->stats, now);
+	count_sent(&state->stats, now);
+	publish_stats(target);
+	if (state->sched.preload_sent < state->sched.preload_total) {
+		state->sched.preload_sent++;
+	}
+	if (state->sched.remaining > 0 && --state->sched.remaining == 0) {
+		state->sched.transmission_complete = 1;
 	}
 }
 
 /**
  * @param state - ping state containing options and packet tracking
- * @param sequence - pointer to current sequence number
- * @param target_sockfd - socket file descriptor for target protocol
- * @return 0 on success, 1 on failure
+ * @return 0 on success, 1 if some due probes could not be sent
  * 
- * Main packet sending function - validates, creates, and sends ICMP packets
+ * Main packet sending function - stamps every due probe into the send batch of
+ * its target's family, in round robin target order, and sends each batch with
+ * a single syscall. Probes left unsent or rejected give their table slot back,
+ * and their sequence number when no later probe of the target was stamped.
+ * Rejected probes get no TX timestamp key, the kernel does not number them.
+ * Probes sent on a schedule (not preload, flood or -i 0) record how late they
+ * left after their slot, the k-th of a batch being due k periods after the first
  */
-int send_ping(t_ping_state *state, uint16_t *sequence, int target_sockfd) {
-	if (!can_send(state, *sequence)) {
-		if (state->opts.count != -1 && *sequence > state->opts.count) {
-			state->stats.transmission_complete = 1;
+int send_ping(t_ping_state *state) {
+	int64_t decided_at = clock_now(state);
+	int due = probes_due(state, decided_at);
+	if (due == 0) {
+		if (state->sched.remaining == 0) {
+			state->sched.transmission_complete = 1;
 		}
 		return 0;
 	}
 	
-	t_packet_entry *packet = create_packet(state, *sequence);
-	if (!packet) {
-		fprintf(stderr, "Failed to create packet %d\n", *sequence);
-		cleanup_packets(state);
-		close(state->conn.ipv4.sockfd);
-		close(state->conn.ipv6.sockfd);
-		exit(1); 
+	state->tx[0].count = 0;
+	state->tx[1].count = 0;
+	for (int i = 0; i < due; i++) {
+		t_target *target = next_target(state);
+		if (!target) {
+			break;
+		}
+		t_packet_entry *packet = create_packet(state, target, target->sequence);
+		if (!packet) {
+			fprintf(stderr, "Failed to create packet %d\n", target->sequence);
+			cleanup_packets(state);
+			cleanup_batches(state);
+			cleanup_timestamps(state);
+			cleanup_targets(state);
+			close(state->conn.ipv4.sockfd);
+			close(state->conn.ipv6.sockfd);
+			exit(1); 
+		}
+		queue_probe(state, target, packet);
+		target->sequence++;
 	}
 	
-	if (send_packet(state, packet, target_sockfd) == 0) {
-		update_stats(state, packet, sequence);
-		return 0;
+	int preloading = (state->sched.preload_sent < state->sched.preload_total);
+	int scheduled = !preloading && !state->opts.flood && state->sched.period > 0;
+	int64_t slot = state->sched.next_send;
+	int total_done = 0;
+	int ret = 0;
+	for (int f = 0; f < 2; f++) {
+		if (state->tx[f].count == 0) {
+			continue;
+		}
+		int64_t queued_at = state->pcap.file ? timestamp_now(state) : 0;
+		int done = send_packets(state, f);
+		int64_t sent_at = clock_now(state);
+		int64_t stamp = timestamp_now(state);
+		int64_t wall = clock_wall(state);
+		struct timeval now = {.tv_sec = wall / NSEC_PER_SEC, .tv_usec = wall % NSEC_PER_SEC / NSEC_PER_USEC};
+		
+		for (int i = 0; i < done; i++) {
+			t_target *target = state->tx[f].targets[i];
+			if (state->tx[f].errors[i]) {
+				count_send_error(state, target, state->tx[f].errors[i]);
+				slot += state->sched.period;
+				continue;
+			}
+			t_packet_entry *packet = find_packet(target, state->tx[f].sequences[i]);
+			record_tx_timestamp(state, target, packet, stamp);
+			update_stats(state, target, packet, sent_at, &now);
+			pcap_probe(state, f, i, queued_at);
+			print_flood_mark(state, 0);
+			if (scheduled) {
+				record_send_jitter(state, sent_at - slot);
+				slot += state->sched.period;
+			}
+		}
+		for (int i = state->tx[f].count - 1; i >= 0; i--) {
+			t_target *target = state->tx[f].targets[i];
+			uint16_t sequence = state->tx[f].sequences[i];
+			if (i < done && !state->tx[f].errors[i]) {
+				continue;
+			}
+			remove_packet(state, target, sequence);
+			if (target->sequence == (uint16_t)(sequence + 1)) {
+				target->sequence = sequence;
+			}
+		}
+		total_done += done;
+		ret |= (done != state->tx[f].count);
 	}
-	
-	return 1;
-}
\ No newline at end of file
+	if (total_done > 0) {
+		schedule_next_send(state, decided_at, clock_now(state), total_done, preloading);
+	}
+	return ret;
+}
@@ -0,0 +1,291 @@
+#include "../includes/ft_ping.h"
+
+// Shards share stdout, a flush must not interleave with another shard's
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *record_types[] = {"reply", "error", "timeout"};
+
+/**
+ * @param state - ping state containing the output format
+ * @return 0 on success, 1 on allocation failure
+ *
+ * Allocates the output buffer of the structured formats, text output keeps
+ * going through stdio
+ */
+int init_output(t_ping_state *state) {
+	state->output.len = 0;
+	state->output.flushed_at = clock_now(state);
+	if (state->opts.format == OUTPUT_TEXT) {
+		return 0;
+	}
+	state->output.buffer = malloc(OUTPUT_BUFFER_S);
+	if (!state->output.buffer) {
+		fprintf(stderr, "malloc failed for output buffer\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the output buffer
+ *
+ * Writes the buffered records to stdout, whole records only, retrying partial
+ * writes. A closed or failing stdout drops the output rather than the run.
+ * With -A only the writer thread gets here, its writes are not probe loop
+ * syscalls
+ */
+void output_flush(t_ping_state *state) {
+	size_t written = 0;
+
+	if (state->output.len == 0) {
+		return;
+	}
+	pthread_mutex_lock(&output_lock);
+	while (written < state->output.len) {
+		ssize_t ret = write(STDOUT_FILENO, state->output.buffer + written, state->output.len - written);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			break;
+		}
+		written += ret;
+	}
+	pthread_mutex_unlock(&output_lock);
+	if (!state->writer.ring) {
+		state->io.syscalls++;
+	}
+	state->output.len = 0;
+	state->output.flushed_at = clock_now(state);
+}
+
+/**
+ * @param state - ping state containing the output buffer
+ * @param now - current monotonic time in nanoseconds
+ *
+ * Flushes from the event loop once the oldest buffered record has waited
+ * OUTPUT_FLUSH_NS, so slow runs still stream and fast ones write in big chunks.
+ * The -A writer thread owns the buffer and flushes it itself
+ */
+void output_tick(t_ping_state *state, int64_t now) {
+	if (!state->writer.ring && state->output.len > 0 && now - state->output.flushed_at >= OUTPUT_FLUSH_NS) {
+		output_flush(state);
+	}
+}
+
+/**
+ * @param state - ping state containing the output buffer
+ *
+ * Stops the -A writer thread, flushes what is left and frees the buffer
+ */
+void cleanup_output(t_ping_state *state) {
+	stop_writer(state);
+	if (state->output.buffer) {
+		output_flush(state);
+	}
+	free(state->output.buffer);
+	state->output.buffer = NULL;
+}
+
+/**
+ * @param state - ping state containing the output buffer
+ * @param fmt - printf format of the text to append
+ *
+ * Appends formatted text to the output buffer, records are bounded by
+ * OUTPUT_RECORD_MAX so a record never needs a flush midway
+ */
+__attribute__((format(printf, 2, 3)))
+static void append(t_ping_state *state, const char *fmt, ...) {
+	va_list args;
+	size_t room = OUTPUT_BUFFER_S - state->output.len;
+
+	va_start(args, fmt);
+	int len = vsnprintf(state->output.buffer + state->output.len, room, fmt, args);
+	va_end(args);
+	if (len > 0) {
+		state->output.len += MIN((size_t)len, room - 1);
+	}
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ * @param str - string to append as a JSON string or CSV field
+ *
+ * Quotes and escapes a string, hostnames from -F files are not trusted to be
+ * free of quotes or separators. Longer strings are truncated
+ */
+static void append_string(t_ping_state *state, const char *str) {
+	char quoted[NI_MAXHOST * 2 + 3];
+	size_t len = 0;
+
+	quoted[len++] = '"';
+	for (; *str && len < sizeof(quoted) - 3; str++) {
+		if (*str == '"') {
+			quoted[len++] = (state->opts.format == OUTPUT_JSON) ? '\\' : '"';
+		} else if (state->opts.format == OUTPUT_JSON && *str == '\\') {
+			quoted[len++] = '\\';
+		}
+		quoted[len++] = ((unsigned char)*str < 0x20) ? '?' : *str;
+	}
+	quoted[len++] = '"';
+	quoted[len] = '\0';
+	append(state, "%s", quoted);
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ * @param key - JSON key of the field
+ * @param value - field value
+ * @param present - 0 to leave the field empty (CSV) or out (JSON)
+ */
+static void append_int(t_ping_state *state, const char *key, long long value, int present) {
+	if (state->opts.format == OUTPUT_JSON) {
+		if (present) {
+			append(state, ",\"%s\":%lld", key, value);
+		}
+	} else {
+		append(state, present ? ",%lld" : ",", value);
+	}
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ * @param key - JSON key of the field
+ * @param value - field value, NULL to leave it empty (CSV) or out (JSON)
+ */
+static void append_field(t_ping_state *state, const char *key, const char *value) {
+	if (state->opts.format == OUTPUT_JSON) {
+		if (value) {
+			append(state, ",\"%s\":", key);
+			append_string(state, value);
+		}
+	} else {
+		append(state, ",");
+		if (value) {
+			append_string(state, value);
+		}
+	}
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ * @param type - record type
+ * @param time_ns - wall clock time of the record
+ * @param target - target name
+ *
+ * Starts a record with the fields every record type has
+ */
+static void begin_record(t_ping_state *state, const char *type, int64_t time_ns, const char *target) {
+	if (state->output.len > OUTPUT_BUFFER_S - OUTPUT_RECORD_MAX) {
+		output_flush(state);
+	}
+	if (state->opts.format == OUTPUT_JSON) {
+		append(state, "{\"type\":\"%s\",\"time_ns\":%lld,\"target\":", type, (long long)time_ns);
+		append_string(state, target);
+	} else {
+		append(state, "%s,%lld,", type, (long long)time_ns);
+		append_string(state, target);
+	}
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ */
+static void end_record(t_ping_state *state) {
+	append(state, (state->opts.format == OUTPUT_JSON) ? "}\n" : "\n");
+}
+
+/**
+ * @return current CLOCK_REALTIME time in nanoseconds
+ */
+int64_t wall_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @param state - ping state containing the output format
+ *
+ * Writes the CSV header row; JSON records are self-describing
+ */
+void output_header(t_ping_state *state) {
+	if (state->opts.format != OUTPUT_CSV) {
+		return;
+	}
+	append(state, "type,time_ns,target,addr,seq,size,ttl,rtt_ns,timeout_ns,from,icmp_type,icmp_code,"
+				  "transmitted,received,errors,loss_pct,min_ns,avg_ns,max_ns,mdev_ns,"
+				  "p50_ns,p90_ns,p99_ns,p999_ns\n");
+	output_flush(state);
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ * @param record - result of one probe
+ *
+ * Formats one probe result as a JSON line or CSV row into the output buffer
+ */
+void output_record(t_ping_state *state, t_probe_record *record) {
+	int is_reply = (record->type == RECORD_REPLY);
+	int is_error = (record->type == RECORD_ERROR);
+	char from[INET6_ADDRSTRLEN] = "";
+
+	if (is_error) {
+		const void *addr = (record->from.sa.sa_family == AF_INET6) ?
+						   (const void*)&record->from.v6.sin6_addr : (const void*)&record->from.v4.sin_addr;
+		inet_ntop(record->from.sa.sa_family, addr, from, sizeof(from));
+	}
+	begin_record(state, record_types[record->type], record->time_ns, record->target->name);
+	append_field(state, "addr", record->target->addr_str);
+	append_int(state, "seq", record->sequence, 1);
+	append_int(state, "size", record->size, is_reply);
+	append_int(state, "ttl", record->ttl, is_reply && record->ttl >= 0);
+	append_int(state, "rtt_ns", record->rtt_ns, is_reply && record->rtt_ns >= 0);
+	append_int(state, "timeout_ns", record->timeout_ns, record->type == RECORD_TIMEOUT);
+	append_field(state, "from", is_error ? from : NULL);
+	append_int(state, "icmp_type", record->icmp_type, is_error);
+	append_int(state, "icmp_code", record->icmp_code, is_error);
+	if (state->opts.format == OUTPUT_CSV) {
+		append(state, ",,,,,,,,,,,,");
+	}
+	end_record(state);
+}
+
+/**
+ * @param state - ping state containing the output format and buffer
+ * @param name - target name, or the number of targets for the totals
+ * @param stats - statistics to summarize
+ *
+ * Formats the final summary of a target, RTTs in nanoseconds
+ */
+void output_summary(t_ping_state *state, const char *name, t_ping_stats *stats) {
+	int has_rtt = (stats->rtt_count > 0);
+	double loss = (stats->packets_sent > 0) ?
+				  (double)(stats->packets_sent - stats->packets_received) * 100.0 / stats->packets_sent : 0.0;
+	double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+	const char *percentile_keys[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+
+	begin_record(state, "summary", clock_wall(state), name);
+	if (state->opts.format == OUTPUT_CSV) {
+		append(state, ",,,,,,,,,");
+	}
+	append_int(state, "transmitted", stats->packets_sent, 1);
+	append_int(state, "received", stats->packets_received, 1);
+	append_int(state, "errors", stats->errors, 1);
+	if (state->opts.format == OUTPUT_JSON) {
+		append(state, ",\"loss_pct\":%.3f", loss);
+	} else {
+		append(state, ",%.3f", loss);
+	}
+	append_int(state, "min_ns", llround(stats->min_rtt * NSEC_PER_MSEC), has_rtt);
+	append_int(state, "avg_ns", llround(stats->rtt_mean * NSEC_PER_MSEC), has_rtt);
+	append_int(state, "max_ns", llround(stats->max_rtt * NSEC_PER_MSEC), has_rtt);
+	append_int(state, "mdev_ns", has_rtt ? llround(calculate_mean_deviation(stats) * NSEC_PER_MSEC) : 0, has_rtt);
+	for (int i = 0; i < 4; i++) {
+		int64_t value = has_rtt ? histogram_percentile(&stats->rtt_hist, percentiles[i]) : 0;
+		value = MAX(value, llround(stats->min_rtt * NSEC_PER_MSEC));
+		value = MIN(value, llround(stats->max_rtt * NSEC_PER_MSEC));
+		append_int(state, percentile_keys[i], value, has_rtt);
+	}
+	end_record(state);
+}
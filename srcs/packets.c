@@ -1,178 +1,352 @@
 #include "../includes/ft_ping.h"
 
 /**
- * @param state - ping state to initialize packet system for
- * @return 0 on success
+ * @param state - ping state containing interval, timeout, preload and count options
+ * @return number of table slots, a power of two
  * 
- * Initializes packet tracking system and adjusts packet size for headers
+ * Sizes a target's in-flight table to hold every probe that can be outstanding
+ * to it within one timeout period, capped at the probe count and the 16-bit
+ * sequence space
  */
-int init_packet_system(t_ping_state *state) {
-	state->sent_packets = NULL;
-	state->stats.rtt_list = NULL;
-	size_t header_size = (state->conn.target_family == AF_INET) ? 
-						sizeof(struct icmphdr) : 
-						sizeof(struct icmp6_hdr);    
-	state->opts.psize += header_size; 
-	return 0;
+static size_t packet_table_capacity(t_ping_state *state) {
+	size_t needed = PACKET_TABLE_MAX;
+	if (state->opts.interval > 0) {
+		needed = (size_t)state->opts.timeout * 1000000 / state->opts.interval + state->opts.preload + 1;
+	}
+	if (state->opts.count != -1 && (size_t)state->opts.count < needed) {
+		needed = state->opts.count;
+	}
+	
+	size_t capacity = PACKET_TABLE_MIN;
+	while (capacity < needed && capacity < PACKET_TABLE_MAX) {
+		capacity <<= 1;
+	}
+	return capacity;
 }
 
 /**
- * @param state - ping state containing packet list and connection info
- * @param sequence - sequence number for the new packet
- * @return pointer to created packet entry, NULL on failure
+ * @param state - ping state containing target count and per-target table size
+ * @return number of deadline queue entries, a power of two
  * 
- * Creates new ICMP packet with specified sequence number and adds to tracking list
+ * Sizes the deadline queue to hold every probe that can be outstanding across
+ * all targets within one timeout period
  */
-t_packet_entry* create_packet(t_ping_state *state, uint16_t sequence) {
-	t_packet_entry *entry = malloc(sizeof(t_packet_entry));
-	if (!entry) {
-		fprintf(stderr, "malloc failed for packet entry\n");
-		return NULL;
-	}
-	entry->packet = malloc(state->opts.psize);
-	if (!entry->packet) {
-		fprintf(stderr, "malloc failed for packet %d\n", sequence);
-		free(entry);
-		return NULL;
-	}
-	
-	entry->sequence = sequence;
-	entry->next = state->sent_packets;
-	state->sent_packets = entry;
+static size_t deadline_queue_capacity(t_ping_state *state) {
+	size_t needed = state->ntargets * (state->targets[0].packets.mask + 1);
 	
-	struct icmphdr *icmp = &entry->packet->header;
+	size_t capacity = PACKET_TABLE_MIN;
+	while (capacity < needed && capacity < DEADLINE_QUEUE_MAX) {
+		capacity <<= 1;
+	}
+	return capacity;
+}
+
+/**
+ * @param state - ping state containing packet options
+ * @param tmpl - template to build
+ * @param family - address family the template is sent to
+ * 
+ * Builds the echo request header and payload once, with sequence, timestamp and
+ * checksum left zero, and records the template sum for incremental checksums
+ */
+static void build_packet_template(t_ping_state *state, t_echo_template *tmpl, int family) {
+	struct icmphdr *icmp = &tmpl->packet->header;
 	
-	if (state->conn.target_family == AF_INET) {
-		state->conn.ipv4.pid = getpid();
+	if (family == AF_INET) {
 		icmp->type = ICMP_ECHO;
 		icmp->un.echo.id = htons(state->conn.ipv4.pid);
 	} else {
-		state->conn.ipv6.pid = getpid();
 		icmp->type = ICMP6_ECHO_REQUEST;
 		icmp->un.echo.id = htons(state->conn.ipv6.pid);
 	}
 	
 	icmp->code = 0;
-	icmp->un.echo.sequence = htons(sequence);
+	icmp->un.echo.sequence = 0;
 	icmp->checksum = 0;
-	fill_packet_data(state, sequence);
-	icmp->checksum = calculate_checksum(state, sequence);
-	
-	return entry;
+	fill_packet_data(state, tmpl->packet);
+	tmpl->sum = ~calculate_checksum(state, tmpl->packet);
 }
 
 /**
- * @param state - ping state containing packet list
- * @param sequence - sequence number to search for
- * @return pointer to packet entry if found, NULL otherwise
+ * @param state - ping state to initialize packet system for
+ * @return 0 on success, 1 on allocation failure
  * 
- * Searches for packet entry with specified sequence number in tracking list
+ * Initializes one packet tracking table per target, the shared deadline queue and
+ * the IPv4 and IPv6 echo templates, adjusts packet size for headers. ICMP and
+ * ICMPv6 echo headers are both 8 bytes
  */
-t_packet_entry* find_packet(t_ping_state *state, uint16_t sequence) {
-	t_packet_entry *current = state->sent_packets;
-	while (current) {
-		if (current->sequence == sequence) {
-			return current;
+int init_packet_system(t_ping_state *state) {
+	size_t capacity = packet_table_capacity(state);
+	
+	state->opts.psize += sizeof(struct icmphdr);
+	
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_packet_table *table = &state->targets[i].packets;
+		memset(table, 0, sizeof(*table));
+		table->slots = calloc(capacity, sizeof(t_packet_entry));
+		if (!table->slots) {
+			fprintf(stderr, "malloc failed for packet table\n");
+			cleanup_packets(state);
+			return 1;
 		}
-		current = current->next;
+		table->mask = capacity - 1;
 	}
-	return NULL;
+	
+	t_deadline_queue *queue = &state->deadlines;
+	memset(queue, 0, sizeof(*queue));
+	size_t queue_capacity = deadline_queue_capacity(state);
+	queue->entries = malloc(queue_capacity * sizeof(t_deadline));
+	state->templates[0].packet = malloc(state->opts.psize);
+	state->templates[1].packet = malloc(state->opts.psize);
+	if (!queue->entries || !state->templates[0].packet || !state->templates[1].packet) {
+		fprintf(stderr, "malloc failed for packet table\n");
+		cleanup_packets(state);
+		return 1;
+	}
+	queue->mask = queue_capacity - 1;
+	build_packet_template(state, &state->templates[0], AF_INET);
+	build_packet_template(state, &state->templates[1], AF_INET6);
+	return 0;
 }
 
 /**
- * @param state - ping state containing packet list
- * @param sequence - sequence number of packet to remove
+ * @param state - ping state containing statistics and output
+ * @param target - target the packet was sent to
+ * @param sequence - sequence number of the packet that expired
  * 
- * Removes and frees packet entry with specified sequence number from tracking list
- */
-void remove_packet(t_ping_state *state, uint16_t sequence) {
-	t_packet_entry **current = &state->sent_packets;
-	while (*current) {
-		if ((*current)->sequence == sequence) {
-			t_packet_entry *to_remove = *current;
-			*current = (*current)->next;
-			free(to_remove->packet);
-			free(to_remove);
-			return;
-		}
-		current = &(*current)->next;
-	}
+ * Counts a probe as timed out, reports it as a timeout record in the
+ * structured output formats and retires it from the target's table
+ */
+static void expire_packet(t_ping_state *state, t_target *target, uint16_t sequence) {
+	print_timeout(state, target, sequence);
+	target->stats.timeouts++;
+	state->stats.timeouts++;
+	remove_packet(state, target, sequence);
 }
 
 /**
- * @param state - ping state containing packet list
+ * @param state - ping state containing in-flight counters and echo templates
+ * @param target - target the probe is sent to
+ * @param sequence - sequence number for the new packet
+ * @return pointer to the packet table entry, NULL if the table is not initialized
  * 
- * Frees all remaining packets in the tracking list and resets list pointer
+ * Stamps the target family's echo template with the sequence number and claims
+ * its table slot. A slot still held by a probe one full table older, which
+ * happens when -W outlasts the 65536 probes the table can hold, expires that
+ * probe early as a timeout; its deadline queue entry goes stale
  */
-void cleanup_packets(t_ping_state *state) {
-	t_packet_entry *current = state->sent_packets;
-	while (current) {
-		t_packet_entry *next = current->next;
-		free(current->packet);
-		free(current);
-		current = next;
+t_packet_entry* create_packet(t_ping_state *state, t_target *target, uint16_t sequence) {
+	if (!target->packets.slots) {
+		return NULL;
+	}
+	
+	t_packet_entry *entry = &target->packets.slots[sequence & target->packets.mask];
+	if (entry->in_use) {
+		expire_packet(state, target, entry->sequence);
 	}
-	cleanup_rtt_list(state);
-	state->sent_packets = NULL;
+	entry->sequence = sequence;
+	entry->in_use = 1;
+	entry->send_time = 0;
+	target->packets.in_flight++;
+	state->sched.in_flight++;
+	
+	stamp_packet(state, &state->templates[FAMILY_IDX(target->family)], sequence);
+	return entry;
 }
 
 /**
  * @param state - ping state containing packet options
- * @param sequence - sequence number of packet to fill
+ * @param tmpl - echo template and its sum
+ * @param sequence - sequence number to write into the template
  * 
- * Fills packet data payload with timestamp and pattern data
+ * Patches sequence number and send timestamp into the template and updates the
+ * checksum incrementally (RFC 1624) from the template sum, so the cost does not
+ * depend on payload size. The template has zeros in the patched fields, so their
+ * new words are simply added to its sum. Datagram sockets checksum in the kernel,
+ * so there only the fields are patched
  */
-void fill_packet_data(t_ping_state *state, uint16_t sequence) {
-	t_packet_entry *entry = find_packet(state, sequence);
-	if (!entry) return;
+void stamp_packet(t_ping_state *state, t_echo_template *tmpl, uint16_t sequence) {
+	struct icmphdr *icmp = &tmpl->packet->header;
+	int checksum = (state->conn.socktype == SOCK_RAW);
+	uint32_t sum = tmpl->sum;
 	
-	size_t icmp_header_size = (state->conn.target_family == AF_INET) ? 
-							 sizeof(struct icmphdr) : 
-							 sizeof(struct icmp6_hdr);
-	size_t data_size = state->opts.psize - icmp_header_size;
-	size_t start_index = 0;
+	icmp->un.echo.sequence = htons(sequence);
+	sum += icmp->un.echo.sequence;
 	
-	if (data_size >= sizeof(struct timeval)) {
+	if (state->opts.psize - sizeof(struct icmphdr) >= sizeof(struct timeval)) {
 		struct timeval tv;
+		uint16_t words[sizeof(tv) / 2];
 		gettimeofday(&tv, NULL);
-		memcpy(&entry->packet->msg, &tv, sizeof(tv));
-		start_index = sizeof(struct timeval);
+		memcpy(&tmpl->packet->msg, &tv, sizeof(tv));
+		memcpy(words, &tv, sizeof(tv));
+		for (size_t i = 0; checksum && i < sizeof(words) / sizeof(words[0]); i++) {
+			sum += words[i];
+		}
 	}
 	
-	for (size_t i = start_index; i < data_size; i++) {
-		entry->packet->msg[i] = 0x10 + (i % 48);
+	if (checksum) {
+		icmp->checksum = inet_checksum_fold(sum);
+	}
+}
+
+/**
+ * @param target - target whose packet table to search
+ * @param sequence - sequence number to search for
+ * @return pointer to packet entry if in flight, NULL otherwise
+ * 
+ * Looks up the table slot for the sequence number in constant time
+ */
+t_packet_entry* find_packet(t_target *target, uint16_t sequence) {
+	if (!target->packets.slots) {
+		return NULL;
+	}
+	t_packet_entry *entry = &target->packets.slots[sequence & target->packets.mask];
+	if (entry->in_use && entry->sequence == sequence) {
+		return entry;
+	}
+	return NULL;
+}
+
+/**
+ * @param state - ping state containing the global in-flight counter
+ * @param target - target the packet was sent to
+ * @param sequence - sequence number of packet to remove
+ * 
+ * Retires packet entry with specified sequence number from the target's table,
+ * its deadline queue entry goes stale and is skipped when it reaches the head
+ */
+void remove_packet(t_ping_state *state, t_target *target, uint16_t sequence) {
+	t_packet_entry *entry = find_packet(target, sequence);
+	if (entry) {
+		entry->in_use = 0;
+		target->packets.in_flight--;
+		state->sched.in_flight--;
 	}
 }
 
 /**
- * @param state - ping state containing packet list and size info
- * @param sequence - sequence number of packet to calculate checksum for
- * @return calculated checksum value, 0 if packet not found
+ * @param state - ping state containing the deadline queue and timeout option
+ * @param target - target the packet was sent to
+ * @param packet - packet entry that was just sent, with its send time set
+ * @return 0 on success, 1 if the queue was full and its head was expired early
  * 
- * Calculates RFC 792 Internet checksum for ICMP packet
+ * Appends a sent probe to the deadline queue. Probes share one timeout and are
+ * sent in time order, so appending keeps the queue sorted by deadline
  */
-uint16_t calculate_checksum(t_ping_state *state, uint16_t sequence) {
-	t_packet_entry *entry = find_packet(state, sequence);
-	if (!entry) return 0;
+int push_deadline(t_ping_state *state, t_target *target, t_packet_entry *packet) {
+	t_deadline_queue *queue = &state->deadlines;
+	int full = 0;
 	
-	uint16_t *ptr = (uint16_t*)entry->packet;
-	int bytes = state->opts.psize;
-	uint32_t sum = 0;
+	if (queue->tail - queue->head > queue->mask) {
+		int64_t oldest = next_packet_deadline(state);
+		full = (queue->tail - queue->head > queue->mask);
+		if (full) {
+			expire_packets(state, oldest);
+		}
+	}
+	t_deadline *entry = &queue->entries[queue->tail & queue->mask];
+	entry->deadline = packet->send_time + (int64_t)state->opts.timeout * NSEC_PER_SEC;
+	entry->target = target - state->targets;
+	entry->sequence = packet->sequence;
+	queue->tail++;
+	return full;
+}
+
+/**
+ * @param state - ping state containing targets
+ * @param entry - deadline queue entry
+ * @return table entry of the probe if it is still in flight, NULL if the queue entry is stale
+ */
+static t_packet_entry *deadline_packet(t_ping_state *state, t_deadline *entry) {
+	t_packet_entry *packet = find_packet(&state->targets[entry->target], entry->sequence);
+	if (packet && packet->send_time + (int64_t)state->opts.timeout * NSEC_PER_SEC == entry->deadline) {
+		return packet;
+	}
+	return NULL;
+}
+
+/**
+ * @param state - ping state containing the deadline queue
+ * @return monotonic ns deadline of the oldest packet in flight, INT64_MAX if none
+ * 
+ * Returns the head of the deadline queue. Entries of answered probes are
+ * skipped and dropped, each once over the whole run
+ */
+int64_t next_packet_deadline(t_ping_state *state) {
+	t_deadline_queue *queue = &state->deadlines;
 	
-	while (bytes > 1) {
-		sum += *ptr++;
-		bytes -= 2;
+	while (queue->head != queue->tail) {
+		t_deadline *entry = &queue->entries[queue->head & queue->mask];
+		if (deadline_packet(state, entry)) {
+			return entry->deadline;
+		}
+		queue->head++;
 	}
+	return INT64_MAX;
+}
+
+/**
+ * @param state - ping state containing the deadline queue
+ * @param now - current monotonic time in nanoseconds
+ * 
+ * Retires packets whose deadline has passed by popping the head of the deadline
+ * queue, the cost is proportional to the number of expired packets. Each one
+ * is reported as a timeout record in the structured output formats
+ */
+void expire_packets(t_ping_state *state, int64_t now) {
+	t_deadline_queue *queue = &state->deadlines;
 	
-	if (bytes == 1) {
-		sum += *(uint8_t*)ptr;
+	while (next_packet_deadline(state) <= now) {
+		t_deadline *entry = &queue->entries[queue->head & queue->mask];
+		expire_packet(state, &state->targets[entry->target], entry->sequence);
+		queue->head++;
+	}
+}
+
+/**
+ * @param state - ping state containing packet tables and templates
+ * 
+ * Frees the packet tables, the deadline queue and the echo templates
+ */
+void cleanup_packets(t_ping_state *state) {
+	for (size_t i = 0; i < state->ntargets; i++) {
+		free(state->targets[i].packets.slots);
+		memset(&state->targets[i].packets, 0, sizeof(t_packet_table));
 	}
+	free(state->deadlines.entries);
+	free(state->templates[0].packet);
+	free(state->templates[1].packet);
+	memset(&state->deadlines, 0, sizeof(state->deadlines));
+	memset(&state->templates, 0, sizeof(state->templates));
+}
+
+/**
+ * @param state - ping state containing packet options
+ * @param packet - packet whose payload to fill
+ * 
+ * Fills packet data payload with pattern data, leaving room for the timestamp
+ */
+void fill_packet_data(t_ping_state *state, t_ping_pkg *packet) {
+	size_t data_size = state->opts.psize - sizeof(struct icmphdr);
+	size_t start_index = 0;
 	
-	while (sum >> 16) {
-		sum = (sum & 0xFFFF) + (sum >> 16);
+	if (data_size >= sizeof(struct timeval)) {
+		memset(&packet->msg, 0, sizeof(struct timeval));
+		start_index = sizeof(struct timeval);
 	}
 	
-	return ~sum;
+	for (size_t i = start_index; i < data_size; i++) {
+		packet->msg[i] = 0x10 + (i % 48);
+	}
 }
 
-
+/**
+ * @param state - ping state containing size info
+ * @param packet - packet to calculate checksum for
+ * @return calculated checksum value
+ * 
+ * Calculates RFC 792 Internet checksum for ICMP packet with the fastest kernel for this CPU
+ */
+uint16_t calculate_checksum(t_ping_state *state, t_ping_pkg *packet) {
+	return inet_checksum(packet, state->opts.psize);
+}
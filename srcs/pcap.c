@@ -0,0 +1,422 @@
+#include "../includes/ft_ping.h"
+
+// Shards share the capture file, a flush must not interleave with another shard's
+static pthread_mutex_t pcap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define PAD4(len) (((len) + 3) & ~(size_t)3)
+
+/**
+ * @param at - where to store, any alignment
+ * @param value - 32-bit value in host order, pcapng files carry their byte order
+ */
+static void put32(char *at, uint32_t value) {
+	memcpy(at, &value, sizeof(value));
+}
+
+/**
+ * @param at - where to store the option
+ * @param code - option code
+ * @param value - option value
+ * @param len - value length
+ * @return bytes stored, padded to 32 bits
+ */
+static size_t put_option(char *at, uint16_t code, const void *value, uint16_t len) {
+	memcpy(at, &code, sizeof(code));
+	memcpy(at + 2, &len, sizeof(len));
+	if (len > 0) {
+		memcpy(at + 4, value, len);
+	}
+	memset(at + 4 + len, 0, PAD4(len) - len);
+	return 4 + PAD4(len);
+}
+
+/**
+ * @param at - where to store the blocks, at least 128 bytes
+ * @return bytes stored
+ *
+ * Stores the section header, then one interface per family: interface 0 carries
+ * IPv4 packets, interface 1 IPv6, like FAMILY_IDX. Timestamps are in nanoseconds
+ */
+static size_t file_header(char *at) {
+	static const char application[] = "ft_ping";
+	uint16_t version[2] = {1, 0};
+	int64_t section_length = -1;
+	uint8_t resolution = 9;
+	size_t len = 0;
+
+	put32(at, 0x0A0D0D0A);
+	put32(at + 8, 0x1A2B3C4D);
+	memcpy(at + 12, version, sizeof(version));
+	memcpy(at + 16, &section_length, sizeof(section_length));
+	len = 24;
+	len += put_option(at + len, 4, application, sizeof(application) - 1); // shb_userappl
+	len += put_option(at + len, 0, NULL, 0);
+	put32(at + 4, len + 4);
+	put32(at + len, len + 4);
+	len += 4;
+
+	for (int f = 0; f < 2; f++) {
+		char *block = at + len;
+		uint16_t link[2] = {(f == 0) ? LINKTYPE_IPV4 : LINKTYPE_IPV6, 0};
+		size_t block_len = 16;
+
+		put32(block, 1);
+		memcpy(block + 8, link, sizeof(link));
+		put32(block + 12, 0); // no snap length
+		block_len += put_option(block + block_len, 9, &resolution, 1); // if_tsresol
+		block_len += put_option(block + block_len, 0, NULL, 0);
+		put32(block + 4, block_len + 4);
+		put32(block + block_len, block_len + 4);
+		len += block_len + 4;
+	}
+	return len;
+}
+
+/**
+ * @param fd - descriptor to write to
+ * @param buf - bytes to write
+ * @param len - number of bytes
+ * @return 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the --pcap and --pcap-size options
+ * @return 0 on success, 1 on failure
+ *
+ * Creates the capture file and writes its header. With --pcap-size the file is
+ * preallocated and mapped with its pages faulted in, so a capture is a copy
+ * into memory and never waits for the disk or a page fault
+ */
+static int open_pcap(t_ping_state *state) {
+	t_pcap_file *file = calloc(1, sizeof(t_pcap_file));
+	char header[128];
+	size_t len = file_header(header);
+
+	if (!file) {
+		fprintf(stderr, "malloc failed for pcap file\n");
+		return 1;
+	}
+	file->fd = -1;
+	state->pcap.file = file;
+	state->pcap.owner = 1;
+	file->limit = UINT64_MAX;
+	file->clock_offset = wall_ns() - now_ns();
+	file->fd = open(state->opts.pcap_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (file->fd < 0) {
+		fprintf(stderr, "ft_ping: %s: %s\n", state->opts.pcap_path, strerror(errno));
+		return 1;
+	}
+	if (state->opts.pcap_size == 0) {
+		if (write_all(file->fd, header, len) < 0) {
+			fprintf(stderr, "ft_ping: %s: %s\n", state->opts.pcap_path, strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
+	file->size = state->opts.pcap_size;
+	int err = posix_fallocate(file->fd, 0, file->size);
+	if (err != 0) {
+		fprintf(stderr, "ft_ping: %s: %s\n", state->opts.pcap_path, strerror(err));
+		return 1;
+	}
+	file->map = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, file->fd, 0);
+	if (file->map == MAP_FAILED) {
+		file->map = NULL;
+		fprintf(stderr, "ft_ping: mmap %s: %s\n", state->opts.pcap_path, strerror(errno));
+		return 1;
+	}
+	memcpy(file->map, header, len);
+	file->used = len;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the --pcap option
+ * @return 0 on success, 1 on failure
+ *
+ * Opens the capture file on first use, shards share the main state's, and
+ * gives this state its write buffer unless the file is mapped
+ */
+int init_pcap(t_ping_state *state) {
+	if (!state->opts.pcap_path) {
+		return 0;
+	}
+	if (!state->pcap.file && open_pcap(state) != 0) {
+		cleanup_pcap(state);
+		return 1;
+	}
+	state->pcap.len = 0;
+	state->pcap.rtt_ns = -1;
+	if (state->pcap.file->map) {
+		return 0;
+	}
+	state->pcap.buffer = malloc(PCAP_BUFFER_S);
+	if (!state->pcap.buffer) {
+		fprintf(stderr, "malloc failed for pcap buffer\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the capture buffer
+ *
+ * Appends the buffered records to the file. A failing write drops them rather
+ * than the run
+ */
+static void flush_pcap(t_ping_state *state) {
+	if (state->pcap.len == 0) {
+		return;
+	}
+	pthread_mutex_lock(&pcap_lock);
+	write_all(state->pcap.file->fd, state->pcap.buffer, state->pcap.len);
+	pthread_mutex_unlock(&pcap_lock);
+	state->io.syscalls++;
+	state->pcap.len = 0;
+}
+
+/**
+ * @param state - ping state containing the capture file and buffer
+ * @param len - record length
+ * @return where to store the record, NULL if the mapped file is full
+ *
+ * Takes room in the write buffer, flushing it first when the record does not
+ * fit, or in the mapping. Shards take room in the mapping with an atomic add,
+ * the first record that does not fit marks where the file ends
+ */
+static char *reserve(t_ping_state *state, size_t len) {
+	t_pcap_file *file = state->pcap.file;
+
+	if (file->map) {
+		uint64_t at = __atomic_fetch_add(&file->used, len, __ATOMIC_RELAXED);
+		if (at + len <= file->size) {
+			return file->map + at;
+		}
+		uint64_t limit = __atomic_load_n(&file->limit, __ATOMIC_RELAXED);
+		while (at < limit && !__atomic_compare_exchange_n(&file->limit, &limit, at, 0,
+														   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		}
+		__atomic_fetch_add(&file->dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	if (state->pcap.len + len > PCAP_BUFFER_S) {
+		flush_pcap(state);
+	}
+	char *record = state->pcap.buffer + state->pcap.len;
+	state->pcap.len += len;
+	return record;
+}
+
+/**
+ * @param header - where to store the header, 40 bytes for IPv6
+ * @param family - AF_INET or AF_INET6
+ * @param src - source address, NULL for the unspecified address
+ * @param dst - destination address, NULL for the unspecified address
+ * @param ttl - TTL or hop limit
+ * @param payload - ICMP bytes following the header
+ * @return header length
+ *
+ * Builds the IP header the kernel added or stripped, so every record is a
+ * whole IP packet. The local address is not known per probe and is left
+ * unspecified
+ */
+static size_t ip_header(char *header, int family, struct sockaddr *src, struct sockaddr *dst,
+						int ttl, size_t payload) {
+	if (family == AF_INET) {
+		struct ip *ip = (struct ip*)header;
+		memset(ip, 0, sizeof(*ip));
+		ip->ip_v = 4;
+		ip->ip_hl = sizeof(*ip) / 4;
+		ip->ip_len = htons(sizeof(*ip) + payload);
+		ip->ip_ttl = ttl;
+		ip->ip_p = IPPROTO_ICMP;
+		if (src) {
+			ip->ip_src = ((struct sockaddr_in*)src)->sin_addr;
+		}
+		if (dst) {
+			ip->ip_dst = ((struct sockaddr_in*)dst)->sin_addr;
+		}
+		ip->ip_sum = inet_checksum(ip, sizeof(*ip));
+		return sizeof(*ip);
+	}
+	struct ip6_hdr *ip6 = (struct ip6_hdr*)header;
+	memset(ip6, 0, sizeof(*ip6));
+	ip6->ip6_flow = htonl(6 << 28);
+	ip6->ip6_plen = htons(payload);
+	ip6->ip6_nxt = IPPROTO_ICMPV6;
+	ip6->ip6_hlim = ttl;
+	if (src) {
+		ip6->ip6_src = ((struct sockaddr_in6*)src)->sin6_addr;
+	}
+	if (dst) {
+		ip6->ip6_dst = ((struct sockaddr_in6*)dst)->sin6_addr;
+	}
+	return sizeof(*ip6);
+}
+
+/**
+ * @param state - ping state containing the capture file
+ * @param f - family index, the interface of the record
+ * @param time - capture time on the timestamp source clock
+ * @param parts - packet bytes, in order
+ * @param nparts - number of parts
+ * @param original - length of the packet on the wire, longer than the parts if it was truncated
+ * @param comment - packet comment, NULL if none
+ *
+ * Stores one Enhanced Packet Block. Timestamps taken on CLOCK_MONOTONIC are
+ * moved to the wall clock, the file's time base
+ */
+static void write_packet(t_ping_state *state, int f, int64_t time, struct iovec *parts, int nparts,
+						 size_t original, const char *comment) {
+	size_t captured = 0;
+	size_t comment_len = comment ? strlen(comment) : 0;
+
+	for (int i = 0; i < nparts; i++) {
+		captured += parts[i].iov_len;
+	}
+	size_t options = comment ? 4 + PAD4(comment_len) + 4 : 0;
+	size_t total = 28 + PAD4(captured) + options + 4;
+	char *record = reserve(state, total);
+	if (!record) {
+		return;
+	}
+	if (state->ts.source != TS_KERNEL) {
+		time += state->pcap.file->clock_offset;
+	}
+
+	put32(record, 6);
+	put32(record + 4, total);
+	put32(record + 8, f);
+	put32(record + 12, (uint64_t)time >> 32);
+	put32(record + 16, (uint32_t)time);
+	put32(record + 20, captured);
+	put32(record + 24, MAX(captured, original));
+	char *at = record + 28;
+	for (int i = 0; i < nparts; i++) {
+		memcpy(at, parts[i].iov_base, parts[i].iov_len);
+		at += parts[i].iov_len;
+	}
+	memset(at, 0, PAD4(captured) - captured);
+	at = record + 28 + PAD4(captured);
+	if (comment) {
+		at += put_option(at, 1, comment, comment_len); // opt_comment
+		at += put_option(at, 0, NULL, 0);
+	}
+	put32(at, total);
+}
+
+/**
+ * @param state - ping state containing the send batch
+ * @param f - family index of the batch
+ * @param index - probe in the batch
+ * @param sent_at - time the batch was handed to the kernel, on the timestamp source clock
+ *
+ * Captures a probe as sent, from the same head and template the send used
+ */
+void pcap_probe(t_ping_state *state, int f, int index, int64_t sent_at) {
+	struct msghdr *msg = &state->tx[f].msgs[index].msg_hdr;
+	char header[sizeof(struct ip6_hdr)];
+	struct iovec parts[3];
+
+	if (!state->pcap.file) {
+		return;
+	}
+	size_t payload = msg->msg_iov[0].iov_len + msg->msg_iov[1].iov_len;
+	parts[0].iov_base = header;
+	parts[0].iov_len = ip_header(header, state->tx[f].targets[index]->family, NULL,
+								 msg->msg_name, state->opts.ttl, payload);
+	parts[1] = msg->msg_iov[0];
+	parts[2] = msg->msg_iov[1];
+	write_packet(state, f, sent_at, parts, 3, 0, NULL);
+}
+
+/**
+ * @param state - ping state containing the capture file and the RTT just measured
+ * @param f - family index of the socket the datagram arrived on
+ * @param from - sender of the datagram
+ * @param buffer - datagram as received
+ * @param len - datagram length
+ * @param rx_time - receive time the RTT was measured with
+ * @param ttl - TTL or hop limit from control data, -1 if none
+ *
+ * Captures a received datagram, whether it matched a probe or not. Raw IPv4
+ * sockets return the IP header, other sockets get a rebuilt one. A datagram
+ * truncated by the receive buffer keeps its wire length when the header tells
+ * it. A reply that gave an RTT carries it as the packet comment
+ */
+void pcap_datagram(t_ping_state *state, int f, struct sockaddr *from, char *buffer, size_t len,
+				   int64_t rx_time, int ttl) {
+	char header[sizeof(struct ip6_hdr)];
+	char comment[PCAP_COMMENT_S];
+	struct iovec parts[2];
+	int nparts = 0;
+	size_t original = 0;
+
+	if (!state->pcap.file) {
+		return;
+	}
+	if (state->conn.socktype != SOCK_RAW || f != 0) {
+		parts[nparts].iov_base = header;
+		parts[nparts++].iov_len = ip_header(header, (f == 0) ? AF_INET : AF_INET6, from, NULL,
+											(ttl < 0) ? 64 : ttl, len);
+	} else if (len >= sizeof(struct ip)) {
+		original = ntohs(((struct ip*)buffer)->ip_len);
+	}
+	parts[nparts].iov_base = buffer;
+	parts[nparts++].iov_len = len;
+	if (state->pcap.rtt_ns >= 0) {
+		snprintf(comment, sizeof(comment), "rtt %lld.%06lld ms",
+				 (long long)(state->pcap.rtt_ns / NSEC_PER_MSEC), (long long)(state->pcap.rtt_ns % NSEC_PER_MSEC));
+	}
+	write_packet(state, f, rx_time, parts, nparts, original, (state->pcap.rtt_ns >= 0) ? comment : NULL);
+}
+
+/**
+ * @param state - ping state containing the capture file and buffer
+ *
+ * Writes what is buffered. The state that opened the file then trims a mapped
+ * file to the records it holds, reports the records that did not fit and
+ * closes it; every shard must have been cleaned up first
+ */
+void cleanup_pcap(t_ping_state *state) {
+	t_pcap_file *file = state->pcap.file;
+
+	if (state->pcap.buffer) {
+		flush_pcap(state);
+		free(state->pcap.buffer);
+		state->pcap.buffer = NULL;
+	}
+	state->pcap.file = NULL;
+	if (!file || !state->pcap.owner) {
+		return;
+	}
+	if (file->map) {
+		munmap(file->map, file->size);
+		if (ftruncate(file->fd, MIN(file->used, file->limit)) < 0) {
+			fprintf(stderr, "ft_ping: %s: %s\n", state->opts.pcap_path, strerror(errno));
+		}
+	}
+	if (file->dropped > 0) {
+		fprintf(stderr, "ft_ping: %s is full, %llu packets not captured\n", state->opts.pcap_path,
+				(unsigned long long)file->dropped);
+	}
+	if (file->fd >= 0) {
+		close(file->fd);
+	}
+	free(file);
+	state->pcap.owner = 0;
+}
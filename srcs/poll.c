@@ -16,80 +16,310 @@ long timeval_diff_ms(struct timeval *start, struct timeval *end) {
 }
 
 /**
- * @param state - ping state containing socket file descriptors
- * @param fds - poll file descriptor array to configure
- * @return target socket file descriptor for the resolved address family
+ * @param epoll_fd - epoll instance
+ * @param fd - descriptor to watch for input, ignored when -1
+ * @return 0 on success, -1 on failure
+ */
+static int watch_fd(int epoll_fd, int fd) {
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+	
+	if (fd < 0) {
+		return 0;
+	}
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * @param state - ping state containing the event loop descriptors
+ * @param fd - descriptor to watch
+ * @param events - EPOLLIN or EPOLLOUT
  * 
- * Configures poll file descriptors for both IPv4 and IPv6 sockets
+ * Waits for a single readiness event on a descriptor the loop does not own for
+ * its whole life, a --metrics-listen connection. The event is reported once,
+ * then the descriptor must be watched again, so closing it never races with a
+ * pending wait
  */
-int setupPoll(t_ping_state *state, struct pollfd *fds) {
-	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+void watch_once(t_ping_state *state, int fd, uint32_t events) {
+	struct epoll_event event = {.events = events | EPOLLONESHOT, .data.fd = fd};
 	
-	for (int i = 0; i < 2; i++) {
-		fds[i].fd = sockets[i];
-		fds[i].events = POLLIN;
-		fds[i].revents = 0;
-	}
-	return (state->conn.target_family == AF_INET) ? 
-			state->conn.ipv4.sockfd : 
-			state->conn.ipv6.sockfd;
+	if (state->io.backend == IO_URING) {
+		uring_watch_once(state, fd, (events & EPOLLOUT) ? POLLOUT : POLLIN);
+		return;
+	}
+	state->io.syscalls++;
+	if (epoll_ctl(state->loop.epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT) {
+		state->io.syscalls++;
+		epoll_ctl(state->loop.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+	}
 }
 
 /**
- * @param state - ping state containing timing and completion info
- * @return timeout value in milliseconds for poll operation
+ * @param state - ping state containing targets and socket file descriptors
+ * @param family - AF_INET or AF_INET6
+ * @return 1 if some target has the family, 0 otherwise
+ */
+static int family_targeted(t_ping_state *state, int family) {
+	for (size_t i = 0; i < state->ntargets; i++) {
+		if (state->targets[i].family == family) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing socket, signal and stop descriptors
+ * @return 0 on success, 1 on failure
  * 
- * Calculates appropriate timeout for poll based on send timing and completion status
+ * Sets up the simulated network for -E sim, or the io_uring backend when
+ * -E io_uring asked for it and the kernel supports it. Otherwise creates the epoll instance of the event loop and the timerfd that wakes it for
+ * the next send or expiry. Watches the sockets of the families that have targets,
+ * the signalfd and the shard stop and status descriptors; errors queued on a socket are
+ * always reported by epoll
  */
-int get_next_poll_timeout(t_ping_state *state) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
+int setupPoll(t_ping_state *state) {
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
 	
-	if (!state->stats.transmission_complete && state->stats.preload_sent >= state->opts.preload) {
-		if (state->stats.last_packet_time.tv_sec != 0) {
-			long since_last = timeval_diff_ms(&state->stats.last_packet_time, &now);
-			int until_next_send = 1000 - since_last;
-			return (until_next_send > 0) ? until_next_send : 0;
+	state->io.backend = IO_EPOLL;
+	if (state->opts.backend == IO_SIM) {
+		state->io.backend = IO_SIM;
+		return init_sim(state);
+	}
+	if (state->opts.backend == IO_URING) {
+		if (init_uring(state) == 0) {
+			state->io.backend = IO_URING;
+			return 0;
 		}
-		return 0;
+		if (state->shard.index == 0) {
+			fprintf(stderr, "ft_ping: io_uring unavailable (%s), using epoll\n", strerror(errno));
+		}
+	}
+	state->loop.armed = 0;
+	state->loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	state->loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (state->loop.epoll_fd < 0 || state->loop.timer_fd < 0 ||
+		watch_fd(state->loop.epoll_fd, state->loop.timer_fd) < 0 ||
+		watch_fd(state->loop.epoll_fd, state->loop.signal_fd) < 0 ||
+		watch_fd(state->loop.epoll_fd, state->shard.stop_fd) < 0 ||
+		watch_fd(state->loop.epoll_fd, state->shard.status_fd) < 0) {
+		perror("ft_ping: event loop");
+		return 1;
+	}
+	for (int f = 0; f < 2; f++) {
+		if (family_targeted(state, (f == 0) ? AF_INET : AF_INET6) &&
+			watch_fd(state->loop.epoll_fd, sockets[f]) < 0) {
+			perror("ft_ping: epoll_ctl");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing event loop descriptors
+ * 
+ * Closes the epoll instance and the timerfd, or tears the io_uring backend or
+ * the simulated network down
+ */
+void cleanup_poll(t_ping_state *state) {
+	cleanup_uring(state);
+	cleanup_sim(state);
+	if (state->loop.epoll_fd >= 0) {
+		close(state->loop.epoll_fd);
+	}
+	if (state->loop.timer_fd >= 0) {
+		close(state->loop.timer_fd);
 	}
+	state->loop.epoll_fd = -1;
+	state->loop.timer_fd = -1;
+}
+
+/**
+ * @return current CLOCK_MONOTONIC time in nanoseconds
+ * 
+ * Reads the monotonic clock used by the send scheduler, immune to wall clock steps
+ */
+int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @param state - ping state containing the simulated network, if any
+ * @return current time in nanoseconds on the event loop clock
+ * 
+ * The loop clock is CLOCK_MONOTONIC, or with -E sim the virtual clock, which
+ * only moves when the loop jumps to its next event
+ */
+int64_t clock_now(t_ping_state *state) {
+	if (state->sim.net) {
+		return __atomic_load_n(&state->sim.now, __ATOMIC_RELAXED);
+	}
+	return now_ns();
+}
+
+/**
+ * @param state - ping state containing the simulated network, if any
+ * @return current CLOCK_REALTIME time in nanoseconds
+ * 
+ * With -E sim the virtual clock moved to the wall clock, so run times and
+ * record times in the output are virtual too
+ */
+int64_t clock_wall(t_ping_state *state) {
+	if (state->sim.net) {
+		return clock_now(state) + state->sim.wall_offset;
+	}
+	return wall_ns();
+}
+
+/**
+ * @param state - ping state containing scheduler, packet table and completion info
+ * @return monotonic ns time of the next send or packet expiry, INT64_MAX if none
+ * 
+ * The event loop sleeps until the next send, the next packet expiry, the
+ * flush of buffered output or the next --stats-interval summary, whichever
+ * comes first; pending preload is due immediately
+ */
+int64_t next_wakeup(t_ping_state *state) {
+	int64_t wake = next_packet_deadline(state);
 	
-	if (state->stats.transmission_complete) {
-		return 100;
+	if (state->loop.status_at > 0) {
+		wake = MIN(wake, state->loop.status_at);
+	}
+	if (!state->writer.ring && state->output.len > 0) {
+		wake = MIN(wake, state->output.flushed_at + OUTPUT_FLUSH_NS);
 	}
+	if (!state->sched.transmission_complete) {
+		if (state->sched.preload_sent < state->sched.preload_total) {
+			wake = clock_now(state);
+		} else if (state->sched.next_send < wake) {
+			wake = state->sched.next_send;
+		}
+	}
+	return wake;
+}
+
+/**
+ * @param state - ping state containing event loop descriptors
+ * @param wake - absolute monotonic ns time to wake at, INT64_MAX for never
+ * 
+ * Arms the timerfd with an absolute deadline, so the wakeup does not drift with
+ * the time spent between computing and arming it. The timer is one-shot and only
+ * rearmed when the deadline changes
+ */
+static void arm_timer(t_ping_state *state, int64_t wake) {
+	struct itimerspec spec;
 	
-	return 0;
+	if (wake == INT64_MAX) {
+		wake = 0;
+	} else if (wake <= 0) {
+		wake = 1; // a zero value would disarm the timer
+	}
+	if (wake == state->loop.armed) {
+		return;
+	}
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = wake / NSEC_PER_SEC;
+	spec.it_value.tv_nsec = wake % NSEC_PER_SEC;
+	state->io.syscalls++;
+	if (timerfd_settime(state->loop.timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+		state->loop.armed = wake;
+	}
 }
 
 /**
- * @param state - ping state containing sent packets and timeout settings
+ * @param state - ping state containing packet table and timeout settings
  * 
- * Removes packets from sent list that have exceeded the timeout period
+ * Retires packets from the in-flight tables that have exceeded the timeout period,
+ * flushes structured output that has waited long enough and prints the
+ * --stats-interval summary when due. A summary missed by a long stall is not
+ * repeated
  */
 void handle_timeouts(t_ping_state *state) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
+	int64_t now = clock_now(state);
+	expire_packets(state, now);
+	output_tick(state, now);
+	if (state->loop.status_at > 0 && now >= state->loop.status_at) {
+		print_status(state);
+		int64_t interval = state->opts.stats_interval * NSEC_PER_USEC;
+		state->loop.status_at = MAX(state->loop.status_at + interval, now + 1);
+	}
+}
+
+/**
+ * @param state - ping state containing sockets and event loop descriptors
+ * @param event - ready descriptor reported by epoll_wait()
+ * @return 1 if the loop must stop, 0 otherwise
+ */
+static int handle_event(t_ping_state *state, struct epoll_event *event) {
+	int fd = event->data.fd;
 	
-	t_packet_entry *current = state->sent_packets;
-	t_packet_entry *prev = NULL;
+	if (fd == state->loop.timer_fd) {
+		uint64_t expirations;
+		ssize_t got = read(fd, &expirations, sizeof(expirations));
+		(void)got;
+		state->io.syscalls++;
+		state->loop.armed = 0;
+		return 0;
+	}
+	if (fd == state->loop.signal_fd) {
+		return handleSignals(state) != 0;
+	}
+	if (fd == state->shard.stop_fd) {
+		return 1;
+	}
+	if (fd == state->shard.status_fd) {
+		handle_status_request(state);
+		return 0;
+	}
+	if (handle_metrics(state, fd)) {
+		return 0;
+	}
+	if (event->events & EPOLLERR) {
+		receive_errors(state, fd);
+	}
+	if (event->events & EPOLLIN) {
+		receive_packets(state, fd);
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state with sockets, packet system, schedule and event loop initialized
+ * @return 0 on success, 1 if some probes could not be sent
+ * 
+ * Runs the event loop until every probe is sent and answered or expired, until
+ * a termination signal arrives or until the shard stop descriptor becomes
+ * readable: send what is due, arm the timer for the next send or expiry, sleep
+ * in epoll_wait(), drain the ready sockets, retire expired probes. Signals are
+ * read from a signalfd, so nothing runs in signal context
+ */
+int run_event_loop(t_ping_state *state) {
+	struct epoll_event events[EPOLL_EVENTS];
+	int ret = 0;
+	int stop = 0;
 	
-	while (current != NULL) {
-		long elapsed = timeval_diff_ms(&current->send_time, &now);
+	if (state->io.backend == IO_URING) {
+		return run_uring_loop(state);
+	}
+	if (state->io.backend == IO_SIM) {
+		return run_sim_loop(state);
+	}
+	while (!stop && (!state->sched.transmission_complete || state->sched.in_flight > 0)) {
+		ret = send_ping(state);
+		arm_timer(state, next_wakeup(state));
 		
-		if (elapsed >= state->opts.timeout * 1000) {
-			if (prev == NULL) {
-				state->sent_packets = current->next;
-			} else {
-				prev->next = current->next;
-			}
-			
-			t_packet_entry *to_free = current;
-			current = current->next;
-			free(to_free->packet);
-			free(to_free);
-		} else {
-			prev = current;
-			current = current->next;
+		int ready = epoll_wait(state->loop.epoll_fd, events, EPOLL_EVENTS, -1);
+		state->io.syscalls++;
+		if (ready < 0 && errno != EINTR) {
+			fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+			break;
 		}
+		for (int i = 0; i < ready; i++) {
+			stop |= handle_event(state, &events[i]);
+		}
+		handle_timeouts(state);
 	}
-}
\ No newline at end of file
+	return ret;
+}
@@ -1,102 +1,270 @@
 #include "../includes/ft_ping.h"
 
 /**
- * @param buffer - received packet buffer
- * @param ip_header - IP header pointer for IPv4 packets
+ * @param packet - in-flight table entry of the answered probe
+ * @param rx_time - receive time on the timestamp source clock
  * @param icmp_data_size - size of ICMP data payload
- * @param family - address family (AF_INET or AF_INET6)
- * @return round-trip time in milliseconds, -1.0 if no timestamp available
+ * @return round-trip time in milliseconds, -1.0 if the payload is too small to carry a timestamp
  * 
- * Calculates round-trip time from embedded timestamp in packet payload
+ * Calculates round-trip time from the probe's recorded send time, both ends come
+ * from the same clock (kernel timestamps or CLOCK_MONOTONIC). Payloads smaller
+ * than a timeval report no time, like iputils
  */
-double calculate_rtt(char *buffer, struct iphdr *ip_header, size_t icmp_data_size, int family) {
+double calculate_rtt(t_packet_entry *packet, int64_t rx_time, size_t icmp_data_size) {
 	if (icmp_data_size < sizeof(struct timeval)) {
 		return -1.0; 
 	}
 	
-	struct timeval now, *sent_time;
-	gettimeofday(&now, NULL);
+	int64_t rtt = rx_time - packet->tx_stamp;
+	return (rtt > 0) ? rtt / (double)NSEC_PER_MSEC : 0.0;
+}
+
+/**
+ * @param hist - histogram
+ * @return sub-bucket bits of its precision
+ */
+static int histogram_bits(t_rtt_histogram *hist) {
+	return hist->coarse ? HIST_COARSE_BITS : HIST_SUB_BITS;
+}
+
+/**
+ * @param value - recorded value in ns
+ * @param bits - sub-bucket bits of the histogram
+ * @return histogram bucket index
+ * 
+ * Maps a value to its log-linear bucket: values below 2^bits get exact buckets,
+ * larger ones keep their bits bits after the leading one
+ */
+static size_t histogram_bucket(int64_t value, int bits) {
+	int64_t sub_count = (int64_t)1 << bits;
 	
-	if (family == AF_INET) {
-		sent_time = (struct timeval*)(buffer + (ip_header->ihl * 4) + sizeof(struct icmphdr));
-	} else {
-		sent_time = (struct timeval*)(buffer + sizeof(struct icmphdr));
+	if (value < 0) {
+		value = 0;
 	}
-	
-	return (now.tv_sec - sent_time->tv_sec) * 1000.0 + 
-		   (now.tv_usec - sent_time->tv_usec) / 1000.0;
+	if (value >= ((int64_t)1 << HIST_MAX_BITS)) {
+		return HIST_BUCKETS(bits) - 1;
+	}
+	if (value < sub_count) {
+		return value;
+	}
+	int msb = 63 - __builtin_clzll(value);
+	size_t group = msb - bits + 1;
+	size_t sub = (value >> (msb - bits)) & (sub_count - 1);
+	return group * sub_count + sub;
 }
 
 /**
- * @param state - ping state containing RTT list
- * @param rtt - RTT value to insert in sorted order
- * 
- * Inserts RTT value into sorted linked list maintaining ascending order
+ * @param index - histogram bucket index
+ * @param bits - sub-bucket bits of the histogram
+ * @return midpoint of the values the bucket covers, in ns
  */
+static int64_t histogram_value(size_t index, int bits) {
+	size_t group = index >> bits;
+	size_t sub = index & (((size_t)1 << bits) - 1);
+	if (group == 0) {
+		return sub;
+	}
+	int64_t low = (int64_t)(((size_t)1 << bits) + sub) << (group - 1);
+	return low + (((int64_t)1 << (group - 1)) >> 1);
+}
 
-static void insert_rtt_sorted(t_ping_state *state, double rtt) {
-	t_rtt_entry *new_entry = malloc(sizeof(t_rtt_entry));
-	if (!new_entry) {
-		fprintf(stderr, "malloc failed for RTT entry\n");
-		cleanup_packets(state);
-		close(state->conn.ipv4.sockfd);
-		close(state->conn.ipv6.sockfd);
-		exit(1); 
+/**
+ * @param hist - histogram to update
+ * @return 0 on success, 1 on allocation failure
+ * 
+ * Allocates the buckets on the first value, so targets that never answer
+ * cost no histogram memory
+ */
+static int histogram_alloc(t_rtt_histogram *hist) {
+	if (!hist->counts) {
+		hist->counts = calloc(HIST_BUCKETS(histogram_bits(hist)), sizeof(uint32_t));
 	}
-	
-	new_entry->rtt = rtt;
-	if (!state->stats.rtt_list || rtt <= state->stats.rtt_list->rtt) {
-		new_entry->next = state->stats.rtt_list;
-		state->stats.rtt_list = new_entry;
+	return hist->counts == NULL;
+}
+
+/**
+ * @param hist - histogram to update
+ * @param value - value to record, in ns
+ * 
+ * Counts a value in its bucket in constant time and memory. A value that
+ * finds no memory for the buckets is left out of the histogram only
+ */
+void histogram_record(t_rtt_histogram *hist, int64_t value) {
+	if (histogram_alloc(hist)) {
 		return;
 	}
+	hist->counts[histogram_bucket(value, histogram_bits(hist))]++;
+	hist->total++;
+}
+
+/**
+ * @param hist - histogram to query
+ * @param percentile - percentile to compute, 0-100
+ * @return value at the percentile in ns (within bucket precision), 0 if empty
+ * 
+ * Walks the buckets until the cumulative count reaches the percentile rank
+ */
+int64_t histogram_percentile(t_rtt_histogram *hist, double percentile) {
+	if (hist->total == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)ceil(percentile / 100.0 * hist->total);
+	if (rank < 1) {
+		rank = 1;
+	}
 	
-	t_rtt_entry *current = state->stats.rtt_list;
-	while (current->next && current->next->rtt < rtt) {
-		current = current->next;
+	int bits = histogram_bits(hist);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < (size_t)HIST_BUCKETS(bits); i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			return histogram_value(i, bits);
+		}
 	}
+	return histogram_value(HIST_BUCKETS(bits) - 1, bits);
+}
+
+/**
+ * @param hist - histogram to query
+ * @param bounds - upper bounds in ns, ascending
+ * @param count - number of bounds
+ * @param below - filled with the number of values at or under each bound
+ * 
+ * Computes the cumulative counts of a Prometheus style histogram in a single
+ * walk of the buckets. A bucket straddling a bound counts as under it, so the
+ * counts are exact within bucket precision
+ */
+void histogram_cumulative(t_rtt_histogram *hist, const int64_t *bounds, size_t count, uint64_t *below) {
+	int bits = histogram_bits(hist);
+	uint64_t seen = 0;
+	size_t i = 0;
 	
-	new_entry->next = current->next;
-	current->next = new_entry;
+	for (size_t b = 0; b < count; b++) {
+		size_t last = histogram_bucket(bounds[b], bits);
+		for (; hist->counts && i <= last; i++) {
+			seen += hist->counts[i];
+		}
+		below[b] = seen;
+	}
 }
 
-void update_rtt_stats(t_ping_state *state, double rtt) {
-	if (state->stats.packets_received == 0 || rtt < state->stats.min_rtt) {
-		state->stats.min_rtt = rtt;
+/**
+ * @param into - histogram to merge into
+ * @param from - histogram to add, left unchanged
+ * 
+ * Adds every bucket of from to the bucket of into holding its midpoint, which
+ * is the same bucket when both have the same precision
+ */
+void histogram_merge(t_rtt_histogram *into, t_rtt_histogram *from) {
+	if (from->total == 0 || histogram_alloc(into)) {
+		return;
 	}
-	if (rtt > state->stats.max_rtt) {
-		state->stats.max_rtt = rtt;
+	int from_bits = histogram_bits(from);
+	int into_bits = histogram_bits(into);
+	
+	for (size_t i = 0; i < (size_t)HIST_BUCKETS(from_bits); i++) {
+		if (from->counts[i]) {
+			into->counts[histogram_bucket(histogram_value(i, from_bits), into_bits)] += from->counts[i];
+		}
 	}
-	state->stats.sum_rtt += rtt;
-	insert_rtt_sorted(state, rtt);
+	into->total += from->total;
 }
 
 /**
- * @param state - ping state containing RTT list
+ * @param hist - histogram to free
+ *
+ * Frees the buckets and empties the histogram, keeping its precision
+ */
+void histogram_free(t_rtt_histogram *hist) {
+	free(hist->counts);
+	hist->counts = NULL;
+	hist->total = 0;
+}
+
+/**
+ * @param stats - RTT statistics of a target or of the whole run
+ * @param rtt - RTT of a reply in milliseconds, negative when the reply carried none
  * 
- * Frees all RTT entries in the list and resets list pointer
+ * Updates min/max/sum, the Welford running mean and variance, the moving
+ * average and the RTT histogram. Constant time and memory per reply, however
+ * long the run
  */
+void update_rtt_stats(t_ping_stats *stats, double rtt) {
+	if (rtt < 0.0) {
+		return;
+	}
+	if (stats->rtt_count == 0 || rtt < stats->min_rtt) {
+		stats->min_rtt = rtt;
+	}
+	if (rtt > stats->max_rtt) {
+		stats->max_rtt = rtt;
+	}
+	stats->sum_rtt += rtt;
+	stats->rtt_ewma = (stats->rtt_count == 0) ? rtt : stats->rtt_ewma + (rtt - stats->rtt_ewma) / 8;
+	stats->rtt_count++;
+	
+	double delta = rtt - stats->rtt_mean;
+	stats->rtt_mean += delta / stats->rtt_count;
+	stats->rtt_m2 += delta * (rtt - stats->rtt_mean);
+	histogram_record(&stats->rtt_hist, llround(rtt * NSEC_PER_MSEC));
+}
 
-void cleanup_rtt_list(t_ping_state *state) {
-	t_rtt_entry *current = state->stats.rtt_list;
-	while (current) {
-		t_rtt_entry *next = current->next;
-		free(current);
-		current = next;
-	}
-	state->stats.rtt_list = NULL;
+/**
+ * @param into - statistics to merge into
+ * @param from - statistics to add, left unchanged
+ * 
+ * Combines two sets of statistics as if every probe had been counted in one:
+ * counters and histograms add up, the Welford accumulators combine with the
+ * parallel update of Chan et al. Moving averages have no exact merge, they are
+ * weighted by RTT count
+ */
+void merge_stats(t_ping_stats *into, t_ping_stats *from) {
+	if (from->packets_sent > 0) {
+		if (into->packets_sent == 0 || timercmp(&from->first_packet_time, &into->first_packet_time, <)) {
+			into->first_packet_time = from->first_packet_time;
+		}
+		if (into->packets_sent == 0 || timercmp(&from->last_packet_time, &into->last_packet_time, >)) {
+			into->last_packet_time = from->last_packet_time;
+		}
+	}
+	into->packets_sent += from->packets_sent;
+	into->packets_received += from->packets_received;
+	into->errors += from->errors;
+	into->error_types[ERROR_TIME_EXCEEDED] += from->error_types[ERROR_TIME_EXCEEDED];
+	into->error_types[ERROR_UNREACHABLE] += from->error_types[ERROR_UNREACHABLE];
+	into->timeouts += from->timeouts;
+	if (from->rtt_count == 0) {
+		return;
+	}
+	
+	if (into->rtt_count == 0 || from->min_rtt < into->min_rtt) {
+		into->min_rtt = from->min_rtt;
+	}
+	if (from->max_rtt > into->max_rtt) {
+		into->max_rtt = from->max_rtt;
+	}
+	into->sum_rtt += from->sum_rtt;
+	
+	long count = into->rtt_count + from->rtt_count;
+	double delta = from->rtt_mean - into->rtt_mean;
+	into->rtt_ewma = (into->rtt_ewma * into->rtt_count + from->rtt_ewma * from->rtt_count) / count;
+	into->rtt_mean += delta * from->rtt_count / count;
+	into->rtt_m2 += from->rtt_m2 + delta * delta * into->rtt_count * from->rtt_count / count;
+	into->rtt_count = count;
+	
+	histogram_merge(&into->rtt_hist, &from->rtt_hist);
 }
 
-double calculate_mean_deviation(t_ping_state *state) {
-    if (state->stats.packets_received == 0) {
-        return 0.0;
-    }
-    double sum_dev = 0.0;
-    double avg = state->stats.avg_rtt;
-    t_rtt_entry *current = state->stats.rtt_list;
-    while (current) {
-        sum_dev += fabs(current->rtt - avg);
-        current = current->next;
-    }
-    return sum_dev / state->stats.packets_received;
-}
\ No newline at end of file
+/**
+ * @param stats - RTT statistics of a target or of the whole run
+ * @return standard deviation of the RTTs in milliseconds
+ * 
+ * Calculates mdev like iputils, as the population standard deviation of the RTTs,
+ * taken from the Welford accumulators
+ */
+double calculate_mean_deviation(t_ping_stats *stats) {
+	if (stats->rtt_count == 0) {
+		return 0.0;
+	}
+	return sqrt(stats->rtt_m2 / stats->rtt_count);
+}
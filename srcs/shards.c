@@ -0,0 +1,311 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * @param state - ping state containing resolved targets and options
+ * @param shard - shard state to fill
+ * @param index - shard number
+ * @param count - number of shards
+ *
+ * Gives the shard its contiguous slice of the main target list, which it
+ * updates in place so nothing is copied in or out, and its own copy of the
+ * options with its share of the --rate
+ */
+static void assign_targets(t_ping_state *state, t_ping_state *shard, int index, int count) {
+	shard->opts = state->opts;
+	shard->shard.index = index;
+	shard->shard.count = count;
+	shard->shard.stop_fd = state->shard.stop_fd;
+	shard->shard.done_fd = state->shard.done_fd;
+	shard->pcap.file = state->pcap.file;
+	size_t first = state->ntargets * index / count;
+	size_t ntargets = state->ntargets * (index + 1) / count - first;
+	shard->targets = state->targets + first;
+	shard->ntargets = ntargets;
+	shard->target_cap = ntargets;
+	shard->opts.rate = state->opts.rate * ntargets / state->ntargets;
+}
+
+/**
+ * @param state - ping state containing resolved targets and options
+ * @param shard - shard state to initialize
+ * @param index - shard number
+ * @param count - number of shards
+ * @param argv - command line arguments for error reporting
+ * @return 0 on success, 1 on failure
+ *
+ * Sets a shard up like a single threaded run over its targets: own sockets,
+ * in-flight tables, deadline queue, batches, timestamps, send schedule and
+ * event loop, output buffer, -A writer and capture buffer. Only the main thread reads signals,
+ * it asks the shard for interim statistics through the shard status descriptor
+ */
+static int init_shard(t_ping_state *state, t_ping_state *shard, int index, int count, char **argv) {
+	shard->conn.ipv4.sockfd = -1;
+	shard->conn.ipv6.sockfd = -1;
+	shard->loop.epoll_fd = -1;
+	shard->loop.timer_fd = -1;
+	shard->loop.signal_fd = -1;
+	shard->writer.wake_fd = -1;
+	shard->shard.status_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shard->shard.status_fd < 0) {
+		perror("ft_ping: eventfd");
+		return 1;
+	}
+	assign_targets(state, shard, index, count);
+	if (init_target_map(shard) ||
+		createSocket(shard, argv) ||
+		init_packet_system(shard) ||
+		init_filters(shard) ||
+		init_batches(shard) ||
+		init_timestamps(shard) ||
+		setupPoll(shard) ||
+		init_output(shard) ||
+		init_writer(shard) ||
+		init_pcap(shard)) {
+		return 1;
+	}
+	memset(&shard->stats, 0, sizeof(shard->stats));
+	init_schedule(shard);
+	return 0;
+}
+
+/**
+ * @param shard - shard state to free
+ *
+ * Frees what a shard allocated, its targets stay owned by the main state
+ */
+static void cleanup_shard(t_ping_state *shard) {
+	cleanup_output(shard);
+	cleanup_pcap(shard);
+	cleanup_packets(shard);
+	cleanup_batches(shard);
+	cleanup_timestamps(shard);
+	cleanup_poll(shard);
+	histogram_free(&shard->stats.rtt_hist);
+	histogram_free(&shard->send_jitter.hist);
+	free(shard->target_map.slots);
+	if (shard->conn.ipv4.sockfd >= 0) {
+		close(shard->conn.ipv4.sockfd);
+	}
+	if (shard->conn.ipv6.sockfd >= 0) {
+		close(shard->conn.ipv6.sockfd);
+	}
+	if (shard->shard.status_fd >= 0) {
+		close(shard->shard.status_fd);
+	}
+}
+
+/**
+ * @param arg - shard state
+ * @return NULL
+ *
+ * Worker thread body, runs the shard's event loop, drains its -A writer and
+ * tells the main thread when it returns. A shard only touches its own state, so
+ * the loop needs no locking
+ */
+static void *shard_worker(void *arg) {
+	t_ping_state *shard = arg;
+	uint64_t one = 1;
+	run_event_loop(shard);
+	stop_writer(shard);
+	ssize_t written = write(shard->shard.done_fd, &one, sizeof(one));
+	(void)written;
+	return NULL;
+}
+
+/**
+ * @param state - ping state receiving the results
+ * @param shard - shard state whose worker has been joined
+ *
+ * Adds the shard's send schedule lateness to the run's, combining the
+ * running means and squared deviations like merge_stats()
+ */
+static void merge_send_jitter(t_ping_state *state, t_ping_state *shard) {
+	if (shard->send_jitter.count == 0) {
+		return;
+	}
+	
+	long count = state->send_jitter.count + shard->send_jitter.count;
+	double delta = shard->send_jitter.mean - state->send_jitter.mean;
+	state->send_jitter.mean += delta * shard->send_jitter.count / count;
+	state->send_jitter.m2 += shard->send_jitter.m2 +
+		delta * delta * state->send_jitter.count * shard->send_jitter.count / count;
+	state->send_jitter.count = count;
+	state->send_jitter.max = MAX(state->send_jitter.max, shard->send_jitter.max);
+	histogram_merge(&state->send_jitter.hist, &shard->send_jitter.hist);
+}
+
+/**
+ * @param state - ping state receiving the results
+ * @param shard - shard state whose worker has been joined
+ *
+ * Adds the shard's totals, send schedule lateness, filter, syscall, dropped
+ * record and simulated network counters to the run totals, its per-target
+ * statistics are already in the targets. Runs after pthread_join(), which
+ * orders every write of the worker before these reads
+ */
+static void collect_shard(t_ping_state *state, t_ping_state *shard) {
+	merge_send_jitter(state, shard);
+	merge_stats(&state->stats, &shard->stats);
+	merge_filter_stats(state, shard);
+	state->io.backend = shard->io.backend;
+	state->io.syscalls += shard->io.syscalls;
+	state->io.bad_checksums += shard->io.bad_checksums;
+	state->writer.dropped += shard->writer.dropped;
+	state->sim.lost += shard->sim.lost;
+	state->sim.duplicated += shard->sim.duplicated;
+	state->sim.reordered += shard->sim.reordered;
+	state->sim.corrupted += shard->sim.corrupted;
+	state->sim.overflowed += shard->sim.overflowed;
+}
+
+/**
+ * @param state - ping state containing resolved targets and options
+ * @param shards - shard states to initialize
+ * @param count - number of shards
+ * @param argv - command line arguments for error reporting
+ * @return 0 on success, 1 on failure with every shard freed
+ */
+static int init_shards(t_ping_state *state, t_ping_state *shards, int count, char **argv) {
+	for (int i = 0; i < count; i++) {
+		if (init_shard(state, &shards[i], i, count, argv) != 0) {
+			for (int j = 0; j <= i; j++) {
+				cleanup_shard(&shards[j]);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the stop descriptor
+ */
+static void stop_workers(t_ping_state *state) {
+	uint64_t one = 1;
+	ssize_t written = write(state->shard.stop_fd, &one, sizeof(one));
+	(void)written;
+}
+
+/**
+ * @param state - ping state containing the signalfd and worker descriptors
+ * @param started - number of workers running
+ * 
+ * Sleeps until every worker has returned or a signal arrives, in which case
+ * the workers are stopped through the stop descriptor
+ */
+static void wait_for_workers(t_ping_state *state, int started) {
+	struct pollfd fds[2] = {
+		{.fd = state->loop.signal_fd, .events = POLLIN},
+		{.fd = state->shard.done_fd, .events = POLLIN},
+	};
+	uint64_t done = 0;
+	
+	while (done < (uint64_t)started) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			stop_workers(state);
+			return;
+		}
+		if ((fds[0].revents & POLLIN) && handleSignals(state)) {
+			stop_workers(state);
+			return;
+		}
+		uint64_t returned;
+		if ((fds[1].revents & POLLIN) && read(state->shard.done_fd, &returned, sizeof(returned)) == sizeof(returned)) {
+			done += returned;
+		}
+	}
+}
+
+/**
+ * @param state - ping state containing the stop descriptor
+ * @param shards - initialized shard states
+ * @param threads - thread handles, one per shard
+ * @param count - number of shards
+ * 
+ * Starts one worker per shard, waits for them to finish or for a signal, then
+ * joins them. Signals are blocked by setupSignals() before any worker starts,
+ * so only the main thread reads them. If a thread cannot be started the ones
+ * already running are stopped
+ */
+static void run_workers(t_ping_state *state, t_ping_state *shards, pthread_t *threads, int count) {
+	int started = 0;
+	
+	for (; started < count; started++) {
+		int err = pthread_create(&threads[started], NULL, shard_worker, &shards[started]);
+		if (err != 0) {
+			fprintf(stderr, "ft_ping: pthread_create: %s\n", strerror(err));
+			stop_workers(state);
+			break;
+		}
+	}
+	if (started == count) {
+		wait_for_workers(state, started);
+	}
+	
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+/**
+ * @param state - ping state containing resolved targets and options
+ * @param argv - command line arguments for error reporting
+ * @return exit status of the run
+ *
+ * Shards the targets across -j worker threads, each running the single threaded
+ * event loop over its own sockets, schedule and in-flight tables with its own
+ * ICMP identifier. Signals are read by the main thread only, which wakes
+ * the workers through a shared eventfd, joins them and reports merged statistics
+ */
+int run_shards(t_ping_state *state, char **argv) {
+	int count = MIN((size_t)state->opts.threads, state->ntargets);
+	t_ping_state *shards = calloc(count, sizeof(t_ping_state));
+	pthread_t *threads = calloc(count, sizeof(pthread_t));
+	int ret = 1;
+
+	state->shard.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	state->shard.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!shards || !threads || state->shard.stop_fd < 0 || state->shard.done_fd < 0) {
+		fprintf(stderr, "ft_ping: cannot set up %d shards\n", count);
+	} else if (setupSignals(state) == 0 && init_output(state) == 0 &&
+			   init_shards(state, shards, count, argv) == 0) {
+		state->shard.count = count;
+		state->shard.workers = shards;
+		state->opts.psize = shards[0].opts.psize;
+		for (int i = 0; i < count; i++) {
+			print_verbose_info(&shards[i]);
+		}
+		print_default_info(state);
+		
+		run_workers(state, shards, threads, count);
+		for (int i = 0; i < count; i++) {
+			collect_shard(state, &shards[i]);
+			cleanup_shard(&shards[i]);
+		}
+		state->shard.workers = NULL;
+		read_filter_stats(state);
+		
+		ret = (interrupted(state) || all_targets_answered(state)) ? 0 : 1;
+		print_stats(state);
+	}
+	
+	int descriptors[] = {state->shard.stop_fd, state->shard.done_fd, state->loop.signal_fd};
+	for (int i = 0; i < 3; i++) {
+		if (descriptors[i] >= 0) {
+			close(descriptors[i]);
+		}
+	}
+	free(shards);
+	free(threads);
+	cleanup_output(state);
+	cleanup_shm(state);
+	cleanup_pcap(state);
+	cleanup_targets(state);
+	histogram_free(&state->stats.rtt_hist);
+	histogram_free(&state->send_jitter.hist);
+	return ret;
+}
@@ -0,0 +1,102 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * @param state - ping state containing the resolved targets and --shm name
+ * @return 0 on success, 1 on failure
+ *
+ * Creates /dev/shm/<name> sized for every target, maps it and gives each
+ * target its block. The names are written before the magic, which tells
+ * readers the segment is initialized. Must run before targets are sharded, so
+ * every shard's copy of a target points at the same block
+ */
+int init_shm(t_ping_state *state) {
+	if (!state->opts.shm_name) {
+		return 0;
+	}
+	if (strchr(state->opts.shm_name, '/') || state->opts.shm_name[0] == '\0') {
+		fprintf(stderr, "ft_ping: invalid shm name: %s (must be a file name)\n", state->opts.shm_name);
+		return 1;
+	}
+	snprintf(state->shm.path, sizeof(state->shm.path), "/dev/shm/%s", state->opts.shm_name);
+	state->shm.size = sizeof(t_shm_header) + state->ntargets * sizeof(t_shm_target);
+
+	int fd = open(state->shm.path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, state->shm.size) < 0) {
+		fprintf(stderr, "ft_ping: %s: %s\n", state->shm.path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(state->shm.path);
+		}
+		return 1;
+	}
+	t_shm_header *header = mmap(NULL, state->shm.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		fprintf(stderr, "ft_ping: mmap %s: %s\n", state->shm.path, strerror(errno));
+		unlink(state->shm.path);
+		return 1;
+	}
+
+	header->version = SHM_VERSION;
+	header->header_size = sizeof(t_shm_header);
+	header->target_size = sizeof(t_shm_target);
+	header->ntargets = state->ntargets;
+	header->pid = getpid();
+	header->running = 1;
+	header->started_ns = wall_ns();
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_shm_target *block = shm_target(header, i);
+		snprintf(block->name, sizeof(block->name), "%s", state->targets[i].name);
+		snprintf(block->addr, sizeof(block->addr), "%s", state->targets[i].addr_str);
+		state->targets[i].shm = block;
+	}
+	__atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	state->shm.header = header;
+	return 0;
+}
+
+/**
+ * @param target - target whose statistics changed
+ *
+ * Copies the target's counters into its segment block under the seqlock: the
+ * sequence turns odd, the fields are stored, the sequence turns even again.
+ * A handful of stores into memory the probe loop already owns, no syscall
+ */
+void publish_stats(t_target *target) {
+	t_shm_target *block = target->shm;
+	t_ping_stats *stats = &target->stats;
+
+	if (!block) {
+		return;
+	}
+	uint64_t seq = block->seq;
+	__atomic_store_n(&block->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&block->sent, stats->packets_sent, __ATOMIC_RELAXED);
+	__atomic_store_n(&block->received, stats->packets_received, __ATOMIC_RELAXED);
+	__atomic_store_n(&block->errors, stats->errors, __ATOMIC_RELAXED);
+	__atomic_store_n(&block->rtt_count, stats->rtt_count, __ATOMIC_RELAXED);
+	__atomic_store_n(&block->min_rtt_ns, llround(stats->min_rtt * NSEC_PER_MSEC), __ATOMIC_RELAXED);
+	__atomic_store_n(&block->max_rtt_ns, llround(stats->max_rtt * NSEC_PER_MSEC), __ATOMIC_RELAXED);
+	__atomic_store_n(&block->sum_rtt_ns, llround(stats->sum_rtt * NSEC_PER_MSEC), __ATOMIC_RELAXED);
+	__atomic_store_n(&block->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @param state - ping state containing the mapped segment
+ *
+ * Marks the run ended for readers that still have the segment mapped, then
+ * removes and unmaps it
+ */
+void cleanup_shm(t_ping_state *state) {
+	if (!state->shm.header) {
+		return;
+	}
+	__atomic_store_n(&state->shm.header->running, 0, __ATOMIC_RELEASE);
+	unlink(state->shm.path);
+	munmap(state->shm.header, state->shm.size);
+	state->shm.header = NULL;
+	for (size_t i = 0; i < state->ntargets; i++) {
+		state->targets[i].shm = NULL;
+	}
+}
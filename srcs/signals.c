@@ -1,14 +1,17 @@
 #include "../includes/ft_ping.h"
 
-static t_ping_state *state_ptr = NULL; 
-
 /**
  * @param state - ping state containing count and timeout options
  * 
- * Sets up alarm for finite ping operations based on expected runtime
+ * Sets up alarm for finite ping operations based on expected runtime, which
+ * a -E sim run measures in virtual time, so it gets none. A --rate run falls
+ * behind its nominal rate whenever the loop wakes late, it gets none either
+ * and ends when its last probe is answered or expires. Neither does a run
+ * longer than alarm() can express, -i goes up to 2099999 s, which likewise
+ * ends with its last probe instead of being cut short by a wrapped alarm
  */
 static void setup_alarm(t_ping_state *state) {
-	if (state->opts.count == -1) {
+	if (state->opts.count == -1 || state->opts.backend == IO_SIM || state->opts.rate > 0.0) {
 		return;
 	}
 	
@@ -17,25 +20,41 @@ static void setup_alarm(t_ping_state *state) {
 		remaining_packets = 0;
 	}
 	
-	unsigned int total_seconds = remaining_packets + state->opts.timeout;
-	alarm(total_seconds);
+	long interval = state->opts.interval;
+	if (state->opts.flood && interval == 0) {
+		interval = FLOOD_INTERVAL_US;
+	}
+	long long send_us = (long long)remaining_packets * interval;
+	long long total_seconds = (send_us + 999999) / 1000000 + state->opts.timeout;
+	if (total_seconds <= UINT_MAX) {
+		alarm(total_seconds);
+	}
 }
 
 /**
- * @param state - ping state to store globally for signal handlers
+ * @param state - ping state to store the signalfd in
+ * @return 0 on success, 1 on failure
  * 
- * Configures signal handlers for graceful termination and alarm timeout
+ * Blocks the termination signals, SIGQUIT and the alarm timeout and reads them
+ * from a signalfd in the event loop, so stats are printed and resources freed
+ * from normal context. Threads started afterwards inherit the blocked mask
  */
-void setupSignals(t_ping_state *state) { 
-	static struct sigaction handler;
-	state_ptr = state; 
-	handler.sa_sigaction = handleSignals;
-	sigemptyset(&handler.sa_mask);
-	handler.sa_flags = 0;
-	sigaction(SIGINT, &handler, NULL);
-	sigaction(SIGTERM, &handler, NULL);
-	sigaction(SIGQUIT, &handler, NULL);
-	sigaction(SIGALRM, &handler, NULL);
+int setupSignals(t_ping_state *state) { 
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGALRM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		perror("sigprocmask");
+		return 1;
+	}
+	state->loop.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (state->loop.signal_fd < 0) {
+		perror("signalfd");
+		return 1;
+	}
 
 	static struct sigaction ignore;
 	ignore.sa_handler = SIG_IGN;
@@ -44,31 +63,71 @@ void setupSignals(t_ping_state *state) {
 	sigaction(SIGCHLD, &ignore, NULL);
 	sigaction(SIGTSTP, &ignore, NULL);
 	setup_alarm(state);
+	return 0;
 }
 
 /**
- * @param signum - signal number received
- * @param info - signal info (unused)
- * @param ptr - signal context (unused)
+ * @param state - ping state containing statistics, or the shards of a -j run
  * 
- * Handles termination signals and alarm timeout with proper cleanup
+ * Prints the running summary, or asks every shard worker to print its own
+ * since only the worker may read its statistics while it runs
  */
-void handleSignals(int signum, siginfo_t *info, void *ptr) {	(void)info;
-	(void)ptr;
+static void request_status(t_ping_state *state) {
+	uint64_t one = 1;
 	
-	if (signum == SIGINT || signum == SIGTERM || signum == SIGQUIT) {
-		// printf("\nReceived signal %d, exiting...\n", signum);
-		print_stats(state_ptr);
-		cleanup_packets(state_ptr);
-		close(state_ptr->conn.ipv4.sockfd);
-		close(state_ptr->conn.ipv6.sockfd);
-		exit(0); 
-	} else if (signum == SIGALRM) {
-		print_stats(state_ptr);
-		cleanup_packets(state_ptr);
-		close(state_ptr->conn.ipv4.sockfd);
-		close(state_ptr->conn.ipv6.sockfd);
-		exit((state_ptr->stats.packets_received == 0) ? 1 : 0);
+	if (!state->shard.workers) {
+		print_status(state);
+		return;
+	}
+	for (int i = 0; i < state->shard.count; i++) {
+		ssize_t written = write(state->shard.workers[i].shard.status_fd, &one, sizeof(one));
+		(void)written;
 	}
+}
 
-}
\ No newline at end of file
+/**
+ * @param state - ping state containing the signalfd
+ * @return signal that stops the run, 0 if none was pending
+ * 
+ * Reads every pending signal from the signalfd. SIGQUIT prints a running
+ * summary and the run goes on; a termination signal or the alarm timeout is
+ * recorded as the reason the run stopped
+ */
+int handleSignals(t_ping_state *state) {
+	struct signalfd_siginfo info;
+	
+	while (1) {
+		state->io.syscalls++;
+		if (read(state->loop.signal_fd, &info, sizeof(info)) != sizeof(info)) {
+			break;
+		}
+		if (info.ssi_signo == SIGQUIT) {
+			request_status(state);
+		} else {
+			state->loop.signal = info.ssi_signo;
+		}
+	}
+	return state->loop.signal;
+}
+
+/**
+ * @param state - ping state containing the shard status descriptor
+ * 
+ * Prints the running summary a shard worker was asked for by the main thread
+ */
+void handle_status_request(t_ping_state *state) {
+	uint64_t requests;
+	
+	state->io.syscalls++;
+	if (read(state->shard.status_fd, &requests, sizeof(requests)) == sizeof(requests)) {
+		print_status(state);
+	}
+}
+
+/**
+ * @param state - ping state containing the signal that stopped the run
+ * @return 1 if the user stopped the run, 0 if it ended or timed out
+ */
+int interrupted(t_ping_state *state) {
+	return state->loop.signal == SIGINT || state->loop.signal == SIGTERM;
+}
@@ -0,0 +1,523 @@
+#include "../includes/ft_ping.h"
+
+typedef struct s_sim_packet {
+	int64_t			deliver_at;	// virtual ns the reply arrives at
+	uint64_t		order;		// send order, breaks ties so runs are reproducible
+	struct sockaddr	*from;		// address of the target that answers
+	uint32_t		slot;		// buffer holding the reply
+	uint32_t		len;
+	int				f;			// family index of the socket it arrives on
+} t_sim_packet;
+
+struct s_sim {
+	t_sim_packet	*queue;		// binary min-heap by deliver_at, then order
+	size_t			count;
+	size_t			limit;
+	char			*buffers;	// limit buffers of buf_size bytes
+	size_t			buf_size;
+	uint32_t		*free_slots;
+	size_t			nfree;
+	uint64_t		order;
+	uint64_t		rng;
+};
+
+/**
+ * @param str - time with an optional ns, us, ms or s suffix, ms without one
+ * @param result - parsed time in ns
+ * @return 0 on success, 1 on failure
+ */
+static int parse_sim_time(const char *str, int64_t *result) {
+	static const struct {
+		const char	*suffix;
+		double		scale;
+	} units[] = {{"ns", 1}, {"us", NSEC_PER_USEC}, {"ms", NSEC_PER_MSEC}, {"s", NSEC_PER_SEC}, {"", NSEC_PER_MSEC}};
+	char *end;
+
+	errno = 0;
+	double value = strtod(str, &end);
+	if (errno || end == str || value < 0 || value > 3600.0 * NSEC_PER_SEC) {
+		return 1;
+	}
+	for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+		if (strcmp(end, units[i].suffix) == 0 && value * units[i].scale <= 3600.0 * NSEC_PER_SEC) {
+			*result = llround(value * units[i].scale);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @param str - probability as a fraction (0.01) or a percentage (1%)
+ * @param result - parsed probability
+ * @return 0 on success, 1 on failure
+ */
+static int parse_sim_chance(const char *str, double *result) {
+	char *end;
+
+	errno = 0;
+	double value = strtod(str, &end);
+	if (errno || end == str) {
+		return 1;
+	}
+	if (strcmp(end, "%") == 0) {
+		value /= 100.0;
+	} else if (*end != '\0') {
+		return 1;
+	}
+	if (!(value >= 0.0 && value <= 1.0)) {
+		return 1;
+	}
+	*result = value;
+	return 0;
+}
+
+/**
+ * @param config - configuration to fill
+ * @param key - setting name
+ * @param value - setting value
+ * @return 0 on success, 1 on an unknown key or invalid value
+ */
+static int set_sim_option(t_sim_config *config, const char *key, const char *value) {
+	char *end;
+
+	if (strcmp(key, "delay") == 0) {
+		return parse_sim_time(value, &config->delay);
+	}
+	if (strcmp(key, "jitter") == 0) {
+		return parse_sim_time(value, &config->jitter);
+	}
+	if (strcmp(key, "dist") == 0) {
+		if (strcmp(value, "uniform") == 0) {
+			config->distribution = SIM_UNIFORM;
+		} else if (strcmp(value, "normal") == 0) {
+			config->distribution = SIM_NORMAL;
+		} else if (strcmp(value, "pareto") == 0) {
+			config->distribution = SIM_PARETO;
+		} else {
+			return 1;
+		}
+		return 0;
+	}
+	if (strcmp(key, "loss") == 0) {
+		return parse_sim_chance(value, &config->loss);
+	}
+	if (strcmp(key, "dup") == 0) {
+		return parse_sim_chance(value, &config->duplicate);
+	}
+	if (strcmp(key, "reorder") == 0) {
+		return parse_sim_chance(value, &config->reorder);
+	}
+	if (strcmp(key, "corrupt") == 0) {
+		return parse_sim_chance(value, &config->corrupt);
+	}
+	errno = 0;
+	if (strcmp(key, "seed") == 0) {
+		config->seed = strtoull(value, &end, 0);
+		return errno || end == value || *end != '\0' || value[0] == '-';
+	}
+	if (strcmp(key, "limit") == 0) {
+		long limit = strtol(value, &end, 10);
+		if (errno || end == value || *end != '\0' || limit < 1 || limit > SIM_LIMIT_MAX) {
+			return 1;
+		}
+		config->limit = limit;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @param spec - comma separated key=value settings, NULL for the defaults
+ * @param config - configuration to fill
+ * @return 0 on success, 1 on failure
+ *
+ * Parses the --sim impairments: delay, jitter, dist, loss, dup, reorder,
+ * corrupt, seed and limit. Settings not given keep their defaults: a fixed
+ * 1 ms RTT, no impairment, seed 1
+ */
+int parse_sim_config(const char *spec, t_sim_config *config) {
+	char buffer[256];
+	char *save = NULL;
+
+	memset(config, 0, sizeof(*config));
+	config->delay = SIM_DELAY_NS;
+	config->distribution = SIM_UNIFORM;
+	config->seed = 1;
+	config->limit = SIM_LIMIT;
+	if (!spec) {
+		return 0;
+	}
+	if (strlen(spec) >= sizeof(buffer)) {
+		fprintf(stderr, "ft_ping: invalid --sim: too long\n");
+		return 1;
+	}
+	strcpy(buffer, spec);
+	for (char *item = strtok_r(buffer, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(item, '=');
+		if (!value) {
+			fprintf(stderr, "ft_ping: invalid --sim setting: %s (must be key=value)\n", item);
+			return 1;
+		}
+		*value++ = '\0';
+		if (set_sim_option(config, item, value) != 0) {
+			fprintf(stderr, "ft_ping: invalid --sim setting: %s=%s\n", item, value);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param sim - simulated network holding the random state
+ * @return next 64 random bits (xorshift64*)
+ */
+static uint64_t sim_random(t_sim *sim) {
+	sim->rng ^= sim->rng >> 12;
+	sim->rng ^= sim->rng << 25;
+	sim->rng ^= sim->rng >> 27;
+	return sim->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @param sim - simulated network holding the random state
+ * @return uniform random number in (0, 1)
+ */
+static double sim_uniform(t_sim *sim) {
+	return ((sim_random(sim) >> 11) + 0.5) * 0x1.0p-53;
+}
+
+/**
+ * @param sim - simulated network holding the random state
+ * @param chance - probability of the event
+ * @return 1 with the given probability, 0 otherwise
+ */
+static int sim_chance(t_sim *sim, double chance) {
+	return chance > 0.0 && sim_uniform(sim) < chance;
+}
+
+/**
+ * @param state - ping state containing the --sim configuration
+ * @return RTT of a reply in ns, drawn from the configured distribution
+ */
+static int64_t sim_delay(t_ping_state *state) {
+	t_sim_config *config = &state->opts.sim;
+	t_sim *sim = state->sim.net;
+	double delay = config->delay;
+
+	if (config->jitter > 0) {
+		switch (config->distribution) {
+			case SIM_NORMAL:
+				delay += config->jitter * sqrt(-2.0 * log(sim_uniform(sim))) * cos(2.0 * M_PI * sim_uniform(sim));
+				break;
+			case SIM_PARETO:
+				delay += config->jitter * 2.0 * (pow(sim_uniform(sim), -1.0 / 3.0) - 1.0);
+				break;
+			default:
+				delay += config->jitter * (2.0 * sim_uniform(sim) - 1.0);
+				break;
+		}
+	}
+	return (delay > 0.0) ? llround(delay) : 0;
+}
+
+/**
+ * @param a - queued reply
+ * @param b - queued reply
+ * @return 1 if a is delivered before b
+ */
+static int sim_before(t_sim_packet *a, t_sim_packet *b) {
+	return a->deliver_at < b->deliver_at || (a->deliver_at == b->deliver_at && a->order < b->order);
+}
+
+/**
+ * @param sim - simulated network
+ * @param packet - reply to queue, its buffer already filled
+ */
+static void sim_push(t_sim *sim, t_sim_packet *packet) {
+	size_t i = sim->count++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!sim_before(packet, &sim->queue[parent])) {
+			break;
+		}
+		sim->queue[i] = sim->queue[parent];
+		i = parent;
+	}
+	sim->queue[i] = *packet;
+}
+
+/**
+ * @param sim - simulated network with at least one queued reply
+ * @return the earliest reply, removed from the queue
+ */
+static t_sim_packet sim_pop(t_sim *sim) {
+	t_sim_packet top = sim->queue[0];
+	t_sim_packet last = sim->queue[--sim->count];
+	size_t i = 0;
+
+	while (2 * i + 1 < sim->count) {
+		size_t child = 2 * i + 1;
+		if (child + 1 < sim->count && sim_before(&sim->queue[child + 1], &sim->queue[child])) {
+			child++;
+		}
+		if (!sim_before(&sim->queue[child], &last)) {
+			break;
+		}
+		sim->queue[i] = sim->queue[child];
+		i = child;
+	}
+	sim->queue[i] = last;
+	return top;
+}
+
+/**
+ * @param state - ping state containing packet size options and the --sim configuration
+ * @return 0 on success, 1 on failure
+ *
+ * Sets up the simulated network of -E sim: a queue of replies in flight, with
+ * a preallocated buffer each, and the virtual clock, started at CLOCK_MONOTONIC.
+ * The queue limit is lowered so its buffers stay under SIM_QUEUE_BYTES
+ */
+int init_sim(t_ping_state *state) {
+	t_sim *sim = calloc(1, sizeof(t_sim));
+
+	if (!sim) {
+		fprintf(stderr, "malloc failed for simulated network\n");
+		return 1;
+	}
+	state->sim.net = sim;
+	sim->buf_size = (state->opts.psize + sizeof(struct iphdr) + 7) & ~(size_t)7;
+	sim->limit = MIN(state->opts.sim.limit, MAX(SIM_QUEUE_BYTES / sim->buf_size, 1));
+	sim->queue = malloc(sim->limit * sizeof(t_sim_packet));
+	sim->buffers = malloc(sim->limit * sim->buf_size);
+	sim->free_slots = malloc(sim->limit * sizeof(uint32_t));
+	if (!sim->queue || !sim->buffers || !sim->free_slots) {
+		fprintf(stderr, "malloc failed for simulated network\n");
+		cleanup_sim(state);
+		return 1;
+	}
+	for (size_t i = 0; i < sim->limit; i++) {
+		sim->free_slots[i] = sim->limit - 1 - i;
+	}
+	sim->nfree = sim->limit;
+	sim->rng = state->opts.sim.seed + state->shard.index;
+	for (int i = 0; i < 4; i++) {
+		sim->rng = sim->rng * 6364136223846793005ULL + 1442695040888963407ULL;
+	}
+	sim->rng |= 1;
+	state->sim.now = now_ns();
+	state->sim.wall_offset = wall_ns() - state->sim.now;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the simulated network
+ *
+ * Frees the simulated network, replies still in flight are dropped
+ */
+void cleanup_sim(t_ping_state *state) {
+	t_sim *sim = state->sim.net;
+
+	if (!sim) {
+		return;
+	}
+	free(sim->queue);
+	free(sim->buffers);
+	free(sim->free_slots);
+	free(sim);
+	state->sim.net = NULL;
+}
+
+/**
+ * @param state - ping state containing the simulated network
+ * @param packet - reply to queue, deliver_at is set here
+ * @param data - reply datagram
+ *
+ * Queues a copy of the reply with its own delay. A reordered reply skips the
+ * delay, like with netem, and overtakes the replies queued before it
+ */
+static void sim_queue_reply(t_ping_state *state, t_sim_packet *packet, char *data) {
+	t_sim *sim = state->sim.net;
+
+	if (sim->nfree == 0) {
+		state->sim.overflowed++;
+		return;
+	}
+	packet->deliver_at = state->sim.now;
+	if (sim_chance(sim, state->opts.sim.reorder)) {
+		state->sim.reordered++;
+	} else {
+		packet->deliver_at += sim_delay(state);
+	}
+	packet->order = sim->order++;
+	packet->slot = sim->free_slots[--sim->nfree];
+	char *buffer = sim->buffers + (size_t)packet->slot * sim->buf_size;
+	if (buffer != data) {
+		memcpy(buffer, data, packet->len);
+	}
+	sim_push(sim, packet);
+}
+
+/**
+ * @param state - ping state containing the simulated network
+ * @param f - family index of the batch
+ * @param msg - probe to answer
+ *
+ * Turns a probe into the reply its target would send: the echo request type
+ * becomes an echo reply, with the checksum adjusted incrementally (RFC 1624),
+ * and IPv4 replies get the IP header a raw socket returns. The reply may be
+ * lost, corrupted in one bit of its ICMP message, or duplicated
+ */
+static void sim_answer(t_ping_state *state, int f, struct msghdr *msg) {
+	t_sim *sim = state->sim.net;
+	t_sim_packet packet;
+	size_t ip_len = (f == 0) ? sizeof(struct iphdr) : 0;
+	char *data = sim->buffers + (size_t)sim->free_slots[sim->nfree - 1] * sim->buf_size;
+	size_t len = ip_len;
+
+	if (sim_chance(sim, state->opts.sim.loss)) {
+		state->sim.lost++;
+		return;
+	}
+	for (size_t i = 0; i < msg->msg_iovlen; i++) {
+		memcpy(data + len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+		len += msg->msg_iov[i].iov_len;
+	}
+	struct icmphdr *icmp = (struct icmphdr*)(data + ip_len);
+	uint16_t before;
+	uint16_t after;
+	memcpy(&before, icmp, sizeof(before));
+	icmp->type = (f == 0) ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY;
+	memcpy(&after, icmp, sizeof(after));
+	icmp->checksum = inet_checksum_adjust(icmp->checksum, before, after);
+	if (f == 0) {
+		struct iphdr *ip = (struct iphdr*)data;
+		memset(ip, 0, sizeof(*ip));
+		ip->version = 4;
+		ip->ihl = sizeof(*ip) / 4;
+		ip->ttl = 64;
+		ip->protocol = IPPROTO_ICMP;
+		ip->tot_len = htons(len);
+		ip->saddr = ((struct sockaddr_in*)msg->msg_name)->sin_addr.s_addr;
+		ip->check = inet_checksum(ip, sizeof(*ip));
+	}
+	if (sim_chance(sim, state->opts.sim.corrupt)) {
+		size_t bit = sim_random(sim) % ((len - ip_len) * 8);
+		data[ip_len + bit / 8] ^= 1 << (bit % 8);
+		state->sim.corrupted++;
+	}
+
+	packet.from = msg->msg_name;
+	packet.len = len;
+	packet.f = f;
+	// the first copy is built in the slot it takes
+	sim_queue_reply(state, &packet, data);
+	if (sim_chance(sim, state->opts.sim.duplicate)) {
+		state->sim.duplicated++;
+		sim_queue_reply(state, &packet, sim->buffers + (size_t)packet.slot * sim->buf_size);
+	}
+}
+
+/**
+ * @param state - ping state containing the simulated network
+ * @param f - family index of the batch
+ * @param msgs - probes to send
+ * @param count - number of probes
+ * @return number of probes sent, always count
+ *
+ * The send path of -E sim, in place of sendmmsg(): every probe is answered
+ * by the simulated network without a syscall. A probe whose reply finds the
+ * queue full is still sent, its reply is lost
+ */
+int sim_sendmmsg(t_ping_state *state, int f, struct mmsghdr *msgs, int count) {
+	for (int i = 0; i < count; i++) {
+		if (state->sim.net->nfree == 0) {
+			state->sim.overflowed++;
+			continue;
+		}
+		sim_answer(state, f, &msgs[i].msg_hdr);
+	}
+	return count;
+}
+
+/**
+ * @param state - ping state containing the simulated network
+ *
+ * Hands every reply due at the virtual time to the receive path, stamped
+ * with its exact arrival time, so a reply's RTT is the delay it was given
+ */
+static void sim_deliver(t_ping_state *state) {
+	t_sim *sim = state->sim.net;
+
+	while (sim->count > 0 && sim->queue[0].deliver_at <= state->sim.now) {
+		t_sim_packet packet = sim_pop(sim);
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = packet.from;
+		msg.msg_namelen = (packet.f == 0) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+		handle_datagram(state, packet.f, &msg, sim->buffers + (size_t)packet.slot * sim->buf_size,
+						packet.len, packet.deliver_at);
+		sim->free_slots[sim->nfree++] = packet.slot;
+	}
+}
+
+/**
+ * @param state - ping state containing the signal, stop and status descriptors
+ * @return 1 if the loop must stop, 0 otherwise
+ *
+ * The simulated loop never sleeps, so it looks for signals, the shard stop
+ * descriptor and status requests without waiting
+ */
+static int sim_poll_events(t_ping_state *state) {
+	struct pollfd fds[] = {
+		{.fd = state->loop.signal_fd, .events = POLLIN},
+		{.fd = state->shard.stop_fd, .events = POLLIN},
+		{.fd = state->shard.status_fd, .events = POLLIN},
+	};
+
+	state->io.syscalls++;
+	if (poll(fds, 3, 0) <= 0) {
+		return 0;
+	}
+	if (fds[2].revents & POLLIN) {
+		handle_status_request(state);
+	}
+	return (fds[1].revents & POLLIN) || ((fds[0].revents & POLLIN) && handleSignals(state) != 0);
+}
+
+/**
+ * @param state - ping state with packet system, schedule and simulated network initialized
+ * @return 0 on success, 1 if some probes could not be sent
+ *
+ * Runs the event loop of -E sim: send what is due, then instead of sleeping
+ * move the virtual clock straight to the next send, expiry or reply arrival,
+ * deliver the replies due and retire expired probes. The run takes as long as
+ * the CPU needs for it, however long it lasts in virtual time
+ */
+int run_sim_loop(t_ping_state *state) {
+	t_sim *sim = state->sim.net;
+	uint64_t turns = 0;
+	int ret = 0;
+
+	while (!state->sched.transmission_complete || state->sched.in_flight > 0) {
+		ret = send_ping(state);
+		int64_t wake = next_wakeup(state);
+		if (sim->count > 0) {
+			wake = MIN(wake, sim->queue[0].deliver_at);
+		}
+		if (wake == INT64_MAX) {
+			break;
+		}
+		if (wake > state->sim.now) {
+			__atomic_store_n(&state->sim.now, wake, __ATOMIC_RELAXED);
+		}
+		sim_deliver(state);
+		handle_timeouts(state);
+		if (++turns % SIM_POLL_TURNS == 0 && sim_poll_events(state)) {
+			break;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,206 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * @param state - ping state containing the target list
+ * @param name - hostname or address as given by the user
+ * @return 0 on success, 1 on allocation failure
+ *
+ * Appends an unresolved target, growing the target list geometrically
+ */
+int add_target(t_ping_state *state, const char *name) {
+	if (state->ntargets == state->target_cap) {
+		size_t cap = state->target_cap ? state->target_cap * 2 : 4;
+		t_target *targets = realloc(state->targets, cap * sizeof(t_target));
+		if (!targets) {
+			fprintf(stderr, "malloc failed for target list\n");
+			return 1;
+		}
+		state->targets = targets;
+		state->target_cap = cap;
+	}
+
+	t_target *target = &state->targets[state->ntargets];
+	memset(target, 0, sizeof(*target));
+	target->name = strdup(name);
+	if (!target->name) {
+		fprintf(stderr, "malloc failed for target list\n");
+		return 1;
+	}
+	target->sequence = 1;
+	target->stats.rtt_hist.coarse = 1;
+	state->ntargets++;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the target list
+ * @param path - file with one target per line, '#' starts a comment
+ * @return 0 on success, 1 on failure
+ *
+ * Reads targets from a file, skipping blank lines and comments
+ */
+int load_target_file(t_ping_state *state, const char *path) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "ft_ping: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	char *line = NULL;
+	size_t line_cap = 0;
+	int ret = 0;
+	while (getline(&line, &line_cap, file) != -1) {
+		char *comment = strchr(line, '#');
+		if (comment) {
+			*comment = '\0';
+		}
+		char *name = strtok(line, " \t\r\n");
+		if (name && add_target(state, name) != 0) {
+			ret = 1;
+			break;
+		}
+	}
+	free(line);
+	fclose(file);
+	return ret;
+}
+
+/**
+ * @param addr - IPv4 or IPv6 socket address
+ * @param len - pointer to store the address length in bytes
+ * @return pointer to the raw address bytes, NULL for other families
+ */
+static const uint8_t *address_bytes(struct sockaddr *addr, size_t *len) {
+	if (addr->sa_family == AF_INET) {
+		*len = sizeof(struct in_addr);
+		return (const uint8_t*)&((struct sockaddr_in*)addr)->sin_addr;
+	}
+	if (addr->sa_family == AF_INET6) {
+		*len = sizeof(struct in6_addr);
+		return (const uint8_t*)&((struct sockaddr_in6*)addr)->sin6_addr;
+	}
+	return NULL;
+}
+
+/**
+ * @param bytes - raw address bytes
+ * @param len - address length in bytes
+ * @return FNV-1a hash of the address
+ */
+static uint32_t address_hash(const uint8_t *bytes, size_t len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * @param state - ping state containing the target map
+ * @param addr - address to look up
+ * @param slot - pointer to store the map slot holding the address, or the empty slot it belongs in
+ * @return target index + 1, 0 if the address is not a target
+ *
+ * Linear probing over the open addressing map
+ */
+static uint32_t probe_target_map(t_ping_state *state, struct sockaddr *addr, size_t *slot) {
+	size_t len;
+	const uint8_t *bytes = address_bytes(addr, &len);
+	if (!bytes || !state->target_map.slots) {
+		return 0;
+	}
+
+	size_t i = address_hash(bytes, len) & state->target_map.mask;
+	while (state->target_map.slots[i]) {
+		t_target *target = &state->targets[state->target_map.slots[i] - 1];
+		size_t target_len;
+		const uint8_t *target_bytes = address_bytes((struct sockaddr*)&target->addr, &target_len);
+		if (target->family == addr->sa_family && memcmp(target_bytes, bytes, len) == 0) {
+			*slot = i;
+			return state->target_map.slots[i];
+		}
+		i = (i + 1) & state->target_map.mask;
+	}
+	*slot = i;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing resolved targets
+ * @return 0 on success, 1 on allocation failure
+ *
+ * Builds the address to target map used to demultiplex replies in constant time,
+ * at most half full. Targets resolving to an address already listed are dropped
+ */
+int init_target_map(t_ping_state *state) {
+	size_t capacity = PACKET_TABLE_MIN;
+	while (capacity < state->ntargets * 2) {
+		capacity <<= 1;
+	}
+	state->target_map.slots = calloc(capacity, sizeof(uint32_t));
+	if (!state->target_map.slots) {
+		fprintf(stderr, "malloc failed for target map\n");
+		return 1;
+	}
+	state->target_map.mask = capacity - 1;
+
+	size_t kept = 0;
+	for (size_t i = 0; i < state->ntargets; i++) {
+		size_t slot;
+		if (probe_target_map(state, (struct sockaddr*)&state->targets[i].addr, &slot)) {
+			fprintf(stderr, "ft_ping: %s: duplicate of %s, skipped\n",
+					state->targets[i].name, state->targets[i].addr_str);
+			free(state->targets[i].name);
+			continue;
+		}
+		state->targets[kept] = state->targets[i];
+		state->target_map.slots[slot] = kept + 1;
+		kept++;
+	}
+	state->ntargets = kept;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the target map
+ * @param addr - source address of a received datagram
+ * @return matching target, NULL if the address is not a target
+ *
+ * Finds the target an address belongs to in constant time
+ */
+t_target* find_target(t_ping_state *state, struct sockaddr *addr) {
+	size_t slot;
+	uint32_t index = probe_target_map(state, addr, &slot);
+	return index ? &state->targets[index - 1] : NULL;
+}
+
+/**
+ * @param state - ping state containing targets
+ * @return 1 if every target received at least one reply, 0 otherwise
+ */
+int all_targets_answered(t_ping_state *state) {
+	for (size_t i = 0; i < state->ntargets; i++) {
+		if (state->targets[i].stats.packets_received == 0) {
+			return 0;
+		}
+	}
+	return state->ntargets > 0;
+}
+
+/**
+ * @param state - ping state containing targets
+ *
+ * Frees target names and RTT histograms, the target list and the target map
+ */
+void cleanup_targets(t_ping_state *state) {
+	for (size_t i = 0; i < state->ntargets; i++) {
+		free(state->targets[i].name);
+		histogram_free(&state->targets[i].stats.rtt_hist);
+	}
+	free(state->targets);
+	free(state->target_map.slots);
+	state->targets = NULL;
+	state->ntargets = 0;
+	state->target_cap = 0;
+	memset(&state->target_map, 0, sizeof(state->target_map));
+}
@@ -0,0 +1,146 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * @param state - ping state containing sockets and deadline queue
+ * @return 0 on success, 1 on allocation failure
+ * 
+ * Enables kernel software TX and RX timestamps (SO_TIMESTAMPING) on both sockets.
+ * TX timestamps come back on the error queue keyed by a per-socket datagram
+ * counter, so a key to probe map sized like the deadline queue is kept per
+ * socket. Falls back to CLOCK_MONOTONIC read around the syscalls when the kernel
+ * refuses the option. -E sim stamps probes and replies with its virtual clock
+ */
+int init_timestamps(t_ping_state *state) {
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+	int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+				SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+				SOF_TIMESTAMPING_OPT_TSONLY;
+	
+	state->ts.source = (state->opts.backend == IO_SIM) ? TS_VIRTUAL : TS_KERNEL;
+	for (int f = 0; f < 2; f++) {
+		state->ts.tx_key[f] = 0;
+		state->ts.tx_map[f] = calloc(state->deadlines.mask + 1, sizeof(t_tx_key));
+		if (!state->ts.tx_map[f]) {
+			fprintf(stderr, "malloc failed for timestamp keys\n");
+			cleanup_timestamps(state);
+			return 1;
+		}
+		if (state->ts.source == TS_KERNEL &&
+			setsockopt(sockets[f], SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+			state->ts.source = TS_MONOTONIC;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing timestamp key maps
+ * 
+ * Frees the timestamp key to probe maps
+ */
+void cleanup_timestamps(t_ping_state *state) {
+	for (int f = 0; f < 2; f++) {
+		free(state->ts.tx_map[f]);
+		state->ts.tx_map[f] = NULL;
+	}
+}
+
+/**
+ * @param state - ping state containing timestamp source
+ * @return current time in nanoseconds on the clock RTTs are measured with
+ * 
+ * Kernel software timestamps are CLOCK_REALTIME, so userspace fallbacks read the
+ * same clock in kernel mode and CLOCK_MONOTONIC otherwise
+ */
+int64_t timestamp_now(t_ping_state *state) {
+	struct timespec ts;
+	if (state->ts.source == TS_VIRTUAL) {
+		return clock_now(state);
+	}
+	clock_gettime((state->ts.source == TS_KERNEL) ? CLOCK_REALTIME : CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @param state - ping state containing timestamp source
+ * @return human readable name of the timestamp source
+ */
+const char *timestamp_source_str(t_ping_state *state) {
+	if (state->ts.source == TS_VIRTUAL) {
+		return "virtual (-E sim clock)";
+	}
+	return (state->ts.source == TS_KERNEL) ?
+			"kernel (SO_TIMESTAMPING software)" :
+			"userspace (CLOCK_MONOTONIC)";
+}
+
+/**
+ * @param msg - received message with control data
+ * @return kernel software timestamp in nanoseconds, 0 if the message has none
+ * 
+ * Extracts the SCM_TIMESTAMPING software timestamp from a message's control data
+ */
+int64_t message_timestamp(struct msghdr *msg) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			struct scm_timestamping tss;
+			memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+			return (int64_t)tss.ts[0].tv_sec * NSEC_PER_SEC + tss.ts[0].tv_nsec;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing timestamp key maps
+ * @param target - target the probe was sent to
+ * @param packet - table entry of the probe that was just sent
+ * @param sent_at - userspace send time, kept until the kernel TX timestamp arrives
+ * 
+ * Records the send time of a probe and the timestamp key the kernel gave it.
+ * The kernel numbers only the datagrams it accepted, so this must not be
+ * called for a probe the send rejected
+ */
+void record_tx_timestamp(t_ping_state *state, t_target *target, t_packet_entry *packet, int64_t sent_at) {
+	int f = FAMILY_IDX(target->family);
+	t_tx_key *key = &state->ts.tx_map[f][state->ts.tx_key[f] & state->deadlines.mask];
+	
+	packet->tx_stamp = sent_at;
+	packet->tx_key = state->ts.tx_key[f];
+	key->target = target - state->targets;
+	key->sequence = packet->sequence;
+	state->ts.tx_key[f]++;
+}
+
+/**
+ * @param state - ping state containing timestamp key maps
+ * @param family - family of the socket the message was read from
+ * @param msg - message read from the socket error queue
+ * 
+ * Replaces a probe's userspace send time with the kernel TX timestamp
+ * carried by an error queue message, matched through its timestamp key
+ */
+void handle_tx_timestamp(t_ping_state *state, int family, struct msghdr *msg) {
+	struct sock_extended_err *serr = NULL;
+	int64_t stamp = 0;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			struct scm_timestamping tss;
+			memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+			stamp = (int64_t)tss.ts[0].tv_sec * NSEC_PER_SEC + tss.ts[0].tv_nsec;
+		} else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+				   (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+			serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+		}
+	}
+
+	if (!serr || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || stamp == 0) {
+		return;
+	}
+	t_tx_key *key = &state->ts.tx_map[FAMILY_IDX(family)][serr->ee_data & state->deadlines.mask];
+	t_packet_entry *entry = find_packet(&state->targets[key->target], key->sequence);
+	if (entry && entry->tx_key == serr->ee_data) {
+		entry->tx_stamp = stamp;
+	}
+}
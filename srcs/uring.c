@@ -0,0 +1,732 @@
+#include "../includes/ft_ping.h"
+
+// Kind of request a completion belongs to, kept in the top half of user_data
+#define URING_RECV 1		// multishot receive on a socket
+#define URING_ERRPOLL 2		// multishot poll for a socket's error queue
+#define URING_ERRQUEUE 3	// one error queue read
+#define URING_SEND 4		// one probe of a linked send chain
+#define URING_SIGNAL 5		// multishot poll on the signalfd
+#define URING_STOP 6		// multishot poll on the shard stop descriptor
+#define URING_STATUS 7		// multishot poll on the shard status descriptor
+#define URING_METRICS 8		// one poll on a --metrics-listen descriptor, whose fd is the low half
+
+#define URING_TAG(kind, f, index) (((uint64_t)(kind) << 32) | ((uint64_t)(f) << 16) | (index))
+#define URING_KIND(data) ((int)((data) >> 32))
+#define URING_FAMILY(data) ((int)(((data) >> 16) & 0xFFFF))
+#define URING_INDEX(data) ((int)((data) & 0xFFFF))
+#define URING_FD(data) ((int)((data) & 0xFFFFFFFF))
+
+typedef struct s_errqueue {
+	struct msghdr			msgs[URING_ERRQUEUE_BATCH];
+	struct iovec			iovs[URING_ERRQUEUE_BATCH];
+	struct sockaddr_storage	addrs[URING_ERRQUEUE_BATCH];
+	char					*controls;	// RX_CONTROL_S bytes per read
+	char					*buffers;	// rx.buf_size bytes per read
+	int						pending;	// reads in flight
+	int						drained;	// a read of the current batch found the queue empty
+	int						again;		// the socket reported errors while reads were in flight
+} t_errqueue;
+
+struct s_uring {
+	int							fd;
+	void						*sq_ring;
+	size_t						sq_ring_size;
+	void						*cq_ring;
+	size_t						cq_ring_size;
+	struct io_uring_sqe			*sqes;
+	size_t						sqes_size;
+	unsigned					*sq_head;
+	unsigned					*sq_tail;
+	unsigned					*sq_array;
+	unsigned					sq_mask;
+	unsigned					*cq_head;
+	unsigned					*cq_tail;
+	unsigned					cq_mask;
+	struct io_uring_cqe			*cqes;
+	unsigned					to_submit;	// queued submissions not yet handed to the kernel
+	struct io_uring_buf_ring	*buf_rings[2];	// provided receive buffers, by FAMILY_IDX
+	char						*buffers[2];
+	size_t						buf_size;	// recvmsg header, name, control and payload
+	struct msghdr				recv_msgs[2];	// layout of the multishot receives
+	t_errqueue					errqueue[2];
+	struct io_uring_cqe			*deferred;	// completions put aside while reaping sends
+	size_t						ndeferred;
+	size_t						deferred_cap;
+	int							sends;		// send completions still to reap
+	int							results[SEND_BATCH];
+	int							stop;		// a signal or the stop descriptor fired
+};
+
+/**
+ * @param state - ping state counting syscalls
+ * @param uring - ring to enter
+ * @param min_complete - completions to wait for
+ * @param timeout - relative time to wait at most, NULL to wait indefinitely
+ * @return number of submissions consumed, -1 with errno set on failure
+ *
+ * Submits every queued request and optionally waits for completions with a
+ * single io_uring_enter()
+ */
+static int uring_enter(t_ping_state *state, t_uring *uring, unsigned min_complete, struct timespec *timeout) {
+	struct io_uring_getevents_arg arg = {
+		.sigmask = 0,
+		.sigmask_sz = _NSIG / 8,
+		.ts = (uint64_t)(uintptr_t)timeout,
+	};
+	unsigned flags = IORING_ENTER_EXT_ARG;
+
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+	state->io.syscalls++;
+	int ret = syscall(__NR_io_uring_enter, uring->fd, uring->to_submit, min_complete,
+					  flags, &arg, sizeof(arg));
+	if (ret >= 0) {
+		uring->to_submit -= MIN((unsigned)ret, uring->to_submit);
+	}
+	return ret;
+}
+
+/**
+ * @param state - ping state counting syscalls
+ * @param uring - ring to take a submission entry from
+ * @return zeroed submission entry, queued for the next io_uring_enter()
+ *
+ * Submits what is queued first when the submission queue is full
+ */
+static struct io_uring_sqe *uring_sqe(t_ping_state *state, t_uring *uring) {
+	unsigned tail = *uring->sq_tail;
+
+	while (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) > uring->sq_mask) {
+		uring_enter(state, uring, 0, NULL);
+	}
+	struct io_uring_sqe *sqe = &uring->sqes[tail & uring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	uring->sq_array[tail & uring->sq_mask] = tail & uring->sq_mask;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->to_submit++;
+	return sqe;
+}
+
+/**
+ * @param state - ping state containing the sockets
+ * @param f - family index of the socket
+ *
+ * Arms a multishot receive that picks buffers from the socket's buffer ring
+ * and completes once per datagram until it runs out of buffers
+ */
+static void arm_receive(t_ping_state *state, int f) {
+	t_uring *uring = state->io.uring;
+	struct io_uring_sqe *sqe = uring_sqe(state, uring);
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = (f == 0) ? state->conn.ipv4.sockfd : state->conn.ipv6.sockfd;
+	sqe->addr = (uint64_t)(uintptr_t)&uring->recv_msgs[f];
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = f;
+	sqe->user_data = URING_TAG(URING_RECV, f, 0);
+}
+
+/**
+ * @param state - ping state containing the event loop descriptors
+ * @param fd - descriptor to watch
+ * @param events - poll events to report
+ * @param tag - user_data of the completions
+ */
+static void arm_poll(t_ping_state *state, int fd, unsigned events, uint64_t tag) {
+	struct io_uring_sqe *sqe = uring_sqe(state, state->io.uring);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = tag;
+}
+
+/**
+ * @param state - ping state containing the io_uring state
+ * @param fd - descriptor to watch
+ * @param events - POLLIN or POLLOUT
+ *
+ * One-shot counterpart of arm_poll() for watch_once()
+ */
+void uring_watch_once(t_ping_state *state, int fd, uint32_t events) {
+	struct io_uring_sqe *sqe = uring_sqe(state, state->io.uring);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = ((uint64_t)URING_METRICS << 32) | (uint32_t)fd;
+}
+
+/**
+ * @param state - ping state containing the sockets
+ * @param f - family index of the socket whose error queue to read
+ *
+ * Queues a batch of non-blocking error queue reads. The kernel returns TX
+ * timestamps there, and ICMP errors on datagram sockets; reading them through
+ * the ring costs no syscall of its own
+ */
+static void read_errqueue(t_ping_state *state, int f) {
+	t_uring *uring = state->io.uring;
+	t_errqueue *queue = &uring->errqueue[f];
+
+	queue->drained = 0;
+	queue->again = 0;
+	for (int i = 0; i < URING_ERRQUEUE_BATCH; i++) {
+		struct msghdr *msg = &queue->msgs[i];
+		memset(msg, 0, sizeof(*msg));
+		queue->iovs[i].iov_base = queue->buffers + i * state->rx.buf_size;
+		queue->iovs[i].iov_len = state->rx.buf_size;
+		msg->msg_name = &queue->addrs[i];
+		msg->msg_namelen = sizeof(struct sockaddr_storage);
+		msg->msg_iov = &queue->iovs[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = queue->controls + i * RX_CONTROL_S;
+		msg->msg_controllen = RX_CONTROL_S;
+
+		struct io_uring_sqe *sqe = uring_sqe(state, uring);
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = (f == 0) ? state->conn.ipv4.sockfd : state->conn.ipv6.sockfd;
+		sqe->addr = (uint64_t)(uintptr_t)msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_ERRQUEUE | MSG_DONTWAIT;
+		sqe->user_data = URING_TAG(URING_ERRQUEUE, f, i);
+		queue->pending++;
+	}
+}
+
+/**
+ * @param uring - ring owning the buffer ring
+ * @param f - family index of the buffer ring
+ * @param bid - buffer to give back to the kernel
+ */
+static void recycle_buffer(t_uring *uring, int f, uint16_t bid) {
+	struct io_uring_buf_ring *ring = uring->buf_rings[f];
+	uint16_t tail = ring->tail;
+	struct io_uring_buf *buf = &ring->bufs[tail & (URING_BUFFERS - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)(uring->buffers[f] + (size_t)bid * uring->buf_size);
+	buf->len = uring->buf_size;
+	buf->bid = bid;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @param state - ping state counting syscalls
+ * @param uring - ring to register the buffers with
+ * @param f - family index, also the buffer group id
+ * @return 0 on success, -1 with errno set on failure
+ *
+ * Registers a ring of URING_BUFFERS provided buffers the multishot receive of
+ * the family's socket fills, each large enough for one datagram with its
+ * recvmsg header, sender address and control data
+ */
+static int register_buffers(t_ping_state *state, t_uring *uring, int f) {
+	size_t ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+
+	uring->buf_rings[f] = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+							   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	uring->buffers[f] = malloc(URING_BUFFERS * uring->buf_size);
+	if (uring->buf_rings[f] == MAP_FAILED || !uring->buffers[f]) {
+		uring->buf_rings[f] = NULL;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uint64_t)(uintptr_t)uring->buf_rings[f],
+		.ring_entries = URING_BUFFERS,
+		.bgid = f,
+	};
+	state->io.syscalls++;
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		munmap(uring->buf_rings[f], ring_size);
+		uring->buf_rings[f] = NULL;
+		return -1;
+	}
+	uring->buf_rings[f]->tail = 0;
+	for (uint16_t bid = 0; bid < URING_BUFFERS; bid++) {
+		recycle_buffer(uring, f, bid);
+	}
+
+	struct msghdr *msg = &uring->recv_msgs[f];
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_namelen = sizeof(struct sockaddr_storage);
+	msg->msg_controllen = RX_CONTROL_S;
+	return 0;
+}
+
+/**
+ * @param uring - ring to map
+ * @param params - parameters returned by io_uring_setup()
+ * @return 0 on success, -1 on failure
+ *
+ * Maps the submission and completion rings and the submission entries
+ */
+static int map_rings(t_uring *uring, struct io_uring_params *params) {
+	uring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+	uring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+	if (params->features & IORING_FEAT_SINGLE_MMAP) {
+		uring->sq_ring_size = MAX(uring->sq_ring_size, uring->cq_ring_size);
+		uring->cq_ring_size = uring->sq_ring_size;
+	}
+	uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+						  MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->sq_ring == MAP_FAILED) {
+		uring->sq_ring = NULL;
+		return -1;
+	}
+	if (params->features & IORING_FEAT_SINGLE_MMAP) {
+		uring->cq_ring = uring->sq_ring;
+	} else {
+		uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+							  MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+		if (uring->cq_ring == MAP_FAILED) {
+			uring->cq_ring = NULL;
+			return -1;
+		}
+	}
+	uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		return -1;
+	}
+
+	char *sq = uring->sq_ring;
+	char *cq = uring->cq_ring;
+	uring->sq_head = (unsigned*)(sq + params->sq_off.head);
+	uring->sq_tail = (unsigned*)(sq + params->sq_off.tail);
+	uring->sq_mask = *(unsigned*)(sq + params->sq_off.ring_mask);
+	uring->sq_array = (unsigned*)(sq + params->sq_off.array);
+	uring->cq_head = (unsigned*)(cq + params->cq_off.head);
+	uring->cq_tail = (unsigned*)(cq + params->cq_off.tail);
+	uring->cq_mask = *(unsigned*)(cq + params->cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*)(cq + params->cq_off.cqes);
+	return 0;
+}
+
+/**
+ * @param uring - ring to create
+ * @return 0 on success, -1 with errno set on failure
+ *
+ * Creates the ring with a completion queue large enough for reply bursts,
+ * asking for cooperative task running where the kernel supports it
+ */
+static int setup_ring(t_uring *uring) {
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = URING_CQ_ENTRIES;
+	uring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (uring->fd < 0 && errno == EINVAL) {
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = URING_CQ_ENTRIES;
+		uring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	}
+	if (uring->fd < 0) {
+		return -1;
+	}
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	return map_rings(uring, &params);
+}
+
+/**
+ * @param state - ping state containing sockets, signal and shard descriptors
+ * @return 0 on success, 1 if io_uring is unavailable
+ *
+ * Sets up the io_uring backend: one ring, a provided buffer ring per socket
+ * filled by multishot receives, multishot polls for the error queues, the
+ * signalfd and the shard stop and status descriptors. Everything is armed once here, the
+ * loop then only resubmits what the kernel terminates
+ */
+int init_uring(t_ping_state *state) {
+	t_uring *uring = calloc(1, sizeof(t_uring));
+
+	if (!uring) {
+		errno = ENOMEM;
+		return 1;
+	}
+	state->io.uring = uring;
+	uring->fd = -1;
+	uring->buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) +
+					  RX_CONTROL_S + state->rx.buf_size;
+	uring->buf_size = (uring->buf_size + 15) & ~(size_t)15; // keeps every buffer's headers aligned
+	if (setup_ring(uring) < 0 ||
+		register_buffers(state, uring, 0) < 0 ||
+		register_buffers(state, uring, 1) < 0) {
+		int err = errno;
+		cleanup_uring(state);
+		errno = err;
+		return 1;
+	}
+
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+	for (int f = 0; f < 2; f++) {
+		t_errqueue *queue = &uring->errqueue[f];
+		queue->controls = malloc(URING_ERRQUEUE_BATCH * RX_CONTROL_S);
+		queue->buffers = malloc(URING_ERRQUEUE_BATCH * state->rx.buf_size);
+		if (!queue->controls || !queue->buffers) {
+			cleanup_uring(state);
+			errno = ENOMEM;
+			return 1;
+		}
+		arm_receive(state, f);
+		arm_poll(state, sockets[f], POLLERR, URING_TAG(URING_ERRPOLL, f, 0));
+	}
+	if (state->loop.signal_fd >= 0) {
+		arm_poll(state, state->loop.signal_fd, POLLIN, URING_TAG(URING_SIGNAL, 0, 0));
+	}
+	if (state->shard.stop_fd >= 0) {
+		arm_poll(state, state->shard.stop_fd, POLLIN, URING_TAG(URING_STOP, 0, 0));
+	}
+	if (state->shard.status_fd >= 0) {
+		arm_poll(state, state->shard.status_fd, POLLIN, URING_TAG(URING_STATUS, 0, 0));
+	}
+	if (uring_enter(state, uring, 0, NULL) < 0) {
+		int err = errno;
+		cleanup_uring(state);
+		errno = err;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the io_uring state
+ *
+ * Unmaps the rings, frees the buffers and closes the ring, which also cancels
+ * every request still armed
+ */
+void cleanup_uring(t_ping_state *state) {
+	t_uring *uring = state->io.uring;
+
+	if (!uring) {
+		return;
+	}
+	if (uring->fd >= 0) {
+		close(uring->fd);
+	}
+	for (int f = 0; f < 2; f++) {
+		if (uring->buf_rings[f]) {
+			munmap(uring->buf_rings[f], URING_BUFFERS * sizeof(struct io_uring_buf));
+		}
+		free(uring->buffers[f]);
+		free(uring->errqueue[f].controls);
+		free(uring->errqueue[f].buffers);
+	}
+	if (uring->sqes) {
+		munmap(uring->sqes, uring->sqes_size);
+	}
+	if (uring->cq_ring && uring->cq_ring != uring->sq_ring) {
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	}
+	if (uring->sq_ring) {
+		munmap(uring->sq_ring, uring->sq_ring_size);
+	}
+	free(uring->deferred);
+	free(uring);
+	state->io.uring = NULL;
+}
+
+/**
+ * @param uring - ring to put the completion aside in
+ * @param cqe - completion that cannot be handled yet
+ *
+ * Keeps a completion for the loop while sends are being reaped, replies to
+ * probes that are not accounted as sent yet must not be matched
+ */
+static void defer_completion(t_uring *uring, struct io_uring_cqe *cqe) {
+	if (uring->ndeferred == uring->deferred_cap) {
+		size_t cap = uring->deferred_cap ? uring->deferred_cap * 2 : URING_ENTRIES;
+		struct io_uring_cqe *deferred = realloc(uring->deferred, cap * sizeof(*deferred));
+		if (!deferred) {
+			fprintf(stderr, "malloc failed for io_uring completions\n");
+			return;
+		}
+		uring->deferred = deferred;
+		uring->deferred_cap = cap;
+	}
+	uring->deferred[uring->ndeferred++] = *cqe;
+}
+
+/**
+ * @param state - ping state containing packet tracking and statistics
+ * @param cqe - completion of a multishot receive
+ * @param returned_at - time the completions were reaped
+ *
+ * Hands the datagram in the selected buffer to the common receive path and
+ * gives the buffer back. A receive the kernel terminated is armed again
+ */
+static void complete_receive(t_ping_state *state, struct io_uring_cqe *cqe, int64_t returned_at) {
+	t_uring *uring = state->io.uring;
+	int f = URING_FAMILY(cqe->user_data);
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		char *buf = uring->buffers[f] + (size_t)bid * uring->buf_size;
+		struct msghdr *layout = &uring->recv_msgs[f];
+
+		if (cqe->res >= (int)sizeof(struct io_uring_recvmsg_out)) {
+			struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out*)buf;
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name = buf + sizeof(*out);
+			msg.msg_namelen = out->namelen;
+			msg.msg_control = (char*)msg.msg_name + layout->msg_namelen;
+			msg.msg_controllen = out->controllen;
+			char *payload = (char*)msg.msg_control + layout->msg_controllen;
+			size_t len = MIN(out->payloadlen, cqe->res - (size_t)(payload - buf));
+			handle_datagram(state, f, &msg, payload, len, returned_at);
+		}
+		recycle_buffer(uring, f, bid);
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+			fprintf(stderr, "ft_ping: io_uring multishot receive: %s\n", strerror(-cqe->res));
+			uring->stop = 1;
+			return;
+		}
+		arm_receive(state, f);
+	}
+}
+
+/**
+ * @param state - ping state containing packet tracking
+ * @param cqe - completion of an error queue read
+ *
+ * Processes the message read, and once the whole batch of reads completed
+ * queues another one unless the error queue was found empty
+ */
+static void complete_errqueue(t_ping_state *state, struct io_uring_cqe *cqe) {
+	int f = URING_FAMILY(cqe->user_data);
+	t_errqueue *queue = &state->io.uring->errqueue[f];
+
+	if (cqe->res >= 0) {
+		handle_queued_message(state, (f == 0) ? AF_INET : AF_INET6,
+							  &queue->msgs[URING_INDEX(cqe->user_data)], cqe->res);
+	} else {
+		queue->drained = 1;
+	}
+	if (--queue->pending == 0 && (!queue->drained || queue->again)) {
+		read_errqueue(state, f);
+	}
+}
+
+/**
+ * @param state - ping state containing the io_uring state
+ * @param cqe - completion to handle
+ * @param returned_at - time the completions were reaped
+ */
+static void complete(t_ping_state *state, struct io_uring_cqe *cqe, int64_t returned_at) {
+	t_uring *uring = state->io.uring;
+	int f = URING_FAMILY(cqe->user_data);
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+
+	switch (URING_KIND(cqe->user_data)) {
+		case URING_RECV:
+			complete_receive(state, cqe, returned_at);
+			break;
+		case URING_ERRQUEUE:
+			complete_errqueue(state, cqe);
+			break;
+		case URING_ERRPOLL:
+			if (uring->errqueue[f].pending > 0) {
+				uring->errqueue[f].again = 1;
+			} else {
+				read_errqueue(state, f);
+			}
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				arm_poll(state, sockets[f], POLLERR, cqe->user_data);
+			}
+			break;
+		case URING_SIGNAL:
+			if (handleSignals(state)) {
+				uring->stop = 1;
+			}
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				arm_poll(state, state->loop.signal_fd, POLLIN, cqe->user_data);
+			}
+			break;
+		case URING_STOP:
+			uring->stop = 1;
+			break;
+		case URING_STATUS:
+			handle_status_request(state);
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				arm_poll(state, state->shard.status_fd, POLLIN, cqe->user_data);
+			}
+			break;
+		case URING_METRICS:
+			handle_metrics(state, URING_FD(cqe->user_data));
+			break;
+	}
+}
+
+/**
+ * @param state - ping state containing the io_uring state
+ * @param sends_only - put every completion but sends aside
+ *
+ * Consumes the completion queue: send results are recorded, the rest is
+ * handled, or deferred while a send chain is being reaped. Error queue reads
+ * go first, so a reply never sees its probe before the probe's TX timestamp
+ */
+static void reap_completions(t_ping_state *state, int sends_only) {
+	t_uring *uring = state->io.uring;
+	unsigned head = *uring->cq_head;
+	unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	int64_t returned_at = timestamp_now(state);
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (unsigned i = head; i != tail; i++) {
+			struct io_uring_cqe *cqe = &uring->cqes[i & uring->cq_mask];
+			int kind = URING_KIND(cqe->user_data);
+			if ((pass == 0) != (kind == URING_SEND || kind == URING_ERRQUEUE)) {
+				continue;
+			}
+			if (kind == URING_SEND) {
+				uring->results[URING_INDEX(cqe->user_data)] = cqe->res;
+				uring->sends--;
+			} else if (sends_only) {
+				defer_completion(uring, cqe);
+			} else {
+				complete(state, cqe, returned_at);
+			}
+		}
+	}
+	__atomic_store_n(uring->cq_head, head + (tail - head), __ATOMIC_RELEASE);
+}
+
+/**
+ * @param state - ping state containing the io_uring state
+ *
+ * Handles the completions put aside while sends were reaped, error queue reads
+ * first like in reap_completions()
+ */
+static void complete_deferred(t_ping_state *state) {
+	t_uring *uring = state->io.uring;
+	int64_t returned_at = timestamp_now(state);
+	size_t count = uring->ndeferred;
+
+	uring->ndeferred = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < count; i++) {
+			if ((pass == 0) == (URING_KIND(uring->deferred[i].user_data) == URING_ERRQUEUE)) {
+				complete(state, &uring->deferred[i], returned_at);
+			}
+		}
+	}
+}
+
+/**
+ * @param state - ping state containing the io_uring state
+ * @param sockfd - socket to send through
+ * @param msgs - messages to send
+ * @param count - number of messages, at most SEND_BATCH
+ * @return number of messages sent, -1 with errno set if the first one failed
+ *
+ * Sends a batch as one chain of linked sendmsg requests with a single
+ * io_uring_enter(), mirroring sendmmsg(): a failure cancels the rest of the
+ * chain, so the probes sent are always a prefix of the batch. Error queue reads
+ * queued behind the chain pick up the TX timestamps in the same call
+ */
+int uring_sendmmsg(t_ping_state *state, int sockfd, struct mmsghdr *msgs, int count) {
+	t_uring *uring = state->io.uring;
+	int f = (sockfd == state->conn.ipv4.sockfd) ? 0 : 1;
+
+	for (int i = 0; i < count; i++) {
+		struct io_uring_sqe *sqe = uring_sqe(state, uring);
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = sockfd;
+		sqe->addr = (uint64_t)(uintptr_t)&msgs[i].msg_hdr;
+		sqe->len = 1;
+		sqe->flags = (i + 1 < count) ? IOSQE_IO_LINK : 0;
+		sqe->user_data = URING_TAG(URING_SEND, 0, i);
+		uring->results[i] = -ECANCELED;
+	}
+	if (state->ts.source == TS_KERNEL && uring->errqueue[f].pending == 0) {
+		read_errqueue(state, f);
+	}
+	uring->sends = count;
+	while (uring->sends > 0) {
+		if (uring_enter(state, uring, 1, NULL) < 0 && errno != EINTR) {
+			return -1;
+		}
+		reap_completions(state, 1);
+	}
+
+	int sent = 0;
+	while (sent < count && uring->results[sent] >= 0) {
+		sent++;
+	}
+	if (sent == 0) {
+		errno = -uring->results[0];
+		return -1;
+	}
+	return sent;
+}
+
+/**
+ * @param state - ping state with sockets, packet system, schedule and io_uring initialized
+ * @return 0 on success, 1 if some probes could not be sent
+ *
+ * Completion based counterpart of run_event_loop(): send what is due, then one
+ * io_uring_enter() submits whatever was rearmed and sleeps until a completion
+ * arrives or the next send or expiry is due. Replies land in provided buffers
+ * without a receive syscall each
+ */
+int run_uring_loop(t_ping_state *state) {
+	t_uring *uring = state->io.uring;
+	int ret = 0;
+
+	while (!uring->stop && (!state->sched.transmission_complete || state->sched.in_flight > 0)) {
+		ret = send_ping(state);
+
+		if (uring->ndeferred > 0) {
+			complete_deferred(state);
+		}
+
+		int64_t wake = next_wakeup(state);
+		int64_t now = now_ns();
+		struct timespec timeout = {0, 0};
+		if (wake > now && wake != INT64_MAX) {
+			timeout.tv_sec = (wake - now) / NSEC_PER_SEC;
+			timeout.tv_nsec = (wake - now) % NSEC_PER_SEC;
+		}
+		int ready = *uring->cq_head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+		unsigned min_complete = (wake <= now || ready) ? 0 : 1;
+
+		if ((min_complete > 0 || uring->to_submit > 0) &&
+			uring_enter(state, uring, min_complete, (wake == INT64_MAX) ? NULL : &timeout) < 0 &&
+			errno != ETIME && errno != EINTR) {
+			fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+			break;
+		}
+		reap_completions(state, 0);
+		handle_timeouts(state);
+	}
+	return ret;
+}
+
+/**
+ * @param state - ping state containing the I/O backend in use
+ * @return human readable name of the I/O backend
+ */
+const char *io_backend_str(t_ping_state *state) {
+	if (state->io.backend == IO_SIM) {
+		return "sim (virtual clock, simulated network)";
+	}
+	return (state->io.backend == IO_URING) ?
+		   "io_uring (multishot receive, provided buffers, linked sends)" :
+		   "epoll (sendmmsg / recvmmsg)";
+}
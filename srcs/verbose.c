@@ -2,160 +2,423 @@
 
 
 /**
- * @param state - ping state containing statistics and target info
+ * @param stats - statistics containing RTT min and max
+ * @param percentile - percentile to report, 0-100
+ * @return RTT at the percentile in milliseconds, clamped to the observed range
+ */
+static double percentile_ms(t_ping_stats *stats, double percentile) {
+	double rtt = histogram_percentile(&stats->rtt_hist, percentile) / (double)NSEC_PER_MSEC;
+	if (rtt < stats->min_rtt) {
+		return stats->min_rtt;
+	}
+	return (rtt > stats->max_rtt) ? stats->max_rtt : rtt;
+}
+
+/**
+ * @param name - target name shown in the header
+ * @param stats - statistics of the target
  * 
- * Prints final ping statistics including packet loss and RTT measurements
+ * Prints one target's statistics including packet loss and RTT measurements
  */
-void print_stats(t_ping_state *state) {
+static void print_target_stats(const char *name, t_ping_stats *stats) {
 	double total_time = 0.0;
-	if (state->stats.packets_sent > 0) {
-		if (state->stats.packets_sent == 1) {
-			total_time = 0.0;
-		} else {
-			total_time = (state->stats.last_packet_time.tv_sec - state->stats.first_packet_time.tv_sec) * 1000.0 + 
-						 (state->stats.last_packet_time.tv_usec - state->stats.first_packet_time.tv_usec) / 1000.0;
-		}
+	if (stats->packets_sent > 1) {
+		total_time = (stats->last_packet_time.tv_sec - stats->first_packet_time.tv_sec) * 1000.0 + 
+					 (stats->last_packet_time.tv_usec - stats->first_packet_time.tv_usec) / 1000.0;
 	}
+	double loss = (stats->packets_sent > 0) ? 
+				  ((double)(stats->packets_sent - stats->packets_received) / stats->packets_sent) * 100.0 : 0.0;
 
-	fprintf(stdout, "\n--- %s ping statistics ---\n", state->conn.target);
+	fprintf(stdout, "\n--- %s ping statistics ---\n", name);
 	fprintf(stdout, "%ld packets transmitted, %ld received, %.0f%% packet loss, time %.0fms\n",
-		   state->stats.packets_sent, state->stats.packets_received,
-		   ((double)(state->stats.packets_sent - state->stats.packets_received) / 
-			state->stats.packets_sent) * 100.0, total_time);
+		   stats->packets_sent, stats->packets_received, loss, total_time);
 	
-	if (state->stats.packets_received > 0) {
-		state->stats.avg_rtt = state->stats.sum_rtt / state->stats.packets_received;
-		if (state->stats.avg_rtt > 0) {
-			double mdev = calculate_mean_deviation(state);
-			fprintf(stdout, "rtt min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f ms\n", 
-				state->stats.min_rtt, state->stats.avg_rtt, state->stats.max_rtt, mdev); 
+	if (stats->rtt_count > 0) {
+		stats->avg_rtt = stats->rtt_mean;
+		double mdev = calculate_mean_deviation(stats);
+		fprintf(stdout, "rtt min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f ms\n", 
+			stats->min_rtt, stats->avg_rtt, stats->max_rtt, mdev); 
+		fprintf(stdout, "rtt p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+			percentile_ms(stats, 50.0), percentile_ms(stats, 90.0),
+			percentile_ms(stats, 99.0), percentile_ms(stats, 99.9));
+	}
+	if (stats->errors > 0) {
+		fprintf(stdout, "+%d errors.\n", stats->errors);
+	}
+}
+
+/**
+ * @param state - ping state containing the send schedule and its statistics
+ * @param out - stream to print to
+ * 
+ * Prints how closely sends tracked the schedule: the nominal rate, the rate
+ * achieved between the first and the last probe, and how late probes left
+ * after their slot, in microseconds
+ */
+static void print_send_jitter(t_ping_state *state, FILE *out) {
+	double nominal = (state->opts.rate > 0.0) ? state->opts.rate :
+					 state->ntargets * 1000000.0 / state->opts.interval;
+	double elapsed = (state->stats.last_packet_time.tv_sec - state->stats.first_packet_time.tv_sec) +
+					 (state->stats.last_packet_time.tv_usec - state->stats.first_packet_time.tv_usec) / 1000000.0;
+	double achieved = (elapsed > 0.0) ? (state->stats.packets_sent - 1) / elapsed : 0.0;
+	long count = state->send_jitter.count;
+	char burst[32] = "";
+
+	if (state->opts.rate > 0.0) {
+		snprintf(burst, sizeof(burst), " (burst %ld)", state->opts.burst);
+	}
+	fprintf(out, "ping: send schedule %.1f pps%s, achieved %.1f pps, late avg/p99/max/sd = %.1f/%.1f/%.1f/%.1f us\n",
+		nominal, burst, achieved, state->send_jitter.mean / NSEC_PER_USEC,
+		MIN(histogram_percentile(&state->send_jitter.hist, 99.0), state->send_jitter.max) / (double)NSEC_PER_USEC,
+		state->send_jitter.max / (double)NSEC_PER_USEC, sqrt(state->send_jitter.m2 / count) / NSEC_PER_USEC);
+}
+
+/**
+ * @param state - ping state containing statistics and target info
+ * 
+ * Prints final ping statistics of every target, followed by the totals
+ * when more than one target was probed, and the kernel filter counters
+ * in verbose mode, the ICMP messages dropped on a bad checksum and the records
+ * the -A writer dropped. The send schedule
+ * statistics follow with -v or --rate. Structured formats
+ * get summary records instead, with the totals under target "*" and the
+ * verbose counters moved to stderr
+ */
+void print_stats(t_ping_state *state) {
+	FILE *out = (state->opts.format == OUTPUT_TEXT) ? stdout : stderr;
+
+	if (state->opts.format != OUTPUT_TEXT) {
+		for (size_t i = 0; i < state->ntargets; i++) {
+			output_summary(state, state->targets[i].name, &state->targets[i].stats);
+		}
+		if (state->ntargets > 1) {
+			output_summary(state, "*", &state->stats);
+		}
+		output_flush(state);
+	} else {
+		for (size_t i = 0; i < state->ntargets; i++) {
+			print_target_stats(state->targets[i].name, &state->targets[i].stats);
+		}
+		if (state->ntargets > 1) {
+			char name[32];
+			snprintf(name, sizeof(name), "%zu targets", state->ntargets);
+			print_target_stats(name, &state->stats);
 		}
 	}
-	if (state->stats.errors > 0) {
-		fprintf(stdout, "+%d errors.\n", state->stats.errors);
+	if (state->opts.verbose && state->filter.attached) {
+		fprintf(out, "ping: socket filter rejected %llu foreign ICMP messages, %llu dropped on full receive buffer\n",
+			(unsigned long long)state->filter.rejected, (unsigned long long)state->filter.dropped);
+	}
+	if (state->io.bad_checksums > 0) {
+		fprintf(out, "ping: %llu ICMP messages dropped on a bad checksum\n",
+			(unsigned long long)state->io.bad_checksums);
+	}
+	if (state->writer.dropped > 0) {
+		fprintf(stderr, "ft_ping: output writer fell behind, %llu records dropped\n",
+			(unsigned long long)state->writer.dropped);
+	}
+	if (state->opts.verbose && state->stats.packets_sent > 0) {
+		fprintf(out, "ping: %s: %llu syscalls, %.2f per probe\n", io_backend_str(state),
+			(unsigned long long)state->io.syscalls, (double)state->io.syscalls / state->stats.packets_sent);
+	}
+	if ((state->opts.verbose || state->opts.rate > 0.0) && state->send_jitter.count > 0) {
+		print_send_jitter(state, out);
+	}
+	if (state->opts.verbose && state->io.backend == IO_SIM) {
+		fprintf(out, "ping: sim: %llu replies lost, %llu duplicated, %llu reordered, %llu corrupted, %llu over the queue limit\n",
+			(unsigned long long)state->sim.lost, (unsigned long long)state->sim.duplicated,
+			(unsigned long long)state->sim.reordered, (unsigned long long)state->sim.corrupted,
+			(unsigned long long)state->sim.overflowed);
+	}
+}
+
+/**
+ * @param name - target name, NULL for the only target
+ * @param stats - statistics of the target
+ * 
+ * Prints a one line running summary like iputils on SIGQUIT, from counters
+ * kept up to date per reply so it costs the same however long the run
+ */
+static void print_target_status(const char *name, t_ping_stats *stats) {
+	char line[256];
+	int len = 0;
+	long loss = (stats->packets_sent > 0) ?
+				(stats->packets_sent - stats->packets_received) * 100 / stats->packets_sent : 0;
+
+	if (name) {
+		len += snprintf(line, sizeof(line), "%s: ", name);
+	}
+	len += snprintf(line + len, sizeof(line) - len, "%ld/%ld packets, %ld%% loss",
+		stats->packets_received, stats->packets_sent, loss);
+	if (stats->rtt_count > 0) {
+		snprintf(line + len, sizeof(line) - len, ", min/avg/ewma/max = %.3f/%.3f/%.3f/%.3f ms",
+			stats->min_rtt, stats->rtt_mean, stats->rtt_ewma, stats->max_rtt);
+	}
+	fprintf(stderr, "%s\n", line);
+}
+
+/**
+ * @param state - ping state containing statistics and target info
+ * 
+ * Prints the running summary of every target to stderr, named when there are
+ * several, then the totals. A -j shard only knows its own targets and leaves
+ * the totals out
+ */
+void print_status(t_ping_state *state) {
+	for (size_t i = 0; i < state->ntargets; i++) {
+		int named = (state->ntargets > 1 || state->shard.count > 1);
+		print_target_status(named ? state->targets[i].name : NULL, &state->targets[i].stats);
+	}
+	if (state->ntargets > 1 && state->shard.count == 1) {
+		char name[32];
+		snprintf(name, sizeof(name), "%zu targets", state->ntargets);
+		print_target_status(name, &state->stats);
 	}
 }
 
 /**
  * @param state - ping state containing verbose flag and socket info
  * 
- * Prints verbose socket and connection information when verbose flag is set
+ * Prints verbose socket and connection information when verbose flag is set,
+ * to stderr when stdout carries structured output
  */
 void print_verbose_info(t_ping_state *state) {
+	FILE *out = (state->opts.format == OUTPUT_TEXT) ? stdout : stderr;
+
 	if (!state->opts.verbose) {
 		return;
 	}
 	
-	int socktype;
-	socklen_t optlen = sizeof(socktype);
-	getsockopt(state->conn.ipv4.sockfd, SOL_SOCKET, SO_TYPE, &socktype, &optlen);
+	int socktypes[2];
+	int sockets[] = {state->conn.ipv4.sockfd, state->conn.ipv6.sockfd};
+	const char *socktype_strs[2];
+	for (int f = 0; f < 2; f++) {
+		socklen_t optlen = sizeof(socktypes[f]);
+		getsockopt(sockets[f], SOL_SOCKET, SO_TYPE, &socktypes[f], &optlen);
+		socktype_strs[f] = (socktypes[f] == SOCK_RAW) ? "SOCK_RAW" : 
+						   (socktypes[f] == SOCK_DGRAM) ? "SOCK_DGRAM" : "UNKNOWN";
+	}
 	
-	const char *socktype_str = (socktype == SOCK_RAW) ? "SOCK_RAW" : 
-							  (socktype == SOCK_DGRAM) ? "SOCK_DGRAM" : "UNKNOWN";
+	fprintf(out, "ping: sock4.fd: %d (socktype: %s), sock6.fd: %d (socktype: %s), hints.ai_family: AF_UNSPEC\n",
+		   sockets[0], socktype_strs[0], sockets[1], socktype_strs[1]);
 	
-	if (state->conn.target_family == AF_INET) {
-		fprintf(stdout, "ping: sock4.fd: %d (socktype: %s), sock6.fd: %d (socktype: SOCK_RAW), hints.ai_family: AF_UNSPEC\n",
-			   state->conn.ipv4.sockfd, socktype_str, state->conn.ipv6.sockfd);
-	} else {
-		fprintf(stdout, "ping: sock4.fd: %d (socktype: SOCK_RAW), sock6.fd: %d (socktype: %s), hints.ai_family: AF_UNSPEC\n",
-			   state->conn.ipv4.sockfd, state->conn.ipv6.sockfd, socktype_str);
+	for (size_t i = 0; i < state->ntargets; i++) {
+		const char *family_str = (state->targets[i].family == AF_INET) ? "AF_INET" : "AF_INET6";
+		fprintf(out, "\nai->ai_family: %s, ai->ai_canonname: '%s'\n",
+			   family_str, state->targets[i].name);
 	}
-	
-	const char *family_str = (state->conn.target_family == AF_INET) ? "AF_INET" : "AF_INET6";
-	fprintf(stdout, "\nai->ai_family: %s, ai->ai_canonname: '%s'\n",
-		   family_str, state->conn.target);
+	fprintf(out, "ping: icmp backend: %s\n", (state->conn.socktype == SOCK_DGRAM) ?
+		   "datagram (unprivileged ICMP sockets, kernel checksums and demultiplexes)" :
+		   "raw (userspace checksums, identifier filtered by socket filter)");
+	fprintf(out, "ping: io backend: %s\n", io_backend_str(state));
+	fprintf(out, "ping: rtt timestamps: %s\n", timestamp_source_str(state));
 }
 
 /**
- * @param state - ping state containing target and packet size info
+ * @param state - ping state containing targets and packet size info
  * 
- * Prints initial ping header with target address and packet size information
+ * Prints initial ping header with address and packet size information for each target,
+ * or the header row of the structured output format
  */
 void print_default_info(t_ping_state *state) {
-	size_t icmp_header_size = (state->conn.target_family == AF_INET) ? 
-							sizeof(struct icmphdr) : 
-							sizeof(struct icmp6_hdr);
-	size_t data_size = state->opts.psize - icmp_header_size;
-	
-	char *addr_str = (state->conn.target_family == AF_INET) ?
-					 state->conn.ipv4.addr_str : 
-					 state->conn.ipv6.addr_str;
+	size_t data_size = state->opts.psize - sizeof(struct icmphdr);
 	
-	if (state->conn.target_family == AF_INET) {
-		size_t total_with_ip = data_size + icmp_header_size + 20;
-		fprintf(stdout, "PING %s (%s) %zu(%zu) bytes of data.\n", 
-			state->conn.target, addr_str, 
-			data_size, total_with_ip);
-	} else {
-		fprintf(stdout, "PING %s (%s) %zu data bytes\n", 
-			state->conn.target, addr_str, data_size);
+	if (state->opts.format != OUTPUT_TEXT) {
+		output_header(state);
+		return;
+	}
+	for (size_t i = 0; i < state->ntargets; i++) {
+		t_target *target = &state->targets[i];
+		if (target->family == AF_INET) {
+			size_t total_with_ip = data_size + sizeof(struct icmphdr) + 20;
+			fprintf(stdout, "PING %s (%s) %zu(%zu) bytes of data.\n", 
+				target->name, target->addr_str, 
+				data_size, total_with_ip);
+		} else {
+			fprintf(stdout, "PING %s (%s) %zu data bytes\n", 
+				target->name, target->addr_str, data_size);
+		}
 	}
 }
 
 /**
- * @param state - ping state containing verbose flag and address info
- * @param icmp_size - size of received ICMP packet
- * @param icmp_header - ICMP header containing sequence and ID
- * @param ttl - time-to-live value
- * @param rtt - round-trip time in milliseconds
+ * @param state - ping state containing verbose flag and echo identifiers
+ * @param record - reply record
  * 
  * Prints formatted ping reply message with packet details
  */
-void print_ping_reply(t_ping_state *state, size_t icmp_size, 
-					 struct icmphdr *icmp_header, int ttl, double rtt) {
-	uint16_t sequence = ntohs(icmp_header->un.echo.sequence);
-	uint16_t id = ntohs(icmp_header->un.echo.id);
+static void print_reply_line(t_ping_state *state, t_probe_record *record) {
+	char *addr_str = record->target->addr_str;
+	int id = (record->target->family == AF_INET) ? state->conn.ipv4.pid : state->conn.ipv6.pid;
+	double rtt = record->rtt_ns / (double)NSEC_PER_MSEC;
 	
-	char *addr_str = (state->conn.target_family == AF_INET) ?
-					 state->conn.ipv4.addr_str : 
-					 state->conn.ipv6.addr_str;
-	
-	if (rtt >= 0.0) {
+	if (record->rtt_ns >= 0) {
 		if (state->opts.verbose) {
-			fprintf(stdout, "%zu bytes from %s: icmp_seq=%d ident=%d ttl=%d time=%.3f ms\n",
-					icmp_size, addr_str, sequence, id, ttl, rtt);
+			fprintf(stdout, "%u bytes from %s: icmp_seq=%d ident=%d ttl=%d time=%.3f ms\n",
+					record->size, addr_str, record->sequence, id, record->ttl, rtt);
 		} else {
-			fprintf(stdout, "%zu bytes from %s: icmp_seq=%d ttl=%d time=%.3f ms\n",
-					icmp_size, addr_str, sequence, ttl, rtt);
+			fprintf(stdout, "%u bytes from %s: icmp_seq=%d ttl=%d time=%.3f ms\n",
+					record->size, addr_str, record->sequence, record->ttl, rtt);
 		}
 	} else {
 		if (state->opts.verbose) {
-			fprintf(stdout, "%zu bytes from %s: icmp_seq=%d ident=%d ttl=%d\n",
-					icmp_size, addr_str, sequence, id, ttl);
+			fprintf(stdout, "%u bytes from %s: icmp_seq=%d ident=%d ttl=%d\n",
+					record->size, addr_str, record->sequence, id, record->ttl);
 		} else {
-			fprintf(stdout, "%zu bytes from %s: icmp_seq=%d ttl=%d\n",
-					icmp_size, addr_str, sequence, ttl);
+			fprintf(stdout, "%u bytes from %s: icmp_seq=%d ttl=%d\n",
+					record->size, addr_str, record->sequence, record->ttl);
 		}
 	}
 }
 
 /**
- * @param ctx - ICMP context containing error packet information
- * @param error_message - the error message to display
+ * @param record - error record containing the sender of the error
  * 
  * Prints formatted ICMP error message with sender address information
  */
-void print_icmp_error(t_icmp_context *ctx, const char *error_message) {
+static void print_error_line(t_probe_record *record) {
 	char hostname[NI_MAXHOST];
-	char sender_ip[INET_ADDRSTRLEN];
-	struct sockaddr_in *from_addr = (struct sockaddr_in*)ctx->from;
+	char sender_ip[INET6_ADDRSTRLEN];
+	const char *error_message = icmp_error_str(record->target->family, record->icmp_type);
+	socklen_t from_len = (record->from.sa.sa_family == AF_INET) ? 
+						 sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
 	
-	inet_ntop(AF_INET, &from_addr->sin_addr, sender_ip, INET_ADDRSTRLEN);
+	if (record->from.sa.sa_family == AF_INET) {
+		inet_ntop(AF_INET, &record->from.v4.sin_addr, sender_ip, sizeof(sender_ip));
+	} else {
+		inet_ntop(AF_INET6, &record->from.v6.sin6_addr, sender_ip, sizeof(sender_ip));
+	}
 	
-	if (getnameinfo((struct sockaddr*)from_addr, sizeof(*from_addr), 
+	if (getnameinfo(&record->from.sa, from_len, 
 					hostname, sizeof(hostname), NULL, 0, 0) == 0) {
 		fprintf(stdout, "From %s (%s): icmp_seq=%d %s\n", 
-			   hostname, sender_ip, ctx->sequence, error_message);
+			   hostname, sender_ip, record->sequence, error_message);
 	} else {
 		fprintf(stdout, "From %s: icmp_seq=%d %s\n", 
-			   sender_ip, ctx->sequence, error_message);
+			   sender_ip, record->sequence, error_message);
+	}
+}
+
+/**
+ * @param state - ping state containing the output format and flood flag
+ * @param record - probe result to print
+ * 
+ * Prints a probe result in the output format, on the probe loop or on the -A
+ * writer thread. Flood mode replaces reply lines with erased dots, and the
+ * text format stays silent about timeouts like iputils ping
+ */
+void print_record(t_ping_state *state, t_probe_record *record) {
+	if (state->opts.format != OUTPUT_TEXT) {
+		if (record->type != RECORD_FLOOD_MARK) {
+			output_record(state, record);
+		}
+		return;
+	}
+	if (record->type == RECORD_FLOOD_MARK || (record->type == RECORD_REPLY && state->opts.flood)) {
+		fputs((record->type == RECORD_REPLY || record->sequence) ? "\b \b" : ".", stdout);
+		if (!state->writer.ring) {
+			fflush(stdout);
+		}
+	} else if (record->type == RECORD_REPLY) {
+		print_reply_line(state, record);
+	} else if (record->type == RECORD_ERROR) {
+		print_error_line(record);
+	}
+}
+
+/**
+ * @param state - ping state containing the output settings
+ * @param target - target the reply came from
+ * @param icmp_size - size of received ICMP packet
+ * @param icmp_header - ICMP header containing the sequence
+ * @param ttl - time-to-live value
+ * @param rtt - round-trip time in milliseconds
+ * 
+ * Reports an echo reply
+ */
+void print_ping_reply(t_ping_state *state, t_target *target, size_t icmp_size, 
+					 struct icmphdr *icmp_header, int ttl, double rtt) {
+	t_probe_record record;
+	
+	memset(&record, 0, sizeof(record));
+	record.type = RECORD_REPLY;
+	record.target = target;
+	record.rtt_ns = (rtt >= 0.0) ? llround(rtt * NSEC_PER_MSEC) : -1;
+	record.size = icmp_size;
+	record.sequence = ntohs(icmp_header->un.echo.sequence);
+	record.ttl = ttl;
+	emit_record(state, &record);
+}
+
+/**
+ * @param state - ping state containing the output settings
+ * @param ctx - ICMP context containing error packet information
+ * @param type - ICMP or ICMPv6 error type
+ * @param code - ICMP or ICMPv6 error code
+ * 
+ * Reports an ICMP error returned for one of our probes
+ */
+void print_icmp_error(t_ping_state *state, t_icmp_context *ctx, uint8_t type, uint8_t code) {
+	t_probe_record record;
+	socklen_t from_len = (ctx->from->ss_family == AF_INET) ? 
+						 sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	
+	memset(&record, 0, sizeof(record));
+	record.type = RECORD_ERROR;
+	record.target = ctx->target;
+	memcpy(&record.from, ctx->from, from_len);
+	record.sequence = ctx->sequence;
+	record.ttl = -1;
+	record.icmp_type = type;
+	record.icmp_code = code;
+	emit_record(state, &record);
+}
+
+/**
+ * @param state - ping state containing the output settings and timeout option
+ * @param target - target the probe was sent to
+ * @param sequence - sequence number of the expired probe
+ * 
+ * Reports a probe that expired unanswered
+ */
+void print_timeout(t_ping_state *state, t_target *target, uint16_t sequence) {
+	t_probe_record record;
+	
+	if (state->opts.format == OUTPUT_TEXT) {
+		return;
+	}
+	memset(&record, 0, sizeof(record));
+	record.type = RECORD_TIMEOUT;
+	record.target = target;
+	record.timeout_ns = (int64_t)state->opts.timeout * NSEC_PER_SEC;
+	record.sequence = sequence;
+	record.ttl = -1;
+	emit_record(state, &record);
+}
+
+/**
+ * @param state - ping state containing flood flag
+ * @param reply - 0 when a probe was sent, 1 when a reply arrived
+ * 
+ * Prints a dot per probe sent and erases one per reply in flood mode,
+ * so the dots left on screen show the packets lost
+ */
+void print_flood_mark(t_ping_state *state, int reply) {
+	t_probe_record record;
+	
+	if (!state->opts.flood || state->opts.format != OUTPUT_TEXT) {
+		return;
 	}
+	memset(&record, 0, sizeof(record));
+	record.type = RECORD_FLOOD_MARK;
+	record.sequence = reply;
+	emit_record(state, &record);
 }
 
 void print_usage(char *arg, char opt) {
 	(void)opt;
 	//fprintf(stderr, "%s: usage error: Unknown option '-%c'\n", arg, opt);
-	fprintf(stdout, "Usage:\n %s [options] <destination>\n", arg);
+	fprintf(stdout, "Usage:\n %s [options] <destination> [destination...]\n", arg);
 	fprintf(stdout, "Options:\n");
 	fprintf(stdout, "  -v		Verbose output\n");
 	fprintf(stdout, "  -c <count> 	Stop after sending <count> packets\n");
@@ -163,4 +426,25 @@ void print_usage(char *arg, char opt) {
 	fprintf(stdout, "  -l <preload>	Preload <preload> packets before starting\n");
 	fprintf(stdout, "  -W <timeout>	Set timeout for each packet in seconds\n");
 	fprintf(stdout, "  -t <ttl>	Set time-to-live for packets\n");
+	fprintf(stdout, "  -i <interval>	Wait <interval> seconds between packets (microsecond resolution)\n");
+	fprintf(stdout, "  -F <file>	Read destinations from <file>, one per line\n");
+	fprintf(stdout, "  -j <threads>	Shard destinations across <threads> worker threads\n");
+	fprintf(stdout, "  -E <backend>	I/O backend: epoll (default), io_uring or sim (simulated network, no sockets)\n");
+	fprintf(stdout, "  -o <format>	Output format: text (default), json (JSON Lines) or csv\n");
+	fprintf(stdout, "  -A		Format and write output on a separate writer thread\n");
+	fprintf(stdout, "  --stats-interval <seconds>\n");
+	fprintf(stdout, "		Print a running summary every <seconds>, as on SIGQUIT\n");
+	fprintf(stdout, "  --shm <name>	Publish live statistics in /dev/shm/<name>\n");
+	fprintf(stdout, "  --metrics-listen <[address:]port>\n");
+	fprintf(stdout, "		Serve OpenMetrics on http://<address>:<port>/metrics (default address 127.0.0.1)\n");
+	fprintf(stdout, "  --pcap <file>	Capture every probe and received datagram to a pcapng file\n");
+	fprintf(stdout, "  --pcap-size <MiB>\n");
+	fprintf(stdout, "		Preallocate the capture file and write it through a mapping, up to <MiB>\n");
+	fprintf(stdout, "  --sim <key=value,...>\n");
+	fprintf(stdout, "		Run on the simulated network (-E sim) with delay, jitter, dist, loss, dup,\n");
+	fprintf(stdout, "		reorder, corrupt, seed and limit settings\n");
+	fprintf(stdout, "  --rate <pps>	Pace probes with a token bucket at <pps> probes per second across all\n");
+	fprintf(stdout, "		destinations, instead of -i\n");
+	fprintf(stdout, "  --burst <n>	Let --rate send up to <n> probes back to back to catch up (default 1)\n");
+	fprintf(stdout, "  -f		Flood ping, send as soon as replies arrive or 100 times per second\n");
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * @param state - ping state containing the writer ring
+ *
+ * Wakes the writer thread through its eventfd. A non-blocking eventfd write
+ * only adds to a counter, so the probe loop cannot block here
+ */
+static void wake_writer(t_ping_state *state) {
+	uint64_t one = 1;
+	ssize_t written = write(state->writer.wake_fd, &one, sizeof(one));
+	(void)written;
+	state->io.syscalls++;
+}
+
+/**
+ * @param state - ping state containing the writer ring and output buffer
+ * @return 1 if records were formatted, 0 if the ring was empty
+ *
+ * Formats every record queued so far. Each slot is handed back to the probe
+ * loop by a release store of head once it has been read
+ */
+static int drain_ring(t_ping_state *state) {
+	uint64_t head = state->writer.head;
+	uint64_t tail = __atomic_load_n(&state->writer.tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+		return 0;
+	}
+	for (; head != tail; head++) {
+		print_record(state, &state->writer.ring[head & (OUTPUT_RING_S - 1)]);
+		__atomic_store_n(&state->writer.head, head + 1, __ATOMIC_RELEASE);
+	}
+	return 1;
+}
+
+/**
+ * @param arg - ping state
+ * @return NULL
+ *
+ * Writer thread body: formats queued records and writes them, then sleeps
+ * until the probe loop finds the ring half full or OUTPUT_FLUSH_NS has passed.
+ * The sleeping flag is published before the ring is checked a last time, so
+ * the probe loop either sees it or its record is seen here
+ */
+static void *writer_thread(void *arg) {
+	t_ping_state *state = arg;
+	struct pollfd fds = {.fd = state->writer.wake_fd, .events = POLLIN};
+
+	while (1) {
+		int stop = __atomic_load_n(&state->writer.stop, __ATOMIC_ACQUIRE);
+		while (drain_ring(state)) {
+		}
+		if (state->opts.format == OUTPUT_TEXT) {
+			fflush(stdout);
+		} else {
+			output_flush(state);
+		}
+		if (stop) {
+			break;
+		}
+
+		__atomic_store_n(&state->writer.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&state->writer.tail, __ATOMIC_SEQ_CST) == state->writer.head &&
+			!__atomic_load_n(&state->writer.stop, __ATOMIC_SEQ_CST)) {
+			poll(&fds, 1, OUTPUT_FLUSH_NS / NSEC_PER_MSEC);
+		}
+		__atomic_store_n(&state->writer.sleeping, 0, __ATOMIC_SEQ_CST);
+		uint64_t wakes;
+		ssize_t got = read(state->writer.wake_fd, &wakes, sizeof(wakes));
+		(void)got;
+	}
+	return NULL;
+}
+
+/**
+ * @param state - ping state containing the output options
+ * @return 0 on success, 1 on failure
+ *
+ * With -A, moves formatting and writing of results to a writer thread fed by
+ * a single producer single consumer ring, so a slow stdout cannot stall the
+ * probe loop that owns this state
+ */
+int init_writer(t_ping_state *state) {
+	state->writer.wake_fd = -1;
+	if (!state->opts.async) {
+		return 0;
+	}
+	state->writer.ring = malloc(OUTPUT_RING_S * sizeof(t_probe_record));
+	state->writer.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!state->writer.ring || state->writer.wake_fd < 0) {
+		fprintf(stderr, "ft_ping: cannot set up the output writer\n");
+		return 1;
+	}
+	fflush(stdout);
+	int err = pthread_create(&state->writer.thread, NULL, writer_thread, state);
+	if (err != 0) {
+		fprintf(stderr, "ft_ping: pthread_create: %s\n", strerror(err));
+		return 1;
+	}
+	state->writer.started = 1;
+	return 0;
+}
+
+/**
+ * @param state - ping state containing the output settings
+ * @param record - probe result, stamped with the wall clock here
+ *
+ * Prints a probe result, or with -A queues it for the writer thread. A full
+ * ring drops the record and counts it rather than waiting for the writer
+ */
+void emit_record(t_ping_state *state, t_probe_record *record) {
+	record->time_ns = clock_wall(state);
+	if (!state->writer.ring) {
+		print_record(state, record);
+		return;
+	}
+
+	uint64_t tail = state->writer.tail;
+	uint64_t used = tail - __atomic_load_n(&state->writer.head, __ATOMIC_ACQUIRE);
+	if (used >= OUTPUT_RING_S) {
+		state->writer.dropped++;
+		return;
+	}
+	state->writer.ring[tail & (OUTPUT_RING_S - 1)] = *record;
+	__atomic_store_n(&state->writer.tail, tail + 1, __ATOMIC_SEQ_CST);
+	if (used + 1 >= OUTPUT_RING_S / 2 && __atomic_exchange_n(&state->writer.sleeping, 0, __ATOMIC_SEQ_CST)) {
+		wake_writer(state);
+	}
+}
+
+/**
+ * @param state - ping state containing the writer ring
+ *
+ * Tells the writer thread the probe loop is done, waits for it to format and
+ * write every queued record, and frees the ring. Safe to call more than once
+ */
+void stop_writer(t_ping_state *state) {
+	if (state->writer.started) {
+		__atomic_store_n(&state->writer.stop, 1, __ATOMIC_SEQ_CST);
+		wake_writer(state);
+		pthread_join(state->writer.thread, NULL);
+		state->writer.started = 0;
+	}
+	if (state->writer.wake_fd >= 0) {
+		close(state->writer.wake_fd);
+		state->writer.wake_fd = -1;
+	}
+	free(state->writer.ring);
+	state->writer.ring = NULL;
+}
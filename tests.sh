@@ -176,12 +176,13 @@ run_test "Count: invalid non-numeric" "./ft_ping -c abc $TARGET" "ping -c abc $T
 # PRELOAD FLAG TESTS (8 tests)
 echo -e "\n${BOLD}${YELLOW}📦 Testing PRELOAD FLAG (-l)${NC}"
 run_test "Preload: minimum (1)" "./ft_ping -l 1 -c 3 $TARGET" "ping -l 1 -c 3 $TARGET"
-run_test "Preload: maximum (3)" "./ft_ping -l 3 -c 5 $TARGET" "ping -l 3 -c 5 $TARGET"
+run_test "Preload: small burst (3)" "./ft_ping -l 3 -c 5 $TARGET" "ping -l 3 -c 5 $TARGET"
+run_test "Preload: large burst (200)" "./ft_ping -l 200 -c 200 $TARGET" "ping -l 200 -c 200 $TARGET"
 run_test "Preload: equals count" "./ft_ping -l 2 -c 2 $TARGET" "ping -l 2 -c 2 $TARGET"
 run_test "Preload: invalid zero" "./ft_ping -l 0 -c 3 $TARGET" "ping -l 0 -c 3 $TARGET" 1
 run_test "Preload: invalid negative" "./ft_ping -l -1 -c 3 $TARGET" "ping -l -1 -c 3 $TARGET" 1
 run_test "Preload: invalid large negative" "./ft_ping -l -10 -c 3 $TARGET" "ping -l -10 -c 3 $TARGET" 1
-run_test "Preload: invalid too high" "./ft_ping -l 5 -c 3 $TARGET" "ping -l 5 -c 3 $TARGET" 1
+run_test "Preload: invalid too high" "./ft_ping -l 65537 -c 3 $TARGET" "ping -l 65537 -c 3 $TARGET" 1
 run_test "Preload: invalid non-numeric" "./ft_ping -l abc -c 3 $TARGET" "ping -l abc -c 3 $TARGET" 1
 
 # VERBOSE FLAG TESTS (2 tests)
@@ -207,7 +208,7 @@ echo -e "\n${BOLD}${YELLOW}🚫 Testing ERROR HANDLING${NC}"
 run_test "Error: unknown flag" "./ft_ping -x $TARGET" "ping -x $TARGET" 1
 run_test "Error: missing target" "./ft_ping -c 2" "ping -c 2" 1
 run_test "Error: missing flag value" "./ft_ping -c $TARGET" "ping -c $TARGET" 1
-run_test "Error: multiple invalid flags" "./ft_ping -c 0 -W 0 -l 5 $TARGET" "ping -c 0 -W 0 -l 5 $TARGET" 1
+run_test "Error: multiple invalid flags" "./ft_ping -c 0 -W 0 -l 65537 $TARGET" "ping -c 0 -W 0 -l 65537 $TARGET" 1
 run_test "Error: flag without argument" "./ft_ping -s -c 1 $TARGET" "ping -s -c 1 $TARGET" 1
 
 # TTL TESTS (6 tests)
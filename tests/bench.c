@@ -0,0 +1,553 @@
+#include "../includes/ft_ping.h"
+
+#define BENCH_MIN_NS (200 * NSEC_PER_MSEC) // shortest timed run of one benchmark
+#define BENCH_REPLIES 4096 // replies per replay pass, at most one per table slot
+#define BENCH_TARGETS 64 // distinct sources replayed from a capture
+#define BENCH_PID 0x4242 // echo identifier of the replayed probes
+#define BENCH_RTT_NS (20 * NSEC_PER_MSEC) // base RTT of replayed replies
+#ifndef BENCH_CFLAGS
+# define BENCH_CFLAGS "unknown" // compiler flags of the benchmarked objects, set by the Makefile
+#endif
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 1
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D
+#define PCAPNG_INTERFACES 8 // ft_ping writes two
+
+typedef struct s_reply {
+	struct sockaddr_storage	from;
+	char					*data;		// what recvmmsg() returns: IPv4 with its header, IPv6 without
+	size_t					len;
+	size_t					target;		// index of the replying target
+	uint16_t				sequence;
+} t_reply;
+
+typedef struct s_replay {
+	t_reply		*replies;
+	size_t		count;
+	size_t		capacity;
+	char		*sources[BENCH_TARGETS];	// numeric addresses, in target order
+	size_t		nsources;
+} t_replay;
+
+typedef struct s_bench {
+	t_ping_state	*state;
+	t_replay		*replay;
+	int64_t			elapsed;	// ns spent in timed sections
+	uint64_t		allocs;		// allocations in timed sections
+	int64_t			started;
+	uint64_t		allocs_at;
+	uint64_t		unmatched;	// replayed replies parse_icmp_reply() rejected
+	uint64_t		sink;		// keeps results alive
+} t_bench;
+
+typedef void (*t_bench_fn)(t_bench *bench, uint64_t iterations);
+
+static uint64_t allocations;
+static FILE *report;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+static void bench_start(t_bench *bench) {
+	bench->allocs_at = allocations;
+	bench->started = now_ns();
+}
+
+static void bench_stop(t_bench *bench) {
+	bench->elapsed += now_ns() - bench->started;
+	bench->allocs += allocations - bench->allocs_at;
+}
+
+/**
+ * @param name - benchmark name
+ * @param size - payload size column, -1 for none
+ * @param bench - benchmark context
+ * @param fn - runs the given number of operations, timing only the measured part
+ *
+ * Doubles the iteration count until a run takes BENCH_MIN_NS, then reports that
+ * run per operation
+ */
+static void run_bench(const char *name, long size, t_bench *bench, t_bench_fn fn) {
+	uint64_t iterations = 1;
+
+	while (1) {
+		bench->elapsed = 0;
+		bench->allocs = 0;
+		bench->unmatched = 0;
+		fn(bench, iterations);
+		if (bench->elapsed >= BENCH_MIN_NS || iterations >= (1ULL << 40)) {
+			break;
+		}
+		iterations *= 2;
+	}
+	char column[24] = "-";
+	if (size >= 0) {
+		snprintf(column, sizeof(column), "%ld", size);
+	}
+	fprintf(report, "%-20s %6s %12llu %10.1f %10.3f\n", name, column, (unsigned long long)iterations,
+			(double)bench->elapsed / iterations, (double)bench->allocs / iterations);
+	if (bench->unmatched) {
+		fprintf(report, "%-20s %llu of %llu replies unmatched\n", "",
+				(unsigned long long)bench->unmatched, (unsigned long long)iterations);
+	}
+}
+
+/**
+ * @param replay - replay set to grow
+ * @return the new reply, NULL if out of memory
+ */
+static t_reply *add_reply(t_replay *replay) {
+	if (replay->count == replay->capacity) {
+		size_t capacity = replay->capacity ? replay->capacity * 2 : 64;
+		t_reply *replies = realloc(replay->replies, capacity * sizeof(t_reply));
+		if (!replies) {
+			return NULL;
+		}
+		replay->replies = replies;
+		replay->capacity = capacity;
+	}
+	t_reply *reply = &replay->replies[replay->count++];
+	memset(reply, 0, sizeof(*reply));
+	return reply;
+}
+
+/**
+ * @param replay - replay set the source is added to
+ * @param from - reply source address
+ * @return target index of the source, -1 if there are too many sources
+ */
+static long add_source(t_replay *replay, struct sockaddr_storage *from) {
+	char addr[INET6_ADDRSTRLEN];
+	const void *raw = (from->ss_family == AF_INET) ?
+					  (void*)&((struct sockaddr_in*)from)->sin_addr :
+					  (void*)&((struct sockaddr_in6*)from)->sin6_addr;
+
+	inet_ntop(from->ss_family, raw, addr, sizeof(addr));
+	for (size_t i = 0; i < replay->nsources; i++) {
+		if (strcmp(replay->sources[i], addr) == 0) {
+			return i;
+		}
+	}
+	if (replay->nsources == BENCH_TARGETS) {
+		return -1;
+	}
+	replay->sources[replay->nsources] = strdup(addr);
+	return replay->sources[replay->nsources] ? (long)replay->nsources++ : -1;
+}
+
+/**
+ * @param replay - replay set to fill
+ * @param payload - echo payload size
+ * @param count - replies to synthesize
+ * @return 0 on success, 1 on failure
+ *
+ * Synthesizes echo replies alternating between 127.0.0.1, with the IPv4 header
+ * a raw socket delivers, and ::1, sequences counting up per target
+ */
+static int synthesize_replies(t_replay *replay, size_t payload, size_t count) {
+	struct sockaddr_storage from[2];
+
+	memset(from, 0, sizeof(from));
+	from[0].ss_family = AF_INET;
+	((struct sockaddr_in*)&from[0])->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	from[1].ss_family = AF_INET6;
+	((struct sockaddr_in6*)&from[1])->sin6_addr = in6addr_loopback;
+	add_source(replay, &from[0]);
+	add_source(replay, &from[1]);
+
+	for (size_t i = 0; i < count; i++) {
+		t_reply *reply = add_reply(replay);
+		if (!reply) {
+			return 1;
+		}
+		int v4 = (i % 2 == 0);
+		size_t ip_len = v4 ? sizeof(struct iphdr) : 0;
+		reply->from = from[!v4];
+		reply->target = !v4;
+		reply->sequence = i / 2;
+		reply->len = ip_len + sizeof(struct icmphdr) + payload;
+		reply->data = calloc(1, reply->len);
+		if (!reply->data) {
+			return 1;
+		}
+		if (v4) {
+			struct iphdr *ip = (struct iphdr*)reply->data;
+			ip->version = 4;
+			ip->ihl = 5;
+			ip->ttl = 64;
+			ip->protocol = IPPROTO_ICMP;
+			ip->tot_len = htons(reply->len);
+			ip->saddr = htonl(INADDR_LOOPBACK);
+			ip->daddr = htonl(INADDR_LOOPBACK);
+		}
+		struct icmphdr *icmp = (struct icmphdr*)(reply->data + ip_len);
+		icmp->type = v4 ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY;
+		icmp->un.echo.id = htons(BENCH_PID);
+		icmp->un.echo.sequence = htons(reply->sequence);
+		icmp->checksum = inet_checksum(icmp, reply->len - ip_len);
+	}
+	return 0;
+}
+
+/**
+ * @param replay - replay set to fill
+ * @param link - LINKTYPE_IPV4 or LINKTYPE_IPV6
+ * @param data - captured packet, starting at its IP header
+ * @param len - captured length
+ *
+ * Keeps echo replies in the form a raw IPv4 or any IPv6 socket returns them,
+ * with the identifier rewritten to the one the replay uses and the checksum
+ * adjusted to match
+ */
+static void add_captured(t_replay *replay, int link, const uint8_t *data, size_t len) {
+	struct sockaddr_storage from;
+	size_t ip_len;
+	size_t skip;
+
+	memset(&from, 0, sizeof(from));
+	if (link == LINKTYPE_IPV4 && len >= sizeof(struct iphdr)) {
+		const struct iphdr *ip = (const struct iphdr*)data;
+		ip_len = ip->ihl * 4;
+		if (ip->protocol != IPPROTO_ICMP || len < ip_len + sizeof(struct icmphdr) ||
+			data[ip_len] != ICMP_ECHOREPLY) {
+			return;
+		}
+		from.ss_family = AF_INET;
+		memcpy(&((struct sockaddr_in*)&from)->sin_addr, &ip->saddr, 4);
+		skip = 0;
+	} else if (link == LINKTYPE_IPV6 && len >= sizeof(struct ip6_hdr) + sizeof(struct icmphdr)) {
+		const struct ip6_hdr *ip6 = (const struct ip6_hdr*)data;
+		ip_len = sizeof(struct ip6_hdr);
+		if (ip6->ip6_nxt != IPPROTO_ICMPV6 || data[ip_len] != ICMP6_ECHO_REPLY) {
+			return;
+		}
+		from.ss_family = AF_INET6;
+		((struct sockaddr_in6*)&from)->sin6_addr = ip6->ip6_src;
+		skip = ip_len;
+	} else {
+		return;
+	}
+
+	long target = add_source(replay, &from);
+	t_reply *reply = (target >= 0) ? add_reply(replay) : NULL;
+	if (!reply) {
+		return;
+	}
+	reply->from = from;
+	reply->target = target;
+	reply->len = len - skip;
+	reply->data = malloc(reply->len);
+	if (!reply->data) {
+		replay->count--;
+		return;
+	}
+	memcpy(reply->data, data + skip, reply->len);
+	struct icmphdr *icmp = (struct icmphdr*)(reply->data + ip_len - skip);
+	reply->sequence = ntohs(icmp->un.echo.sequence);
+	icmp->checksum = inet_checksum_adjust(icmp->checksum, icmp->un.echo.id, htons(BENCH_PID));
+	icmp->un.echo.id = htons(BENCH_PID);
+}
+
+/**
+ * @param replay - replay set to fill
+ * @param path - pcapng file written by ft_ping --pcap
+ * @return 0 on success, 1 on failure
+ *
+ * Reads the echo replies of a capture in host byte order, the order ft_ping
+ * writes it in
+ */
+static int load_capture(t_replay *replay, const char *path) {
+	int links[PCAPNG_INTERFACES];
+	size_t nlinks = 0;
+	uint32_t head[2];
+	int ret = 0;
+
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "bench: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	while (fread(head, sizeof(head), 1, file) == 1) {
+		if (head[1] < 12 || head[1] % 4) {
+			ret = 1;
+			break;
+		}
+		size_t body_len = head[1] - 12;
+		uint8_t *body = malloc(body_len + 4);
+		if (!body || fread(body, body_len + 4, 1, file) != 1) {
+			free(body);
+			ret = 1;
+			break;
+		}
+		if (head[0] == PCAPNG_SHB && (body_len < 4 || *(uint32_t*)body != PCAPNG_BYTE_ORDER)) {
+			fprintf(stderr, "bench: %s: not a host byte order pcapng file\n", path);
+			free(body);
+			fclose(file);
+			return 1;
+		}
+		if (head[0] == PCAPNG_IDB && body_len >= 2 && nlinks < PCAPNG_INTERFACES) {
+			links[nlinks++] = *(uint16_t*)body;
+		}
+		if (head[0] == PCAPNG_EPB && body_len >= 20) {
+			uint32_t interface = ((uint32_t*)body)[0];
+			uint32_t captured = ((uint32_t*)body)[3];
+			uint32_t original = ((uint32_t*)body)[4];
+			if (interface < nlinks && captured == original && 20 + captured <= body_len) {
+				add_captured(replay, links[interface], body + 20, captured);
+			}
+		}
+		free(body);
+	}
+	fclose(file);
+	if (ret) {
+		fprintf(stderr, "bench: %s: truncated or malformed pcapng file\n", path);
+	} else if (replay->count == 0) {
+		fprintf(stderr, "bench: %s: no echo replies\n", path);
+		ret = 1;
+	}
+	return ret;
+}
+
+/**
+ * @param state - ping state to set up
+ * @param replay - replay set whose sources become the targets
+ * @param payload - echo payload size (-s)
+ * @return 0 on success, 1 on failure
+ *
+ * Prepares a state the way main() does up to the sockets, then configures the
+ * connection like a raw socket without opening one
+ */
+static int setup_state(t_ping_state *state, t_replay *replay, size_t payload) {
+	char size[16];
+	char *argv[BENCH_TARGETS + 4] = {"ft_ping", "-s", size};
+	int argc = 3;
+
+	snprintf(size, sizeof(size), "%zu", payload);
+	for (size_t i = 0; i < replay->nsources; i++) {
+		argv[argc++] = replay->sources[i];
+	}
+	memset(state, 0, sizeof(*state));
+	state->shard.count = 1;
+	state->shard.stop_fd = -1;
+	state->shard.done_fd = -1;
+	state->shard.status_fd = -1;
+	state->loop.epoll_fd = -1;
+	state->loop.timer_fd = -1;
+	state->loop.signal_fd = -1;
+	state->writer.wake_fd = -1;
+	state->metrics.listen_fd = -1;
+	optind = 0;
+	if (parseArgs(state, argc, argv) || resolveHost(state, argv)) {
+		return 1;
+	}
+	state->opts.interval = 0; // widest packet table, a replay pass never wraps it
+	state->conn.socktype = SOCK_RAW;
+	state->conn.ipv4.sockfd = -1;
+	state->conn.ipv6.sockfd = -1;
+	state->conn.ipv4.pid = BENCH_PID;
+	state->conn.ipv6.pid = BENCH_PID;
+	if (init_packet_system(state) || init_output(state)) {
+		return 1;
+	}
+	return 0;
+}
+
+static void teardown_state(t_ping_state *state) {
+	fflush(stdout);
+	cleanup_output(state);
+	cleanup_packets(state);
+	cleanup_targets(state);
+}
+
+static void free_replay(t_replay *replay) {
+	for (size_t i = 0; i < replay->count; i++) {
+		free(replay->replies[i].data);
+	}
+	for (size_t i = 0; i < replay->nsources; i++) {
+		free(replay->sources[i]);
+	}
+	free(replay->replies);
+	memset(replay, 0, sizeof(*replay));
+}
+
+/**
+ * Puts every reply's probe in flight untimed, then times parse_icmp_reply()
+ * over them: target lookup, RTT, statistics, output record and table removal
+ */
+static void bench_parse(t_bench *bench, uint64_t iterations) {
+	t_ping_state *state = bench->state;
+	t_replay *replay = bench->replay;
+	size_t pass = MIN(replay->count, state->targets[0].packets.mask + 1);
+	uint64_t done = 0;
+	size_t next = 0;
+
+	while (done < iterations) {
+		size_t chunk = MIN(pass, iterations - done);
+		size_t first = next;
+		for (size_t i = 0; i < chunk; i++) {
+			t_reply *reply = &replay->replies[(first + i) % replay->count];
+			t_packet_entry *entry = create_packet(state, &state->targets[reply->target], reply->sequence);
+			entry->tx_stamp = (int64_t)(done + i) * NSEC_PER_USEC;
+		}
+		bench_start(bench);
+		for (size_t i = 0; i < chunk; i++) {
+			t_reply *reply = &replay->replies[(first + i) % replay->count];
+			int64_t rx_time = (int64_t)(done + i) * NSEC_PER_USEC + BENCH_RTT_NS + (i % 1024) * 10 * NSEC_PER_USEC;
+			bench->unmatched += parse_icmp_reply(reply->data, reply->len, state, &reply->from, rx_time, -1);
+		}
+		bench_stop(bench);
+		next = (first + chunk) % replay->count;
+		done += chunk;
+	}
+}
+
+static void bench_rtt(t_bench *bench, uint64_t iterations) {
+	t_packet_entry entry;
+	double sum = 0.0;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.tx_stamp = NSEC_PER_SEC;
+	bench_start(bench);
+	for (uint64_t i = 0; i < iterations; i++) {
+		sum += calculate_rtt(&entry, NSEC_PER_SEC + BENCH_RTT_NS + (int64_t)(i & 1023) * NSEC_PER_USEC, 56);
+	}
+	bench_stop(bench);
+	bench->sink += (uint64_t)sum;
+}
+
+static void bench_stats(t_bench *bench, uint64_t iterations) {
+	t_ping_stats *stats = calloc(1, sizeof(*stats));
+
+	if (!stats) {
+		return;
+	}
+	bench_start(bench);
+	for (uint64_t i = 0; i < iterations; i++) {
+		update_rtt_stats(stats, 20.0 + (i & 1023) * 0.01);
+	}
+	bench_stop(bench);
+	bench->sink += stats->rtt_count;
+	histogram_free(&stats->rtt_hist);
+	free(stats);
+}
+
+static void bench_create(t_bench *bench, uint64_t iterations) {
+	t_ping_state *state = bench->state;
+
+	bench_start(bench);
+	for (uint64_t i = 0; i < iterations; i++) {
+		bench->sink += create_packet(state, &state->targets[i & 1], i)->sequence;
+	}
+	bench_stop(bench);
+}
+
+static void bench_checksum(t_bench *bench, uint64_t iterations) {
+	t_ping_state *state = bench->state;
+
+	bench_start(bench);
+	for (uint64_t i = 0; i < iterations; i++) {
+		state->templates[0].packet->header.un.echo.sequence = i;
+		bench->sink += calculate_checksum(state, state->templates[0].packet);
+	}
+	bench_stop(bench);
+}
+
+/**
+ * @param bench - benchmark context
+ * @param name - benchmark name
+ * @param size - payload size column, -1 for a capture's mixed sizes
+ * @param replay - replies to parse, their sources become the targets
+ * @return 0 on success, 1 on failure
+ */
+static int run_replay(t_bench *bench, const char *name, long size, t_replay *replay) {
+	t_ping_state state;
+
+	if (setup_state(&state, replay, size >= 0 ? (size_t)size : 56)) {
+		return 1;
+	}
+	bench->state = &state;
+	bench->replay = replay;
+	run_bench(name, size, bench, bench_parse);
+	teardown_state(&state);
+	return 0;
+}
+
+/**
+ * Replays synthesized echo replies, or those of a capture given as argument,
+ * through the receive path and times the packet building blocks at several
+ * payload sizes. Needs no sockets and no privileges; per-reply output goes to
+ * /dev/null, the report to the original stdout
+ */
+int main(int argc, char **argv) {
+	static const size_t sizes[] = {0, 56, 1472, 65507};
+	t_bench bench;
+	t_replay replay;
+	t_replay captured;
+	t_ping_state state;
+	int ret = 0;
+
+	int out = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	report = (out >= 0) ? fdopen(out, "w") : NULL;
+	if (!report || null < 0 || dup2(null, STDOUT_FILENO) < 0) {
+		fprintf(stderr, "bench: cannot redirect stdout: %s\n", strerror(errno));
+		return 1;
+	}
+	close(null);
+
+	memset(&bench, 0, sizeof(bench));
+	memset(&replay, 0, sizeof(replay));
+	memset(&captured, 0, sizeof(captured));
+	if (argc > 1 && load_capture(&captured, argv[1])) {
+		free_replay(&captured);
+		return 1;
+	}
+	fprintf(report, "built with: %s\n", BENCH_CFLAGS);
+	fprintf(report, "%-20s %6s %12s %10s %10s\n", "benchmark", "size", "iterations", "ns/op", "allocs/op");
+	for (size_t i = 1; i < 3 && !ret; i++) {
+		ret = synthesize_replies(&replay, sizes[i], BENCH_REPLIES) ||
+			  run_replay(&bench, "parse_icmp_reply", sizes[i], &replay);
+		free_replay(&replay);
+	}
+	if (!ret && captured.count) {
+		ret = run_replay(&bench, "replay", -1, &captured);
+		fprintf(report, "%-20s %zu replies from %zu sources in %s\n", "", captured.count, captured.nsources, argv[1]);
+	}
+	free_replay(&captured);
+	if (!ret) {
+		run_bench("calculate_rtt", -1, &bench, bench_rtt);
+		run_bench("update_rtt_stats", -1, &bench, bench_stats);
+	}
+
+	synthesize_replies(&replay, 0, 0);
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !ret; i++) {
+		ret = setup_state(&state, &replay, sizes[i]);
+		if (ret) {
+			break;
+		}
+		bench.state = &state;
+		run_bench("create_packet", sizes[i], &bench, bench_create);
+		run_bench("calculate_checksum", sizes[i], &bench, bench_checksum);
+		teardown_state(&state);
+	}
+	free_replay(&replay);
+	fclose(report);
+	return ret;
+}
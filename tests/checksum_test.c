@@ -0,0 +1,80 @@
+#include "../includes/ft_ping.h"
+
+#define MAX_CHECKSUM_LEN (65507 + sizeof(struct icmphdr))
+#define MAX_OFFSET 4
+
+typedef struct s_kernel {
+	const char	*name;
+	uint16_t	(*fn)(const void *data, size_t len);
+	int			supported;
+} t_kernel;
+
+/**
+ * @param buffer - buffer to fill
+ * @param len - buffer length
+ * @param seed - pattern selector
+ * 
+ * Fills buffer with pseudo-random bytes, or all ones to force maximum carries
+ */
+static void fill_buffer(uint8_t *buffer, size_t len, int seed) {
+	uint32_t x = 2463534242u + seed;
+	for (size_t i = 0; i < len; i++) {
+		if (seed == 0) {
+			buffer[i] = 0xFF;
+			continue;
+		}
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buffer[i] = x;
+	}
+}
+
+/**
+ * Compares every vector checksum kernel supported by this CPU against the scalar
+ * path for all ICMP sizes 0..65515 at even and odd buffer alignments
+ */
+int main(void) {
+	t_kernel kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+		{"sse2", inet_checksum_sse2, __builtin_cpu_supports("sse2")},
+		{"avx2", inet_checksum_avx2, __builtin_cpu_supports("avx2")},
+#endif
+		{"dispatch", inet_checksum, 1},
+	};
+	size_t nkernels = sizeof(kernels) / sizeof(kernels[0]);
+	uint8_t *buffer = malloc(MAX_CHECKSUM_LEN + MAX_OFFSET);
+	int failures = 0;
+	
+	if (!buffer) {
+		fprintf(stderr, "malloc failed for test buffer\n");
+		return 1;
+	}
+	
+	for (int seed = 0; seed < 2; seed++) {
+		fill_buffer(buffer, MAX_CHECKSUM_LEN + MAX_OFFSET, seed);
+		for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+			for (size_t len = 0; len <= MAX_CHECKSUM_LEN; len++) {
+				uint16_t expected = inet_checksum_scalar(buffer + offset, len);
+				for (size_t k = 0; k < nkernels; k++) {
+					if (!kernels[k].supported) {
+						continue;
+					}
+					uint16_t got = kernels[k].fn(buffer + offset, len);
+					if (got != expected && failures++ < 10) {
+						fprintf(stderr, "%s: len %zu offset %zu: got 0x%04x, expected 0x%04x\n",
+								kernels[k].name, len, offset, got, expected);
+					}
+				}
+			}
+		}
+	}
+	free(buffer);
+	
+	for (size_t k = 0; k < nkernels; k++) {
+		fprintf(stdout, "checksum %s: %s\n", kernels[k].name,
+				!kernels[k].supported ? "skipped (unsupported cpu)" : failures ? "FAIL" : "ok");
+	}
+	fprintf(stdout, "dispatch selects %s\n", inet_checksum_kernel());
+	return failures != 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Socket filter accounting: on the loopback of a private network namespace the
+# only ICMP messages are ours, so the filters reject exactly the echo requests
+# the raw sockets see go by, one per probe, whether or not the run is sharded.
+#
+# Usage: make test (as root, skipped otherwise), or tests/filter_test.sh with
+# PING pointing at the binary
+set -eu
+
+PING=${PING:-./ft_ping}
+COUNT=50
+TARGETS="127.0.0.1 127.0.0.2 127.0.0.3 127.0.0.4"
+NS=ftping-filter-$$
+failed=0
+
+if [ "$(id -u)" -ne 0 ] || ! ip netns add "$NS" 2>/dev/null; then
+	echo "filter: skipped, needs root and network namespaces"
+	exit 0
+fi
+trap 'ip netns del "$NS" 2>/dev/null || true' EXIT INT TERM
+ip -n "$NS" link set lo up
+
+expected=$((COUNT * $(echo $TARGETS | wc -w)))
+for threads in 1 4; do
+	rejected=$(ip netns exec "$NS" "$PING" -v -c "$COUNT" -i 0.01 -j "$threads" $TARGETS |
+		sed -n 's/^ping: socket filter rejected \([0-9]*\) .*/\1/p')
+	if [ "$rejected" = "$expected" ]; then
+		echo "filter -j $threads: ok"
+	else
+		echo "filter -j $threads: rejected ${rejected:-nothing}, expected $expected"
+		failed=1
+	fi
+done
+exit "$failed"
@@ -0,0 +1,89 @@
+#!/bin/sh
+# RTT accuracy benchmark: ft_ping against ft_ping_echo in a private network
+# namespace. The responder logs the delay it gave every reply, so each RTT
+# ft_ping measures is paired with its exact ground truth.
+#
+# Usage (root): make rtt-bench, or tests/rtt_bench.sh with the grid below
+# overridden from the environment, e.g. DELAYS="1:0 1:0.5" RATES=1000
+set -eu
+
+PING=${PING:-./ft_ping}
+ECHO=${ECHO:-./ft_ping_echo}
+DELAYS=${DELAYS:-"0:0 0.1:0 1:0 10:0 10:2"}	# injected delay:jitter, ms
+RATES=${RATES:-"100 1000 10000"}		# probes per second
+SIZES=${SIZES:-"56 1472"}			# payload bytes
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-2}		# probes per run = rate * this
+COUNT_MAX=${COUNT_MAX:-20000}			# ICMP sequence numbers stay unique
+
+NS=ftping-rtt-$$
+TMP=$(mktemp -d)
+
+cleanup() {
+	ip netns del "$NS" 2>/dev/null || true
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+ip netns add "$NS"
+ip -n "$NS" link set lo up
+
+echo "bias: mean of measured RTT - injected delay; sd: its standard deviation (variance = sd^2)"
+echo "stand-in: how late ft_ping_echo wrote the replies, part of the bias"
+echo "tool: RTT - injected delay - stand-in, the kernel path and ft_ping's own overhead"
+printf "%8s %8s %6s %5s %6s %8s %8s %8s %8s %8s %8s %8s\n" \
+	delay_ms jitter pps size n bias_us sd_us min_us max_us stand-in tool_us tool_sd
+for scenario in $DELAYS; do
+	delay=${scenario%%:*}
+	jitter=${scenario#*:}
+	for rate in $RATES; do
+		interval=$(awk -v r="$rate" 'BEGIN { printf "%.6f", 1 / r }')
+		count=$(awk -v r="$rate" -v s="$SECONDS_PER_RUN" -v m="$COUNT_MAX" \
+			'BEGIN { c = int(r * s); print (c > m) ? m : c }')
+		for size in $SIZES; do
+			ip netns exec "$NS" "$ECHO" -4 10.77.0.1/24 -D "$delay" -J "$jitter" \
+				-l "$TMP/echo.log" 2>"$TMP/echo.err" &
+			pid=$!
+			tries=0
+			until ip -n "$NS" link show ftping0 up 2>/dev/null | grep -q UP; do
+				tries=$((tries + 1))
+				if [ "$tries" -gt 100 ]; then
+					cat "$TMP/echo.err" >&2
+					exit 1
+				fi
+				sleep 0.01
+			done
+			ip netns exec "$NS" "$PING" -c "$count" -i "$interval" -s "$size" -o csv \
+				10.77.0.2 >"$TMP/ping.csv"
+			kill -INT "$pid"
+			wait "$pid" || true
+			awk -F, -v delay="$delay" -v jitter="$jitter" -v rate="$rate" -v size="$size" '
+				FILENAME == ARGV[1] { given[$1] = $2; late[$1] = $3; next }
+				$1 == "reply" && (($5 % 65536) in given) {
+					seq = $5 % 65536
+					error = ($8 - given[seq]) / 1000
+					n++
+					sum += error
+					squares += error * error
+					stand_in += late[seq] / 1000
+					tool = error - late[seq] / 1000
+					tool_sum += tool
+					tool_squares += tool * tool
+					if (n == 1 || error < min) min = error
+					if (n == 1 || error > max) max = error
+				}
+				END {
+					if (n == 0) {
+						printf "%8s %8s %6s %5s %6d\n", delay, jitter, rate, size, 0
+						exit
+					}
+					bias = sum / n
+					variance = squares / n - bias * bias
+					tool = tool_sum / n
+					tool_variance = tool_squares / n - tool * tool
+					printf "%8s %8s %6s %5s %6d %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+						delay, jitter, rate, size, n, bias, sqrt(variance > 0 ? variance : 0),
+						min, max, stand_in / n, tool, sqrt(tool_variance > 0 ? tool_variance : 0)
+				}' "$TMP/echo.log" "$TMP/ping.csv"
+		done
+	done
+done
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Regression test on the simulated network: a seeded -E sim run is fully
+# deterministic, so its transmitted, received, timeout, duplicate and corrupt
+# counts are checked exactly, single threaded and sharded. A corrupted reply
+# must fail its checksum and time out, never count as received.
+#
+# Usage: make test, or tests/sim_test.sh with PING pointing at the binary
+set -eu
+
+PING=${PING:-./ft_ping}
+SIM=delay=2,jitter=1,loss=0.1,dup=0.05,corrupt=0.05,seed=42
+TMP=$(mktemp -d)
+failed=0
+
+cleanup() {
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+# Prints "target transmitted received timeouts" per summary record, then the
+# replies the simulated network lost, duplicated and corrupted, and the ICMP
+# messages dropped on a bad checksum
+counts() {
+	"$PING" -E sim --sim "$SIM" -c 500 -i 0.001 -W 1 -j "$1" -o csv -v \
+		127.0.0.1 127.0.0.2 >"$TMP/out.csv" 2>"$TMP/err.txt"
+	awk -F, '
+		$1 == "timeout" { timeouts[$3]++; timeouts["\"*\""]++ }
+		$1 == "summary" { line[n++] = $3 " " $13 " " $14 }
+		END { for (i = 0; i < n; i++) { split(line[i], f, " "); print line[i], timeouts[f[1]] + 0 } }
+	' "$TMP/out.csv"
+	sed -n 's/^ping: sim: \([0-9]*\) replies lost, \([0-9]*\) duplicated, [0-9]* reordered, \([0-9]*\) corrupted.*/lost \1 duplicated \2 corrupted \3/p' "$TMP/err.txt"
+	sed -n 's/^ping: \([0-9]*\) ICMP messages dropped on a bad checksum/bad checksum \1/p' "$TMP/err.txt"
+}
+
+# check <threads> <expected counts, one line each>
+check() {
+	threads=$1
+	shift
+	printf '%s\n' "$@" >"$TMP/expected"
+	counts "$threads" >"$TMP/actual"
+	if cmp -s "$TMP/expected" "$TMP/actual"; then
+		echo "sim -j $threads: ok"
+	else
+		echo "sim -j $threads: counts differ (expected, actual)"
+		diff "$TMP/expected" "$TMP/actual" || true
+		failed=1
+	fi
+}
+
+check 1 \
+	'"127.0.0.1" 500 440 60' \
+	'"127.0.0.2" 500 419 81' \
+	'"*" 1000 859 141' \
+	'lost 98 duplicated 49 corrupted 43' \
+	'bad checksum 45'
+check 2 \
+	'"127.0.0.1" 500 427 73' \
+	'"127.0.0.2" 500 437 63' \
+	'"*" 1000 864 136' \
+	'lost 97 duplicated 44 corrupted 39' \
+	'bad checksum 42'
+exit "$failed"
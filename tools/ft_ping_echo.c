@@ -0,0 +1,693 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+#include <linux/if_tun.h>
+#include "../includes/ft_ping_checksum.h"
+
+#define ECHO_DEV "ftping0" // default TUN device name
+#define ECHO_MTU 65535 // whole probes of any -s arrive unfragmented
+#define ECHO_QUEUE_BYTES (64 << 20) // replies held back by the delay, plus room for a wrap entry
+#define ECHO_ENTRY_WRAP UINT32_MAX // queue entry telling the reader to go back to the start
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+
+typedef struct s_echo_entry {
+	int64_t		due;		// monotonic ns the reply is written at
+	int64_t		received;	// monotonic ns the request was read at
+	uint32_t	len;		// reply bytes following the entry, ECHO_ENTRY_WRAP at a wrap
+	uint32_t	reserved;
+} t_echo_entry;
+
+typedef struct s_echo {
+	int			tun_fd;
+	int			signal_fd;
+	char		dev[IFNAMSIZ];
+	int64_t		delay;		// ns added to every reply
+	int64_t		jitter;		// ns, the delay varies by up to this much either way
+	double		loss;		// probability a request is not answered
+	double		rate;		// replies per second, 0 for unlimited
+	double		burst;		// replies the rate limit lets through back to back
+	double		tokens;
+	int64_t		refilled_at;
+	uint64_t	rng;
+	FILE		*log;		// one line per reply written, -l
+	char		*queue;		// FIFO of t_echo_entry and reply, ECHO_QUEUE_BYTES
+	size_t		head;		// offset of the oldest entry
+	size_t		tail;		// offset the next entry is written at
+	size_t		used;
+	int64_t		last_due;	// replies leave in arrival order
+	struct {
+		uint64_t	requests;	// echo requests read
+		uint64_t	replied;	// replies written
+		uint64_t	lost;		// requests dropped by -L
+		uint64_t	limited;	// requests over the -r rate
+		uint64_t	overflowed;	// requests that found the delay queue full
+		uint64_t	ignored;	// datagrams that are not echo requests
+		uint64_t	failed;		// replies the device refused
+		int64_t		delay_min;	// delay given to replies, ns
+		int64_t		delay_max;
+		int64_t		delay_sum;
+		int64_t		late_max;	// how late replies were written after their due time, ns
+		int64_t		late_sum;
+	} count;
+} t_echo;
+
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @param echo - responder holding the random state
+ * @return uniform random number in [0, 1) (xorshift64*)
+ */
+static double echo_random(t_echo *echo) {
+	echo->rng ^= echo->rng >> 12;
+	echo->rng ^= echo->rng << 25;
+	echo->rng ^= echo->rng >> 27;
+	return ((echo->rng * 0x2545F4914F6CDD1DULL) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * @param packet - IP packet read from the device
+ * @param len - packet length
+ * @return 1 if the packet was turned into its echo reply in place, 0 if it is not an echo request
+ *
+ * Swaps source and destination and the ICMP type, adjusting the checksums. The
+ * ICMPv6 pseudo header sum does not change when the addresses swap
+ */
+static int make_reply(char *packet, size_t len) {
+	uint16_t before;
+	uint16_t after;
+
+	if (len >= sizeof(struct iphdr) && (packet[0] >> 4) == 4) {
+		struct iphdr *ip = (struct iphdr*)packet;
+		size_t ip_len = ip->ihl * 4;
+		struct icmphdr *icmp = (struct icmphdr*)(packet + ip_len);
+		if (ip->protocol != IPPROTO_ICMP || (ntohs(ip->frag_off) & (IP_MF | IP_OFFMASK)) ||
+			len < ip_len + sizeof(*icmp) || icmp->type != ICMP_ECHO) {
+			return 0;
+		}
+		uint32_t addr = ip->saddr;
+		ip->saddr = ip->daddr;
+		ip->daddr = addr;
+		memcpy(&before, &ip->ttl, sizeof(before));
+		ip->ttl = 64;
+		memcpy(&after, &ip->ttl, sizeof(after));
+		ip->check = inet_checksum_adjust(ip->check, before, after);
+		memcpy(&before, icmp, sizeof(before));
+		icmp->type = ICMP_ECHOREPLY;
+		memcpy(&after, icmp, sizeof(after));
+		icmp->checksum = inet_checksum_adjust(icmp->checksum, before, after);
+		return 1;
+	}
+	if (len >= sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr) && (packet[0] >> 4) == 6) {
+		struct ip6_hdr *ip6 = (struct ip6_hdr*)packet;
+		struct icmp6_hdr *icmp6 = (struct icmp6_hdr*)(packet + sizeof(*ip6));
+		if (ip6->ip6_nxt != IPPROTO_ICMPV6 || icmp6->icmp6_type != ICMP6_ECHO_REQUEST) {
+			return 0;
+		}
+		struct in6_addr addr = ip6->ip6_src;
+		ip6->ip6_src = ip6->ip6_dst;
+		ip6->ip6_dst = addr;
+		ip6->ip6_hlim = 64;
+		memcpy(&before, icmp6, sizeof(before));
+		icmp6->icmp6_type = ICMP6_ECHO_REPLY;
+		memcpy(&after, icmp6, sizeof(after));
+		icmp6->icmp6_cksum = inet_checksum_adjust(icmp6->icmp6_cksum, before, after);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @param echo - responder holding the rate limit
+ * @param now - monotonic time of the request
+ * @return 1 if the rate limit lets a reply through, 0 otherwise
+ *
+ * Token bucket refilled at -r replies per second, holding up to -b
+ */
+static int rate_allows(t_echo *echo, int64_t now) {
+	if (echo->rate <= 0.0) {
+		return 1;
+	}
+	echo->tokens += (now - echo->refilled_at) * echo->rate / NSEC_PER_SEC;
+	if (echo->tokens > echo->burst) {
+		echo->tokens = echo->burst;
+	}
+	echo->refilled_at = now;
+	if (echo->tokens < 1.0) {
+		return 0;
+	}
+	echo->tokens -= 1.0;
+	return 1;
+}
+
+/**
+ * @param echo - responder whose counters to update
+ * @param delay - delay the reply was given
+ * @param late - how long after its due time it was written
+ */
+static void count_reply(t_echo *echo, int64_t delay, int64_t late) {
+	if (echo->count.replied == 0 || delay < echo->count.delay_min) {
+		echo->count.delay_min = delay;
+	}
+	if (delay > echo->count.delay_max) {
+		echo->count.delay_max = delay;
+	}
+	if (late > echo->count.late_max) {
+		echo->count.late_max = late;
+	}
+	echo->count.delay_sum += delay;
+	echo->count.late_sum += late;
+	echo->count.replied++;
+}
+
+/**
+ * @param echo - responder owning the device
+ * @param packet - reply to write
+ * @param len - reply length
+ * @param received - monotonic time the request was read at
+ * @param due - monotonic time the reply was due at
+ *
+ * With -l, logs the reply's sequence number, the delay it was given and how
+ * late it was written, in ns
+ */
+static void send_reply(t_echo *echo, char *packet, size_t len, int64_t received, int64_t due) {
+	if (write(echo->tun_fd, packet, len) != (ssize_t)len) {
+		echo->count.failed++;
+		return;
+	}
+	int64_t late = now_ns() - due;
+	late = (late > 0) ? late : 0;
+	count_reply(echo, due - received, late);
+	if (echo->log) {
+		size_t offset = ((packet[0] >> 4) == 4) ? (size_t)(packet[0] & 0x0F) * 4 : sizeof(struct ip6_hdr);
+		struct icmphdr *icmp = (struct icmphdr*)(packet + offset);
+		fprintf(echo->log, "%u,%lld,%lld\n", ntohs(icmp->un.echo.sequence),
+			(long long)(due - received), (long long)late);
+	}
+}
+
+/**
+ * @param echo - responder holding the delay queue
+ * @param packet - reply to hold back
+ * @param len - reply length
+ * @param received - monotonic time the request was read at
+ * @param due - monotonic time the reply is due at
+ * @return 0 on success, 1 if the queue is full
+ */
+static int queue_reply(t_echo *echo, char *packet, size_t len, int64_t received, int64_t due) {
+	size_t need = sizeof(t_echo_entry) + ((len + 7) & ~(size_t)7);
+	size_t wasted = 0;
+
+	if (echo->tail + need > ECHO_QUEUE_BYTES) {
+		wasted = ECHO_QUEUE_BYTES - echo->tail;
+	}
+	if (echo->used + wasted + need > ECHO_QUEUE_BYTES) {
+		return 1;
+	}
+	if (wasted) {
+		((t_echo_entry*)(echo->queue + echo->tail))->len = ECHO_ENTRY_WRAP;
+		echo->used += wasted;
+		echo->tail = 0;
+	}
+	t_echo_entry *entry = (t_echo_entry*)(echo->queue + echo->tail);
+	entry->due = due;
+	entry->received = received;
+	entry->len = len;
+	memcpy(entry + 1, packet, len);
+	echo->tail += need;
+	echo->used += need;
+	return 0;
+}
+
+/**
+ * @param echo - responder holding the delay queue
+ * @return oldest queued reply, NULL if the queue is empty
+ */
+static t_echo_entry *queue_head(t_echo *echo) {
+	if (echo->used == 0) {
+		return NULL;
+	}
+	t_echo_entry *entry = (t_echo_entry*)(echo->queue + echo->head);
+	if (entry->len == ECHO_ENTRY_WRAP) {
+		echo->used -= ECHO_QUEUE_BYTES - echo->head;
+		echo->head = 0;
+		entry = (t_echo_entry*)echo->queue;
+	}
+	return entry;
+}
+
+/**
+ * @param echo - responder holding the delay queue
+ * @param now - current monotonic time
+ *
+ * Writes every queued reply whose time has come
+ */
+static void flush_due(t_echo *echo, int64_t now) {
+	t_echo_entry *entry;
+
+	while ((entry = queue_head(echo)) && entry->due <= now) {
+		size_t need = sizeof(t_echo_entry) + ((entry->len + 7) & ~(size_t)7);
+		send_reply(echo, (char*)(entry + 1), entry->len, entry->received, entry->due);
+		echo->head += need;
+		echo->used -= need;
+		now = now_ns();
+	}
+}
+
+/**
+ * @param echo - responder
+ * @param packet - datagram read from the device
+ * @param len - datagram length
+ * @param now - monotonic time it was read at
+ *
+ * Answers an echo request: applies loss and the rate limit, then writes the
+ * reply at once or queues it for its delay. Replies keep their arrival order,
+ * jitter delays a reply but never lets it overtake an earlier one
+ */
+static void handle_request(t_echo *echo, char *packet, size_t len, int64_t now) {
+	if (!make_reply(packet, len)) {
+		echo->count.ignored++;
+		return;
+	}
+	echo->count.requests++;
+	if (echo->loss > 0.0 && echo_random(echo) < echo->loss) {
+		echo->count.lost++;
+		return;
+	}
+	if (!rate_allows(echo, now)) {
+		echo->count.limited++;
+		return;
+	}
+	int64_t due = now + echo->delay;
+	if (echo->jitter > 0) {
+		due += (int64_t)((2.0 * echo_random(echo) - 1.0) * echo->jitter);
+	}
+	if (due < echo->last_due) {
+		due = echo->last_due;
+	}
+	if (due <= now && echo->used == 0) {
+		send_reply(echo, packet, len, now, now);
+		return;
+	}
+	if (queue_reply(echo, packet, len, now, due) != 0) {
+		echo->count.overflowed++;
+		return;
+	}
+	echo->last_due = due;
+}
+
+/**
+ * @param echo - responder whose counters to print
+ *
+ * Prints the ground truth counters: what was asked, answered and dropped, the
+ * delay replies were given and how late the responder wrote them
+ */
+static void print_counters(t_echo *echo) {
+	fprintf(stderr, "ft_ping_echo: %llu requests, %llu replied, %llu lost, %llu rate limited, "
+		"%llu queue full, %llu write errors, %llu other datagrams\n",
+		(unsigned long long)echo->count.requests, (unsigned long long)echo->count.replied,
+		(unsigned long long)echo->count.lost, (unsigned long long)echo->count.limited,
+		(unsigned long long)echo->count.overflowed, (unsigned long long)echo->count.failed,
+		(unsigned long long)echo->count.ignored);
+	if (echo->count.replied > 0) {
+		fprintf(stderr, "ft_ping_echo: delay min/avg/max = %.3f/%.3f/%.3f ms, written late avg/max = %.3f/%.3f ms\n",
+			(double)echo->count.delay_min / NSEC_PER_MSEC,
+			(double)echo->count.delay_sum / echo->count.replied / NSEC_PER_MSEC,
+			(double)echo->count.delay_max / NSEC_PER_MSEC,
+			(double)echo->count.late_sum / echo->count.replied / NSEC_PER_MSEC,
+			(double)echo->count.late_max / NSEC_PER_MSEC);
+	}
+}
+
+/**
+ * @param sock - socket to configure the device through
+ * @param dev - device name
+ * @param request - SIOCSIFADDR or SIOCSIFNETMASK
+ * @param addr - IPv4 address or netmask
+ * @return 0 on success, -1 on failure
+ */
+static int set_ipv4(int sock, const char *dev, unsigned long request, in_addr_t addr) {
+	struct ifreq ifr;
+	struct sockaddr_in *sin = (struct sockaddr_in*)&ifr.ifr_addr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", dev);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = addr;
+	return ioctl(sock, request, &ifr);
+}
+
+/**
+ * @param cidr - address/prefix to parse, modified
+ * @param family - AF_INET or AF_INET6
+ * @param addr - parsed address
+ * @param prefix - parsed prefix length
+ * @return 0 on success, 1 on failure
+ */
+static int parse_cidr(char *cidr, int family, void *addr, int *prefix) {
+	char *slash = strchr(cidr, '/');
+	int max = (family == AF_INET) ? 32 : 128;
+	char *end;
+
+	*prefix = (family == AF_INET) ? 24 : 64;
+	if (slash) {
+		*slash = '\0';
+		*prefix = strtol(slash + 1, &end, 10);
+		if (end == slash + 1 || *end != '\0' || *prefix < 1 || *prefix > max) {
+			return 1;
+		}
+	}
+	return inet_pton(family, cidr, addr) != 1;
+}
+
+/**
+ * @param echo - responder to attach
+ * @param v4 - IPv4 address/prefix of the device, NULL for none
+ * @param v6 - IPv6 address/prefix of the device, NULL for none
+ * @return 0 on success, 1 on failure
+ *
+ * Creates the TUN device, or attaches to an existing one of that name, gives
+ * it its addresses and brings it up. The kernel routes the rest of each
+ * prefix into the device, so every other address in it answers. IPv6
+ * duplicate address detection is turned off, so the address is usable at once
+ */
+static int open_device(t_echo *echo, char *v4, char *v6) {
+	struct ifreq ifr;
+
+	echo->tun_fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", echo->dev);
+	if (echo->tun_fd < 0 || ioctl(echo->tun_fd, TUNSETIFF, &ifr) < 0) {
+		fprintf(stderr, "ft_ping_echo: %s: %s\n", echo->dev, strerror(errno));
+		return 1;
+	}
+	snprintf(echo->dev, sizeof(echo->dev), "%s", ifr.ifr_name);
+
+	int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	int ret = (sock < 0);
+	ifr.ifr_mtu = ECHO_MTU;
+	ret = ret || ioctl(sock, SIOCSIFMTU, &ifr) < 0;
+	if (!ret && v4) {
+		struct in_addr addr;
+		int prefix;
+		if (parse_cidr(v4, AF_INET, &addr, &prefix)) {
+			fprintf(stderr, "ft_ping_echo: invalid IPv4 address: %s\n", v4);
+			close(sock);
+			return 1;
+		}
+		ret = set_ipv4(sock, echo->dev, SIOCSIFADDR, addr.s_addr) < 0 ||
+			  set_ipv4(sock, echo->dev, SIOCSIFNETMASK, htonl(~0U << (32 - prefix))) < 0;
+	}
+	if (!ret && v6) {
+		char path[128];
+		snprintf(path, sizeof(path), "/proc/sys/net/ipv6/conf/%s/accept_dad", echo->dev);
+		int fd = open(path, O_WRONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			ret = write(fd, "0", 1) != 1;
+			close(fd);
+		}
+		struct {
+			struct in6_addr	addr;
+			uint32_t		prefix;
+			int				ifindex;
+		} req;
+		int prefix;
+		if (parse_cidr(v6, AF_INET6, &req.addr, &prefix)) {
+			fprintf(stderr, "ft_ping_echo: invalid IPv6 address: %s\n", v6);
+			close(sock);
+			return 1;
+		}
+		req.prefix = prefix;
+		req.ifindex = if_nametoindex(echo->dev);
+		int sock6 = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		ret = sock6 < 0 || ioctl(sock6, SIOCSIFADDR, &req) < 0;
+		if (sock6 >= 0) {
+			close(sock6);
+		}
+	}
+	if (!ret) {
+		ret = ioctl(sock, SIOCGIFFLAGS, &ifr) < 0;
+		ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+		ret = ret || ioctl(sock, SIOCSIFFLAGS, &ifr) < 0;
+	}
+	if (ret) {
+		fprintf(stderr, "ft_ping_echo: configuring %s: %s\n", echo->dev, strerror(errno));
+	}
+	if (sock >= 0) {
+		close(sock);
+	}
+	return ret;
+}
+
+/**
+ * @param str - milliseconds, fractions allowed
+ * @param result - parsed time in ns
+ * @return 0 on success, 1 on failure
+ */
+static int parse_ms(const char *str, int64_t *result) {
+	char *end;
+	double ms = strtod(str, &end);
+
+	if (end == str || *end != '\0' || !(ms >= 0.0 && ms <= 3600000.0)) {
+		return 1;
+	}
+	*result = (int64_t)(ms * NSEC_PER_MSEC + 0.5);
+	return 0;
+}
+
+/**
+ * @param str - non negative number
+ * @param max - largest value accepted
+ * @param result - parsed value
+ * @return 0 on success, 1 on failure
+ */
+static int parse_number(const char *str, double max, double *result) {
+	char *end;
+	double value = strtod(str, &end);
+
+	if (end == str || *end != '\0' || !(value >= 0.0 && value <= max)) {
+		return 1;
+	}
+	*result = value;
+	return 0;
+}
+
+static void usage(const char *arg) {
+	fprintf(stderr, "Usage:\n %s [options]\n", arg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -d <device>	TUN device to create or attach to (default %s)\n", ECHO_DEV);
+	fprintf(stderr, "  -4 <addr/len>	IPv4 address of the device, the rest of the prefix answers\n");
+	fprintf(stderr, "  -6 <addr/len>	IPv6 address of the device, the rest of the prefix answers\n");
+	fprintf(stderr, "  -D <ms>	Delay every reply by <ms> milliseconds\n");
+	fprintf(stderr, "  -J <ms>	Vary the delay uniformly by up to <ms> either way\n");
+	fprintf(stderr, "  -L <percent>	Leave <percent> of the requests unanswered\n");
+	fprintf(stderr, "  -r <pps>	Answer at most <pps> requests per second\n");
+	fprintf(stderr, "  -b <burst>	Let <burst> requests through back to back under -r (default 1)\n");
+	fprintf(stderr, "  -S <seed>	Seed of the loss and jitter random stream (default 1)\n");
+	fprintf(stderr, "  -l <file>	Log seq,delay_ns,late_ns of every reply to <file>\n");
+}
+
+/**
+ * @param echo - responder to set up
+ * @param argc - argument count
+ * @param argv - argument vector
+ * @return 0 on success, 1 on failure
+ */
+static int parse_options(t_echo *echo, int argc, char **argv, char **v4, char **v6) {
+	double value;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hd:4:6:D:J:L:r:b:S:l:")) != -1) {
+		switch (opt) {
+			case 'd':
+				snprintf(echo->dev, sizeof(echo->dev), "%s", optarg);
+				break;
+			case '4':
+				*v4 = optarg;
+				break;
+			case '6':
+				*v6 = optarg;
+				break;
+			case 'D':
+				if (parse_ms(optarg, &echo->delay)) {
+					fprintf(stderr, "ft_ping_echo: invalid delay: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'J':
+				if (parse_ms(optarg, &echo->jitter)) {
+					fprintf(stderr, "ft_ping_echo: invalid jitter: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'L':
+				if (parse_number(optarg, 100.0, &value)) {
+					fprintf(stderr, "ft_ping_echo: invalid loss: %s (must be 0-100)\n", optarg);
+					return 1;
+				}
+				echo->loss = value / 100.0;
+				break;
+			case 'r':
+				if (parse_number(optarg, 1e9, &echo->rate)) {
+					fprintf(stderr, "ft_ping_echo: invalid rate: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'b':
+				if (parse_number(optarg, 1e9, &echo->burst) || echo->burst < 1.0) {
+					fprintf(stderr, "ft_ping_echo: invalid burst: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'S':
+				if (parse_number(optarg, 1e18, &value)) {
+					fprintf(stderr, "ft_ping_echo: invalid seed: %s\n", optarg);
+					return 1;
+				}
+				echo->rng = (uint64_t)value * 0x9E3779B97F4A7C15ULL | 1;
+				break;
+			case 'l':
+				if (echo->log) {
+					fclose(echo->log);
+				}
+				echo->log = fopen(optarg, "we");
+				if (!echo->log) {
+					fprintf(stderr, "ft_ping_echo: %s: %s\n", optarg, strerror(errno));
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc || (!*v4 && !*v6)) {
+		usage(argv[0]);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @param echo - responder with its device open
+ * @return 0 when stopped by SIGINT or SIGTERM
+ *
+ * Sleeps until a request arrives or the oldest queued reply is due, answers
+ * every request read, writes every reply due. SIGQUIT prints the counters
+ * and the responder goes on. main() sets the timer slack to 1 ns, so the
+ * wait for a delayed reply is not rounded up by the default 50 us
+ */
+static int run(t_echo *echo) {
+	static char packet[ECHO_MTU];
+	struct pollfd fds[] = {
+		{.fd = echo->tun_fd, .events = POLLIN},
+		{.fd = echo->signal_fd, .events = POLLIN},
+	};
+
+	while (1) {
+		struct timespec wait;
+		struct timespec *timeout = NULL;
+		t_echo_entry *head = queue_head(echo);
+		if (head) {
+			int64_t left = head->due - now_ns();
+			left = (left > 0) ? left : 0;
+			wait.tv_sec = left / NSEC_PER_SEC;
+			wait.tv_nsec = left % NSEC_PER_SEC;
+			timeout = &wait;
+		}
+		if (ppoll(fds, 2, timeout, NULL) < 0 && errno != EINTR) {
+			perror("ft_ping_echo: ppoll");
+			return 1;
+		}
+		if (fds[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+			while (read(echo->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+				if (info.ssi_signo != SIGQUIT) {
+					return 0;
+				}
+				print_counters(echo);
+			}
+		}
+		ssize_t len;
+		while ((len = read(echo->tun_fd, packet, sizeof(packet))) > 0) {
+			handle_request(echo, packet, len, now_ns());
+			flush_due(echo, now_ns());
+		}
+		flush_due(echo, now_ns());
+	}
+}
+
+/**
+ * Answers ICMP and ICMPv6 echo requests routed into a TUN device, with
+ * programmable delay, jitter, loss and rate limit. Its counters are the ground
+ * truth ft_ping's statistics can be checked against
+ */
+int main(int argc, char **argv) {
+	t_echo echo;
+	char *v4 = NULL;
+	char *v6 = NULL;
+	sigset_t mask;
+
+	memset(&echo, 0, sizeof(echo));
+	snprintf(echo.dev, sizeof(echo.dev), "%s", ECHO_DEV);
+	echo.burst = 1.0;
+	echo.rng = 0x9E3779B97F4A7C15ULL | 1;
+	echo.tun_fd = -1;
+	if (parse_options(&echo, argc, argv, &v4, &v6)) {
+		return 1;
+	}
+	echo.tokens = echo.burst;
+	echo.refilled_at = now_ns();
+	prctl(PR_SET_TIMERSLACK, 1UL);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	echo.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	echo.queue = malloc(ECHO_QUEUE_BYTES + sizeof(t_echo_entry));
+	if (echo.signal_fd < 0 || !echo.queue) {
+		perror("ft_ping_echo");
+		return 1;
+	}
+	if (open_device(&echo, v4, v6)) {
+		free(echo.queue);
+		return 1;
+	}
+	fprintf(stderr, "ft_ping_echo: answering on %s\n", echo.dev);
+	int ret = run(&echo);
+	print_counters(&echo);
+	close(echo.tun_fd);
+	close(echo.signal_fd);
+	free(echo.queue);
+	if (echo.log) {
+		fclose(echo.log);
+	}
+	return ret;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ft_ping_shm.h"
+
+/**
+ * @param name - target name
+ * @param block - snapshot of the target's counters
+ *
+ * Prints one target's counters in the style of the ft_ping summary line
+ */
+static void print_block(const char *name, t_shm_target *block) {
+	long loss = (block->sent > 0) ? (long)((block->sent - block->received) * 100 / block->sent) : 0;
+
+	printf("%s: %llu/%llu packets, %ld%% loss, %llu errors", name,
+		(unsigned long long)block->received, (unsigned long long)block->sent, loss,
+		(unsigned long long)block->errors);
+	if (block->rtt_count > 0) {
+		printf(", min/avg/max = %.3f/%.3f/%.3f ms", block->min_rtt_ns / 1e6,
+			block->sum_rtt_ns / 1e6 / block->rtt_count, block->max_rtt_ns / 1e6);
+	}
+	printf("\n");
+}
+
+/**
+ * @param header - mapped segment
+ *
+ * Prints every target from a consistent snapshot of its block, then the totals
+ * summed from the same snapshots
+ */
+static void print_segment(t_shm_header *header) {
+	t_shm_target total = {0};
+
+	for (uint32_t i = 0; i < header->ntargets; i++) {
+		t_shm_target block;
+		shm_read_target(shm_target(header, i), &block);
+		print_block(block.name, &block);
+		if (block.rtt_count > 0 && (total.rtt_count == 0 || block.min_rtt_ns < total.min_rtt_ns)) {
+			total.min_rtt_ns = block.min_rtt_ns;
+		}
+		if (block.max_rtt_ns > total.max_rtt_ns) {
+			total.max_rtt_ns = block.max_rtt_ns;
+		}
+		total.sent += block.sent;
+		total.received += block.received;
+		total.errors += block.errors;
+		total.rtt_count += block.rtt_count;
+		total.sum_rtt_ns += block.sum_rtt_ns;
+	}
+	if (header->ntargets > 1) {
+		print_block("total", &total);
+	}
+}
+
+/**
+ * Prints the statistics an ft_ping --shm <name> run publishes, once or every
+ * <interval> seconds until the run ends. Never signals or blocks the ping
+ */
+int main(int argc, char **argv) {
+	char path[4096];
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage:\n %s <name|path> [interval]\n", argv[0]);
+		return 1;
+	}
+	snprintf(path, sizeof(path), (argv[1][0] == '/') ? "%s" : "/dev/shm/%s", argv[1]);
+	double interval = (argc == 3) ? atof(argv[2]) : 0.0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		return 1;
+	}
+	if ((size_t)st.st_size < sizeof(t_shm_header)) {
+		fprintf(stderr, "%s: not an ft_ping segment\n", path);
+		return 1;
+	}
+	t_shm_header *header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || header->version != SHM_VERSION ||
+		header->header_size + (size_t)header->ntargets * header->target_size > (size_t)st.st_size) {
+		fprintf(stderr, "%s: not an ft_ping segment or not version %d\n", path, SHM_VERSION);
+		return 1;
+	}
+
+	while (1) {
+		int running = __atomic_load_n(&header->running, __ATOMIC_ACQUIRE) &&
+					  (kill(header->pid, 0) == 0 || errno == EPERM);
+		printf("--- pid %d%s ---\n", header->pid, running ? "" : " (ended)");
+		print_segment(header);
+		fflush(stdout);
+		if (interval <= 0.0 || !running) {
+			break;
+		}
+		usleep((useconds_t)(interval * 1e6));
+	}
+	munmap(header, st.st_size);
+	return 0;
+}